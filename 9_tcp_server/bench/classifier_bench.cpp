@@ -0,0 +1,292 @@
+// `PacketClassifier`的基准测试：比较`DispatchBurst`第一阶段的两种做法每个数据包花费的CPU周期：
+// 1. 逐个`ClassifyPacket`完整解析，再检查目的IP和端口，按照类别放入不同的数组(使用分类器之前的做法)
+// 2. `PacketClassifier`各个实现一次判断一批数据包的类别，按照类别分组，每一组再用`ParseClassified`连续解析，丢弃的数据包不解析
+// 同时检查各个实现的分类结果和解析结果与`ClassifyPacket`完全相同。
+// 数据包有两种组合：局域网(大部分是发给自己的TCP/UDP)和扫描(大部分发往没有绑定的端口或者其他主机)。
+// 每一轮处理之前打乱数据包的顺序，避免分支预测器记住固定的顺序。不需要网卡，运行方法：
+//     make bench
+//     make bench BENCH_ARGS="-l 2 --no-huge --no-pci"
+
+#include "../src/configs.h"
+#include "../src/packet.h"
+#include "../src/packet_template.h"
+#include "../src/classifier.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <rte_lcore.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+
+#define BENCH_NB_PKTS 1024 // 每种组合的数据包数量，每一轮按照`MAX_PKT_BURST`分批处理一遍
+#define BENCH_ROUNDS 10000
+
+static const rte_be32_t local_ip = RTE_BE32(RTE_IPV4(192, 168, 1, 2));
+static const rte_be32_t remote_ip = RTE_BE32(RTE_IPV4(192, 168, 1, 3));
+static const rte_be32_t other_ip = RTE_BE32(RTE_IPV4(192, 168, 1, 4));
+static const struct rte_ether_addr local_mac = {{0x02, 0, 0, 0, 0, 0x02}};
+
+// 一种数据包和它在组合中的比例(/16)
+struct PacketKind
+{
+    int weight;
+    uint16_t ether_type;
+    uint8_t proto;
+    rte_be32_t dst_ip;
+    uint16_t dst_port;
+};
+
+static const PacketKind lan_mix[] = {
+    {8, RTE_ETHER_TYPE_IPV4, IPPROTO_TCP, local_ip, 8080},
+    {3, RTE_ETHER_TYPE_IPV4, IPPROTO_UDP, local_ip, 53},
+    {1, RTE_ETHER_TYPE_IPV4, IPPROTO_TCP, local_ip, 22},
+    {1, RTE_ETHER_TYPE_IPV4, IPPROTO_UDP, other_ip, 53},
+    {1, RTE_ETHER_TYPE_IPV4, IPPROTO_ICMP, local_ip, 0},
+    {1, RTE_ETHER_TYPE_ARP, 0, 0, 0},
+    {1, RTE_ETHER_TYPE_IPV6, 0, 0, 0},
+};
+
+static const PacketKind scan_mix[] = {
+    {4, RTE_ETHER_TYPE_IPV4, IPPROTO_TCP, local_ip, 8080},
+    {8, RTE_ETHER_TYPE_IPV4, IPPROTO_TCP, local_ip, 22},
+    {2, RTE_ETHER_TYPE_IPV4, IPPROTO_UDP, local_ip, 161},
+    {2, RTE_ETHER_TYPE_IPV4, IPPROTO_TCP, other_ip, 8080},
+};
+
+static struct rte_mbuf *BuildPacket(struct rte_mempool *pool, const PacketKind &kind)
+{
+    struct rte_mbuf *pkt = rte_pktmbuf_alloc(pool);
+    if (!pkt)
+        rte_exit(EXIT_FAILURE, "Cannot allocate mbuf\n");
+    if (kind.ether_type == RTE_ETHER_TYPE_IPV4)
+    {
+        PacketTemplate tmpl;
+        tmpl.Init(kind.proto, local_mac, remote_ip, kind.dst_ip, rte_cpu_to_be_16(40000), rte_cpu_to_be_16(kind.dst_port));
+        tmpl.Apply(pkt, 0, 64);
+        return pkt;
+    }
+
+    struct rte_ether_hdr *eth_hdr = (struct rte_ether_hdr *)rte_pktmbuf_append(pkt, sizeof(struct rte_ether_hdr) + sizeof(struct rte_arp_hdr));
+    memset(eth_hdr, 0, pkt->data_len);
+    eth_hdr->ether_type = rte_cpu_to_be_16(kind.ether_type);
+    if (kind.ether_type == RTE_ETHER_TYPE_ARP)
+    {
+        struct rte_arp_hdr *arp_hdr = (struct rte_arp_hdr *)(eth_hdr + 1);
+        arp_hdr->arp_hardware = rte_cpu_to_be_16(RTE_ARP_HRD_ETHER);
+        arp_hdr->arp_protocol = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+        arp_hdr->arp_opcode = rte_cpu_to_be_16(RTE_ARP_OP_REQUEST);
+        arp_hdr->arp_data.arp_sip = remote_ip;
+        arp_hdr->arp_data.arp_tip = local_ip;
+    }
+    return pkt;
+}
+
+static void BuildMix(struct rte_mempool *pool, const PacketKind *kinds, size_t nb_kinds, struct rte_mbuf **pkts)
+{
+    for (uint16_t i = 0; i < BENCH_NB_PKTS; i++)
+    {
+        int r = rand() % 16;
+        size_t k = 0;
+        while (k + 1 < nb_kinds && r >= kinds[k].weight)
+            r -= kinds[k++].weight;
+        pkts[i] = BuildPacket(pool, kinds[k]);
+    }
+}
+
+// 使用分类器之前的做法：每个数据包都完整解析一遍
+static PacketClass ClassifyBaseline(struct rte_mbuf *pkt, const LocalPortSet &ports, PacketInfo *info)
+{
+    PacketClass cls = ClassifyPacket(pkt, info);
+    if (cls != PacketClass::ARP && info->dst_ip != local_ip)
+        return PacketClass::UNKNOWN;
+    if ((cls == PacketClass::TCP || cls == PacketClass::UDP) && !ports.Contains(info->proto, info->dst_port))
+        return PacketClass::UNKNOWN;
+    return cls;
+}
+
+// 一批数据包按照类别分好的下标，和`DispatchBurst`第一阶段的结果相同
+struct Groups
+{
+    uint16_t index[CLASSIFY_NB_CLASSES][MAX_PKT_BURST];
+    uint16_t nb[CLASSIFY_NB_CLASSES];
+};
+
+static void BaselineBurst(struct rte_mbuf **pkts, const LocalPortSet &ports, PacketInfo *infos, Groups *groups)
+{
+    memset(groups->nb, 0, sizeof(groups->nb));
+    for (uint16_t i = 0; i < MAX_PKT_BURST; i++)
+    {
+        const uint8_t c = (uint8_t)ClassifyBaseline(pkts[i], ports, &infos[i]);
+        groups->index[c][groups->nb[c]++] = i;
+    }
+}
+
+// 和`Dispatcher::DispatchBurst`相同：按照类别分组，带IP Option的数据包在分组时逐个解析，之后每一组连续解析，格式错误的放入UNKNOWN
+template <PacketClass CLS>
+static void ParseGroup(struct rte_mbuf **pkts, PacketInfo *infos, Groups *groups, uint64_t parsed)
+{
+    uint16_t *group = groups->index[(uint8_t)CLS];
+    const uint16_t n = groups->nb[(uint8_t)CLS];
+    uint16_t nb_kept = 0;
+    for (uint16_t k = 0; k < n; k++)
+    {
+        const uint16_t i = group[k];
+        if (((parsed >> i) & 1) || ParseClassified<CLS>(pkts[i], &infos[i]) == CLS)
+            group[nb_kept++] = i;
+        else
+            groups->index[(uint8_t)PacketClass::UNKNOWN][groups->nb[(uint8_t)PacketClass::UNKNOWN]++] = i;
+    }
+    groups->nb[(uint8_t)CLS] = nb_kept;
+}
+
+static void ClassifierBurst(const PacketClassifier &classifier, struct rte_mbuf **pkts, const LocalPortSet &ports, PacketInfo *infos, Groups *groups)
+{
+    uint8_t classes[MAX_PKT_BURST];
+    classifier.Classify(pkts, MAX_PKT_BURST, local_ip, ports, classes);
+
+    memset(groups->nb, 0, sizeof(groups->nb));
+    uint64_t parsed = 0;
+    for (uint16_t i = 0; i < MAX_PKT_BURST; i++)
+    {
+        uint8_t c = classes[i];
+        if (unlikely(c == CLASSIFY_SLOW))
+        {
+            c = (uint8_t)ClassifyBaseline(pkts[i], ports, &infos[i]);
+            parsed |= 1ULL << i;
+        }
+        groups->index[c][groups->nb[c]++] = i;
+    }
+    ParseGroup<PacketClass::ARP>(pkts, infos, groups, parsed);
+    ParseGroup<PacketClass::ICMP>(pkts, infos, groups, parsed);
+    ParseGroup<PacketClass::UDP>(pkts, infos, groups, parsed);
+    ParseGroup<PacketClass::TCP>(pkts, infos, groups, parsed);
+}
+
+// 各个实现的分组和解析结果必须和逐个解析相同，返回不一致的批数
+static uint32_t Verify(const PacketClassifier &classifier, struct rte_mbuf **pkts, const LocalPortSet &ports)
+{
+    uint32_t mismatches = 0;
+    for (uint16_t base = 0; base < BENCH_NB_PKTS; base += MAX_PKT_BURST)
+    {
+        PacketInfo expected_infos[MAX_PKT_BURST], infos[MAX_PKT_BURST];
+        Groups expected, groups;
+        BaselineBurst(pkts + base, ports, expected_infos, &expected);
+        ClassifierBurst(classifier, pkts + base, ports, infos, &groups);
+        bool same = true;
+        for (uint8_t c = 0; c < CLASSIFY_NB_CLASSES; c++)
+        {
+            if (c == (uint8_t)PacketClass::UNKNOWN)
+            {
+                // 丢弃的数据包顺序可以不同
+                same &= groups.nb[c] == expected.nb[c];
+                continue;
+            }
+            same &= groups.nb[c] == expected.nb[c] && memcmp(groups.index[c], expected.index[c], sizeof(uint16_t) * groups.nb[c]) == 0;
+            for (uint16_t k = 0; same && k < groups.nb[c]; k++)
+                same &= memcmp(&infos[groups.index[c][k]], &expected_infos[groups.index[c][k]], sizeof(PacketInfo)) == 0;
+        }
+        mismatches += !same;
+    }
+    return mismatches;
+}
+
+// 处理`BENCH_ROUNDS`轮，每一轮之前打乱顺序(不计时)，返回总的周期数
+template <typename F>
+static uint64_t Measure(struct rte_mbuf **pkts, F &&burst, uint64_t *sink)
+{
+    struct rte_mbuf *order[BENCH_NB_PKTS];
+    memcpy(order, pkts, sizeof(order));
+    PacketInfo infos[MAX_PKT_BURST];
+    Groups groups;
+    uint64_t cycles = 0;
+    srand(2);
+    for (int round = 0; round < BENCH_ROUNDS; round++)
+    {
+        for (uint16_t i = BENCH_NB_PKTS - 1; i > 0; i--)
+            std::swap(order[i], order[rand() % (i + 1)]);
+        const uint64_t start = rte_rdtsc();
+        for (uint16_t base = 0; base < BENCH_NB_PKTS; base += MAX_PKT_BURST)
+        {
+            burst(order + base, infos, &groups);
+            // 读取解析的结果，避免被优化掉；一批中可能没有TCP数据包，只读取组内的下标
+            const uint8_t tcp = (uint8_t)PacketClass::TCP;
+            for (uint16_t k = 0; k < groups.nb[tcp]; k++)
+                *sink += infos[groups.index[tcp][k]].payload_length;
+        }
+        cycles += rte_rdtsc() - start;
+    }
+    return cycles;
+}
+
+static int RunMix(const char *name, struct rte_mbuf **pkts, const LocalPortSet &ports, uint64_t *sink)
+{
+    const double total = (double)BENCH_ROUNDS * BENCH_NB_PKTS;
+    printf("%s:\n", name);
+    const uint64_t baseline = Measure(pkts, [&](struct rte_mbuf **burst, PacketInfo *infos, Groups *groups) {
+        BaselineBurst(burst, ports, infos, groups);
+    }, sink);
+    printf("    %-16s %6.2f cycles/packet\n", "ClassifyPacket", baseline / total);
+
+    int ret = EXIT_SUCCESS;
+    PacketClassifier classifier(false);
+    for (PacketClassifier::Impl impl : {PacketClassifier::SCALAR, PacketClassifier::SSE, PacketClassifier::AVX2})
+    {
+        if (!classifier.Select(impl))
+        {
+            printf("    %-16s not supported by this CPU\n", impl == PacketClassifier::SSE ? "SSE4.2" : "AVX2");
+            continue;
+        }
+        const uint32_t mismatches = Verify(classifier, pkts, ports);
+        if (mismatches > 0)
+        {
+            printf("    %-16s %u bursts classified differently from ClassifyPacket\n", classifier.Name(), mismatches);
+            ret = EXIT_FAILURE;
+            continue;
+        }
+        const uint64_t cycles = Measure(pkts, [&](struct rte_mbuf **burst, PacketInfo *infos, Groups *groups) {
+            ClassifierBurst(classifier, burst, ports, infos, groups);
+        }, sink);
+        printf("    %-16s %6.2f cycles/packet, %.2fx\n", classifier.Name(), cycles / total, (double)baseline / cycles);
+    }
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    if (rte_eal_init(argc, argv) < 0)
+        rte_panic("Cannot init EAL\n");
+
+    struct rte_mempool *pool = rte_pktmbuf_pool_create("bench_pool", BENCH_NB_PKTS * 2, 0, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+    if (!pool)
+        rte_exit(EXIT_FAILURE, "Cannot create mbuf pool\n");
+
+    LocalPortSet ports("bench_ports", rte_socket_id());
+    ports.Add(IPPROTO_TCP, rte_cpu_to_be_16(8080));
+    ports.Add(IPPROTO_UDP, rte_cpu_to_be_16(53));
+
+    static struct rte_mbuf *lan[BENCH_NB_PKTS], *scan[BENCH_NB_PKTS];
+    srand(1);
+    BuildMix(pool, lan_mix, RTE_DIM(lan_mix), lan);
+    BuildMix(pool, scan_mix, RTE_DIM(scan_mix), scan);
+
+    uint64_t sink = 0;
+    int ret = RunMix("LAN mix (mostly accepted)", lan, ports, &sink);
+    if (RunMix("Scan mix (mostly dropped)", scan, ports, &sink) != EXIT_SUCCESS)
+        ret = EXIT_FAILURE;
+    printf("(checksum %" PRIu64 ", TSC %" PRIu64 " Hz)\n", sink, rte_get_tsc_hz());
+
+    for (uint16_t i = 0; i < BENCH_NB_PKTS; i++)
+    {
+        rte_pktmbuf_free(lan[i]);
+        rte_pktmbuf_free(scan[i]);
+    }
+    rte_mempool_free(pool);
+    rte_eal_cleanup();
+    return ret;
+}
@@ -0,0 +1,371 @@
+// ARP表：每个lcore一份，按IPv4地址查找邻居的MAC地址。所有发往IPv4地址的数据包都通过`Output`发送，
+// 只需要查一次表；还没有解析出MAC地址时数据包暂存在表项中(每项最多`ARP_PENDING_PACKETS`个)，
+// 收到ARP回复之后一起发出去。
+// 表项有3种状态：INCOMPLETE(已经发送ARP请求，还没有回复)、REACHABLE(最近确认过)、STALE(很久没有确认，
+// 仍然可以使用，被使用时重新发送ARP请求确认)。表项的超时和重发由一个定时器每隔`ARP_SCAN_INTERVAL_US`统一检查。
+// 开放寻址(线性探测)，删除时把后面的表项前移，不需要墓碑。
+
+#ifndef __ARP_H__
+#define __ARP_H__
+
+#include "common.h"
+#include "configs.h"
+#include "mbuf_alloc.h"
+#include "timer_wheel.h"
+#include "tx_buffer.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include <rte_arp.h>
+#include <rte_cycles.h>
+#include <rte_debug.h>
+#include <rte_ether.h>
+#include <rte_jhash.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+
+class ARPTable
+{
+public:
+    struct Stats
+    {
+        uint64_t hits;            // 发送时直接查到了MAC地址
+        uint64_t misses;          // 发送时需要等待ARP解析
+        uint64_t requests_sent;
+        uint64_t updates;         // 根据收到的ARP数据包新增或更新的表项
+        uint64_t pending_dropped; // 暂存的数据包太多、表满或者解析失败时丢弃的数据包
+        uint64_t failures;        // 重试多次之后仍然没有回复
+    };
+
+private:
+    enum class State : uint8_t
+    {
+        FREE = 0,
+        INCOMPLETE,
+        REACHABLE,
+        STALE,
+    };
+
+    struct Entry
+    {
+        rte_be32_t ip;
+        State state;
+        uint8_t nb_retries;  // 当前这一轮解析已经发送了多少次ARP请求，0表示没有在解析
+        uint8_t nb_pending;
+        struct rte_ether_addr mac;
+        uint64_t confirmed_tsc; // 最近一次收到对方ARP数据包的时间
+        uint64_t used_tsc;      // 最近一次被用来发送数据包的时间
+        uint64_t request_tsc;   // 最近一次发送ARP请求的时间
+        struct rte_mbuf *pending[ARP_PENDING_PACKETS];
+    };
+
+    Entry *entries;
+    uint32_t size;
+
+    TxBuffer *tx;
+    TimerWheel *timers;
+    MbufAllocator *mbufs;
+    const struct rte_ether_addr *mac_addr; // 自己的MAC地址
+    const rte_be32_t *ip_addr;             // 自己的IP地址，DHCP结束之后才有
+
+    Timer scan_timer;
+    uint64_t retry_tsc;
+    uint64_t reachable_tsc;
+    uint64_t gc_tsc;
+
+    Stats stats;
+
+public:
+    ARPTable(const char *name, TxBuffer *tx, TimerWheel *timers, MbufAllocator *mbufs,
+             const struct rte_ether_addr *mac_addr, const rte_be32_t *ip_addr, int socket_id)
+        : size(0), tx(tx), timers(timers), mbufs(mbufs), mac_addr(mac_addr), ip_addr(ip_addr), scan_timer(OnScanTimer, this)
+    {
+        static_assert((ARP_TABLE_SIZE & (ARP_TABLE_SIZE - 1)) == 0, "ARP_TABLE_SIZE must be a power of 2");
+        entries = (Entry *)rte_zmalloc_socket(name, sizeof(Entry) * ARP_TABLE_SIZE, RTE_CACHE_LINE_SIZE, socket_id);
+        if (!entries)
+            rte_exit(EXIT_FAILURE, "Cannot allocate ARP table %s\n", name);
+        retry_tsc = rte_get_tsc_hz() * ARP_RETRY_US / US_PER_S;
+        reachable_tsc = rte_get_tsc_hz() * ARP_REACHABLE_US / US_PER_S;
+        gc_tsc = rte_get_tsc_hz() * ARP_GC_US / US_PER_S;
+        memset(&stats, 0, sizeof(stats));
+        timers->Schedule(&scan_timer, ARP_SCAN_INTERVAL_US);
+    }
+
+    ~ARPTable()
+    {
+        timers->Cancel(&scan_timer);
+        for (uint32_t i = 0; i < ARP_TABLE_SIZE; i++)
+            DropPending(&entries[i]);
+        rte_free(entries);
+    }
+
+    ARPTable(const ARPTable &) = delete;
+    ARPTable &operator=(const ARPTable &) = delete;
+
+    uint32_t Size() const { return size; }
+    const Stats &GetStats() const { return stats; }
+
+    // 把一个以太网帧发给`next_hop`，填好以太网头的源和目的MAC地址。还没有MAC地址时暂存起来并发送ARP请求。
+    // 接管`pkt`
+    void Output(struct rte_mbuf *pkt, rte_be32_t next_hop)
+    {
+        const uint64_t now = rte_get_tsc_cycles();
+        Entry *entry = Find(next_hop);
+        if (entry && entry->state != State::INCOMPLETE)
+        {
+            stats.hits++;
+            entry->used_tsc = now;
+            if (entry->state == State::STALE && entry->nb_retries == 0)
+            {
+                // 很久没有确认过了，先继续使用，同时重新确认
+                entry->nb_retries = 1;
+                SendRequest(next_hop, now, entry);
+            }
+            Transmit(pkt, &entry->mac);
+            return;
+        }
+
+        stats.misses++;
+        if (!entry)
+        {
+            entry = Insert(next_hop);
+            if (!entry)
+            {
+                stats.pending_dropped++;
+                rte_pktmbuf_free(pkt);
+                return;
+            }
+            entry->state = State::INCOMPLETE;
+            entry->nb_retries = 1;
+            entry->used_tsc = now;
+            SendRequest(next_hop, now, entry);
+        }
+        if (entry->nb_pending >= ARP_PENDING_PACKETS)
+        {
+            stats.pending_dropped++;
+            rte_pktmbuf_free(pkt);
+            return;
+        }
+        entry->pending[entry->nb_pending++] = pkt;
+    }
+
+    // 提前解析`ip`的MAC地址(例如网关)，已经有表项时什么都不做
+    void Resolve(rte_be32_t ip)
+    {
+        if (Find(ip))
+            return;
+        Entry *entry = Insert(ip);
+        if (!entry)
+            return;
+        const uint64_t now = rte_get_tsc_cycles();
+        entry->state = State::INCOMPLETE;
+        entry->nb_retries = 1;
+        entry->used_tsc = now;
+        SendRequest(ip, now, entry);
+    }
+
+    // 查询`ip`的MAC地址，没有解析出来时返回nullptr
+    const struct rte_ether_addr *Lookup(rte_be32_t ip) const
+    {
+        const Entry *entry = const_cast<ARPTable *>(this)->Find(ip);
+        return entry && entry->state != State::INCOMPLETE ? &entry->mac : nullptr;
+    }
+
+    // 根据收到的ARP数据包(请求或回复)更新表项(RFC 826)：已经有表项时更新MAC地址，
+    // 对方在和自己通信(目标IP是自己)时新增表项。暂存的数据包会被发出去
+    void Input(const struct rte_arp_hdr *arp_hdr)
+    {
+        const rte_be32_t sip = arp_hdr->arp_data.arp_sip;
+        if (sip == 0 || sip == *ip_addr)
+            return;
+
+        Entry *entry = Find(sip);
+        if (!entry)
+        {
+            if (arp_hdr->arp_data.arp_tip != *ip_addr || *ip_addr == 0)
+                return;
+            entry = Insert(sip);
+            if (!entry)
+                return;
+        }
+
+        const uint64_t now = rte_get_tsc_cycles();
+        entry->mac = arp_hdr->arp_data.arp_sha;
+        entry->state = State::REACHABLE;
+        entry->nb_retries = 0;
+        entry->confirmed_tsc = now;
+        if (entry->used_tsc == 0)
+            entry->used_tsc = now;
+        stats.updates++;
+
+        for (uint8_t i = 0; i < entry->nb_pending; i++)
+            Transmit(entry->pending[i], &entry->mac);
+        entry->nb_pending = 0;
+    }
+
+    // 发送gratuitous ARP，通知局域网内的其他主机(和交换机)自己的IP和MAC地址，获得/更换地址之后调用
+    void Announce()
+    {
+        struct rte_mbuf *pkt = BuildARP(RTE_ARP_OP_REQUEST, *ip_addr);
+        if (!pkt)
+            return;
+        tx->Send(pkt);
+        printf("[ARP] Sent gratuitous ARP for %s\n", format_ipv4(*ip_addr).c_str());
+    }
+
+private:
+    Entry *Find(rte_be32_t ip)
+    {
+        for (uint32_t i = Home(ip), n = 0; n < ARP_TABLE_SIZE; i = (i + 1) & (ARP_TABLE_SIZE - 1), n++)
+        {
+            Entry *entry = &entries[i];
+            if (entry->state == State::FREE)
+                return nullptr;
+            if (entry->ip == ip)
+                return entry;
+        }
+        return nullptr;
+    }
+
+    // 新增一个空的表项，表满时返回nullptr
+    Entry *Insert(rte_be32_t ip)
+    {
+        if (size >= ARP_TABLE_SIZE - 1)
+            return nullptr;
+        uint32_t i = Home(ip);
+        while (entries[i].state != State::FREE)
+            i = (i + 1) & (ARP_TABLE_SIZE - 1);
+        Entry *entry = &entries[i];
+        memset(entry, 0, sizeof(*entry));
+        entry->ip = ip;
+        size++;
+        return entry;
+    }
+
+    // 删除第`i`个表项，把后面探测链上的表项前移填补空位
+    void Remove(uint32_t i)
+    {
+        DropPending(&entries[i]);
+        entries[i].state = State::FREE;
+        size--;
+        for (uint32_t j = (i + 1) & (ARP_TABLE_SIZE - 1); entries[j].state != State::FREE; j = (j + 1) & (ARP_TABLE_SIZE - 1))
+        {
+            const uint32_t home = Home(entries[j].ip);
+            // `home`不在(i, j]之间时，`j`上的表项可以移到`i`
+            if (((j - home) & (ARP_TABLE_SIZE - 1)) >= ((j - i) & (ARP_TABLE_SIZE - 1)))
+            {
+                entries[i] = entries[j];
+                entries[j].state = State::FREE;
+                entries[j].nb_pending = 0;
+                i = j;
+            }
+        }
+    }
+
+    void DropPending(Entry *entry)
+    {
+        for (uint8_t i = 0; i < entry->nb_pending; i++)
+            rte_pktmbuf_free(entry->pending[i]);
+        stats.pending_dropped += entry->nb_pending;
+        entry->nb_pending = 0;
+    }
+
+    static uint32_t Home(rte_be32_t ip) { return rte_jhash_1word(ip, 0) & (ARP_TABLE_SIZE - 1); }
+
+    static void OnScanTimer(Timer *timer, void *arg)
+    {
+        ARPTable *self = static_cast<ARPTable *>(arg);
+        self->timers->Schedule(timer, ARP_SCAN_INTERVAL_US);
+        if (self->size > 0)
+            self->Scan(rte_get_tsc_cycles());
+    }
+
+    // 检查所有表项的超时：重发没有回复的ARP请求，重试次数用完时删除；REACHABLE过期变为STALE；长期不用的STALE删除
+    void Scan(uint64_t now)
+    {
+        for (uint32_t i = 0; i < ARP_TABLE_SIZE; i++)
+        {
+            Entry *entry = &entries[i];
+            if (entry->state == State::FREE)
+                continue;
+
+            if (entry->nb_retries > 0 && now - entry->request_tsc >= retry_tsc)
+            {
+                if (entry->nb_retries > ARP_MAX_RETRIES)
+                {
+                    printf("[ARP] No reply for %s, giving up\n", format_ipv4(entry->ip).c_str());
+                    stats.failures++;
+                    Remove(i);
+                    i--; // 后面的表项可能被移到了这里
+                    continue;
+                }
+                entry->nb_retries++;
+                SendRequest(entry->ip, now, entry);
+            }
+
+            if (entry->state == State::REACHABLE && now - entry->confirmed_tsc >= reachable_tsc)
+            {
+                entry->state = State::STALE;
+            }
+            else if (entry->state == State::STALE && entry->nb_retries == 0 && now - entry->used_tsc >= gc_tsc)
+            {
+                Remove(i);
+                i--;
+            }
+        }
+    }
+
+    void SendRequest(rte_be32_t ip, uint64_t now, Entry *entry)
+    {
+        entry->request_tsc = now;
+        struct rte_mbuf *pkt = BuildARP(RTE_ARP_OP_REQUEST, ip);
+        if (!pkt)
+            return;
+        tx->Send(pkt);
+        stats.requests_sent++;
+        printf("[ARP] Sent ARP request for %s\n", format_ipv4(ip).c_str());
+    }
+
+    // 构造一个广播的ARP数据包，目标IP为`target_ip`
+    struct rte_mbuf *BuildARP(uint16_t opcode, rte_be32_t target_ip)
+    {
+        struct rte_mbuf *pkt = mbufs->Alloc(MbufPriority::CRITICAL);
+        if (!pkt)
+            return nullptr;
+
+        struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
+        rte_ether_addr_copy(mac_addr, &eth_hdr->src_addr);
+        memset(&eth_hdr->dst_addr, 0xFF, sizeof(eth_hdr->dst_addr));
+        eth_hdr->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_ARP);
+
+        struct rte_arp_hdr *arp_hdr = (struct rte_arp_hdr *)(eth_hdr + 1);
+        arp_hdr->arp_hardware = rte_cpu_to_be_16(RTE_ARP_HRD_ETHER);
+        arp_hdr->arp_protocol = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+        arp_hdr->arp_hlen = 6;
+        arp_hdr->arp_plen = 4;
+        arp_hdr->arp_opcode = rte_cpu_to_be_16(opcode);
+        arp_hdr->arp_data.arp_sha = *mac_addr;
+        arp_hdr->arp_data.arp_sip = *ip_addr;
+        memset(&arp_hdr->arp_data.arp_tha, 0, sizeof(arp_hdr->arp_data.arp_tha));
+        arp_hdr->arp_data.arp_tip = target_ip;
+
+        // Fill other DPDK metadata
+        pkt->packet_type = RTE_PTYPE_L2_ETHER_ARP;
+        const uint32_t PKT_LEN = sizeof(*eth_hdr) + sizeof(*arp_hdr);
+        pkt->pkt_len = PKT_LEN;
+        pkt->data_len = pkt->pkt_len;
+        pkt->l2_len = sizeof(struct rte_ether_hdr) + sizeof(struct rte_arp_hdr);
+        return pkt;
+    }
+
+    void Transmit(struct rte_mbuf *pkt, const struct rte_ether_addr *dst_mac_addr)
+    {
+        struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
+        rte_ether_addr_copy(mac_addr, &eth_hdr->src_addr);
+        rte_ether_addr_copy(dst_mac_addr, &eth_hdr->dst_addr);
+        tx->Send(pkt);
+    }
+};
+
+#endif // __ARP_H__
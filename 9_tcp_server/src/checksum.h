@@ -0,0 +1,223 @@
+// Internet checksum(RFC 1071)：IPv4包头、TCP/UDP/ICMP的checksum都由这里计算。
+// 求和按照本机字节序的16位字进行，一补数加法和字节序无关，最后的结果直接写回包中即可。
+// CPU支持AVX2时每次累加32字节，否则用64位整数每次累加8字节，启动时选择一次。
+// 修改包头中的个别字段时用`Update16`/`Update32`(RFC 1624)增量更新checksum，不需要重新求和。
+// 发送时网卡不支持的checksum offload由`SoftwareTxOffload`补上，收发两个方向都不依赖网卡一定支持offload。
+
+#ifndef __CHECKSUM_H__
+#define __CHECKSUM_H__
+
+#include <cstdint>
+#include <cstring>
+
+#include <rte_byteorder.h>
+#include <rte_cpuflags.h>
+#include <rte_ethdev.h>
+#include <rte_ip.h>
+#include <rte_mbuf.h>
+#include <rte_tcp.h>
+#include <rte_udp.h>
+
+#if defined(RTE_ARCH_X86)
+#include <immintrin.h>
+#endif
+
+class Checksum
+{
+    using SumFunc = uint64_t (*)(const uint8_t *buf, size_t len);
+
+public:
+    // 把`sum`折叠成16位，不取反
+    static uint16_t Fold(uint64_t sum)
+    {
+        sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+        sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+        sum = (sum >> 16) + (sum & 0xFFFF);
+        sum = (sum >> 16) + (sum & 0xFFFF);
+        sum = (sum >> 16) + (sum & 0xFFFF);
+        return (uint16_t)sum;
+    }
+
+    // 一段连续内存的16位一补数和(不取反)
+    static uint16_t Raw(const void *buf, size_t len) { return Fold(sum_func((const uint8_t *)buf, len)); }
+
+    // mbuf链中从`offset`开始`len`字节的一补数和(不取反)，数据跨越多个segment
+    static uint16_t RawMbuf(const struct rte_mbuf *m, uint32_t offset, uint32_t len)
+    {
+        while (m && offset >= m->data_len)
+        {
+            offset -= m->data_len;
+            m = m->next;
+        }
+
+        uint64_t sum = 0;
+        uint32_t done = 0; // 已经求和的字节数，为奇数时下一段的高低字节是反的
+        for (; m && done < len; m = m->next, offset = 0)
+        {
+            const uint32_t seg_len = RTE_MIN((uint32_t)(m->data_len - offset), len - done);
+            uint16_t seg_sum = Raw(rte_pktmbuf_mtod_offset(m, const uint8_t *, offset), seg_len);
+            if (done & 1)
+                seg_sum = rte_bswap16(seg_sum);
+            sum += seg_sum;
+            done += seg_len;
+        }
+        return Fold(sum);
+    }
+
+    // IPv4包头的checksum，包头中的`hdr_checksum`必须为0
+    static uint16_t IPv4Header(const struct rte_ipv4_hdr *ip_hdr)
+    {
+        return (uint16_t)~Raw(ip_hdr, rte_ipv4_hdr_len(ip_hdr));
+    }
+
+    // TCP/UDP伪首部的一补数和(不取反)，`l4_len`为主机序
+    static uint16_t PseudoHeader(const struct rte_ipv4_hdr *ip_hdr, uint16_t l4_len)
+    {
+        uint64_t sum = (uint64_t)ip_hdr->src_addr + ip_hdr->dst_addr;
+        sum += rte_cpu_to_be_16((uint16_t)ip_hdr->next_proto_id) + rte_cpu_to_be_16(l4_len);
+        return Fold(sum);
+    }
+
+    // TCP/UDP的checksum(包括伪首部)，L4包头从mbuf的`l4_offset`开始，包头中的checksum字段必须为0
+    static uint16_t IPv4L4(const struct rte_mbuf *m, const struct rte_ipv4_hdr *ip_hdr, uint32_t l4_offset)
+    {
+        const uint16_t l4_len = rte_be_to_cpu_16(ip_hdr->total_length) - rte_ipv4_hdr_len(ip_hdr);
+        uint16_t cksum = ~Fold((uint64_t)PseudoHeader(ip_hdr, l4_len) + RawMbuf(m, l4_offset, l4_len));
+        // UDP的checksum为0表示没有计算，算出来是0时写成0xFFFF(TCP中两者等价)
+        return cksum == 0 ? 0xFFFF : cksum;
+    }
+
+    // 校验TCP/UDP的checksum(包括伪首部)，正确时返回true
+    static bool VerifyIPv4L4(const struct rte_mbuf *m, const struct rte_ipv4_hdr *ip_hdr, uint32_t l4_offset)
+    {
+        const uint16_t l4_len = rte_be_to_cpu_16(ip_hdr->total_length) - rte_ipv4_hdr_len(ip_hdr);
+        return Fold((uint64_t)PseudoHeader(ip_hdr, l4_len) + RawMbuf(m, l4_offset, l4_len)) == 0xFFFF;
+    }
+
+    // RFC 1624：16位字段从`old_value`改为`new_value`之后的checksum，HC' = ~(~HC + ~m + m')
+    static uint16_t Update16(uint16_t cksum, uint16_t old_value, uint16_t new_value)
+    {
+        return (uint16_t)~Fold((uint64_t)(uint16_t)~cksum + (uint16_t)~old_value + new_value);
+    }
+
+    static uint16_t Update32(uint16_t cksum, uint32_t old_value, uint32_t new_value)
+    {
+        return (uint16_t)~Fold((uint64_t)(uint16_t)~cksum + (uint16_t)~(old_value >> 16) + (uint16_t)~old_value +
+                               (new_value >> 16) + (new_value & 0xFFFF));
+    }
+
+    // 发送之前调用：`pkt`请求了网卡不支持(不在`tx_offloads`中)的IPv4/TCP/UDP checksum offload时用软件计算，并清除对应的`ol_flags`。
+    // 请求L4 offload的数据包checksum字段中是伪首部的和(`rte_ipv4_phdr_cksum`)，这里会覆盖它
+    static void SoftwareTxOffload(struct rte_mbuf *pkt, uint64_t tx_offloads)
+    {
+        const uint64_t ol_flags = pkt->ol_flags;
+        if (likely(!(ol_flags & (RTE_MBUF_F_TX_IP_CKSUM | RTE_MBUF_F_TX_L4_MASK))))
+            return;
+
+        struct rte_ipv4_hdr *ip_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_ipv4_hdr *, pkt->l2_len);
+        if ((ol_flags & RTE_MBUF_F_TX_IP_CKSUM) && !(tx_offloads & RTE_ETH_TX_OFFLOAD_IPV4_CKSUM))
+        {
+            ip_hdr->hdr_checksum = 0;
+            ip_hdr->hdr_checksum = IPv4Header(ip_hdr);
+            pkt->ol_flags &= ~RTE_MBUF_F_TX_IP_CKSUM;
+        }
+
+        const uint32_t l4_offset = pkt->l2_len + pkt->l3_len;
+        switch (ol_flags & RTE_MBUF_F_TX_L4_MASK)
+        {
+        case RTE_MBUF_F_TX_TCP_CKSUM:
+            if (!(tx_offloads & RTE_ETH_TX_OFFLOAD_TCP_CKSUM))
+            {
+                struct rte_tcp_hdr *tcp_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_tcp_hdr *, l4_offset);
+                tcp_hdr->cksum = 0;
+                tcp_hdr->cksum = IPv4L4(pkt, ip_hdr, l4_offset);
+                pkt->ol_flags &= ~RTE_MBUF_F_TX_L4_MASK;
+            }
+            break;
+        case RTE_MBUF_F_TX_UDP_CKSUM:
+            if (!(tx_offloads & RTE_ETH_TX_OFFLOAD_UDP_CKSUM))
+            {
+                struct rte_udp_hdr *udp_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_udp_hdr *, l4_offset);
+                udp_hdr->dgram_cksum = 0;
+                udp_hdr->dgram_cksum = IPv4L4(pkt, ip_hdr, l4_offset);
+                pkt->ol_flags &= ~RTE_MBUF_F_TX_L4_MASK;
+            }
+            break;
+        default:
+            break;
+        }
+        if (!(pkt->ol_flags & (RTE_MBUF_F_TX_IP_CKSUM | RTE_MBUF_F_TX_L4_MASK)))
+            pkt->ol_flags &= ~RTE_MBUF_F_TX_IPV4;
+    }
+
+    static const char *Name() { return sum_name; }
+
+private:
+    // 8字节一组累加到64位整数中，进位留在高32位，最后再折叠
+    static uint64_t SumScalar(const uint8_t *buf, size_t len)
+    {
+        uint64_t sum = 0;
+        for (; len >= 8; buf += 8, len -= 8)
+        {
+            uint64_t v;
+            memcpy(&v, buf, sizeof(v));
+            sum += (v >> 32) + (v & 0xFFFFFFFF);
+        }
+        for (; len >= 2; buf += 2, len -= 2)
+        {
+            uint16_t v;
+            memcpy(&v, buf, sizeof(v));
+            sum += v;
+        }
+        if (len)
+        {
+            uint16_t v = 0;
+            memcpy(&v, buf, 1); // 最后一个字节放在它在16位字中的位置，另一半补0
+            sum += v;
+        }
+        return sum;
+    }
+
+#if defined(RTE_ARCH_X86)
+    // 32字节一组，每个32位lane分别累加高16位和低16位，每组每个lane最多增加2*0xFFFF，
+    // 每`AVX2_BLOCK`组把累加器加到64位的和中，避免溢出
+    __attribute__((target("avx2"))) static uint64_t SumAVX2(const uint8_t *buf, size_t len)
+    {
+        static constexpr size_t AVX2_BLOCK = 4096;
+        const __m256i mask = _mm256_set1_epi32(0xFFFF);
+        uint64_t sum = 0;
+        while (len >= 32)
+        {
+            __m256i acc = _mm256_setzero_si256();
+            for (size_t n = 0; n < AVX2_BLOCK && len >= 32; n++, buf += 32, len -= 32)
+            {
+                const __m256i v = _mm256_loadu_si256((const __m256i *)buf);
+                acc = _mm256_add_epi32(acc, _mm256_and_si256(v, mask));
+                acc = _mm256_add_epi32(acc, _mm256_srli_epi32(v, 16));
+            }
+            // 8个32位lane扩展成4个64位lane再相加
+            const __m256i wide = _mm256_add_epi64(_mm256_and_si256(acc, _mm256_set1_epi64x(0xFFFFFFFF)), _mm256_srli_epi64(acc, 32));
+            alignas(32) uint64_t lanes[4];
+            _mm256_store_si256((__m256i *)lanes, wide);
+            sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+        return sum + SumScalar(buf, len);
+    }
+#endif
+
+    static SumFunc Select()
+    {
+#if defined(RTE_ARCH_X86)
+        if (rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX2) > 0)
+            return SumAVX2;
+#endif
+        return SumScalar;
+    }
+
+    static const char *SelectName() { return Select() == SumScalar ? "scalar" : "AVX2"; }
+
+    static inline const SumFunc sum_func = Select();
+    static inline const char *const sum_name = SelectName();
+};
+
+#endif // __CHECKSUM_H__
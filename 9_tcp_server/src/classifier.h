@@ -0,0 +1,395 @@
+// 收包的第一步：用SIMD一次判断多个数据包应该交给哪一类Task处理(`PacketClass`)，不是发给自己的IPv4数据包、
+// 以及发往没有绑定的TCP/UDP端口的数据包直接判为`UNKNOWN`。
+// 每个数据包只读取包头中固定位置的几个字段：ether_type和version_ihl(偏移12开始的4字节)、IPv4协议号(偏移23)、目的IP(偏移30)、
+// 目的端口(偏移36)，放到向量的不同lane中一起比较。端口在`LocalPortSet`的位图中查找，AVX2用gather一次查8个。
+// AVX2每次处理8个数据包，SSE4.2每次4个，启动时按照CPU支持的指令集选择，都不支持时逐个处理。
+// 带IP Option的数据包字段位置不固定，判为`CLASSIFY_SLOW`，由调用者用`ClassifyPacket`逐个处理。
+// 网卡能识别ARP/IPv4/TCP/UDP/ICMP时(`rte_eth_dev_get_supported_ptypes`)直接使用mbuf中的`packet_type`，只需要再读取目的IP和端口。
+// 这里不检查长度，读取的位置都在mbuf的数据区内(数据区至少有几百字节)，长度由随后的`ParseClassified`检查。
+// `make bench`运行`bench/classifier_bench.cpp`，比较各个实现和逐个`ClassifyPacket`的速度。
+
+#ifndef __CLASSIFIER_H__
+#define __CLASSIFIER_H__
+
+#include "packet.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include <rte_byteorder.h>
+#include <rte_cpuflags.h>
+#include <rte_debug.h>
+#include <rte_malloc.h>
+#include <rte_mbuf_ptype.h>
+#include <rte_mbuf.h>
+#include <rte_prefetch.h>
+
+#if defined(RTE_ARCH_X86)
+#include <immintrin.h>
+#endif
+
+#define CLASSIFY_SLOW 5       // 需要逐个解析的数据包，紧接在`PacketClass`的值后面
+#define CLASSIFY_NB_CLASSES 5 // `PacketClass`的数量，`Group`的每一组对应一个类别
+
+// 以小端序读出偏移12开始的4个字节时ether_type和version_ihl对应的值
+#define CLASSIFY_KEY_ARP 0x0608U         // ether_type = 0x0806
+#define CLASSIFY_KEY_IPV4 0x00450008U    // ether_type = 0x0800，version_ihl = 0x45
+#define CLASSIFY_KEY_IPV4_ANY 0x00400008U // ether_type = 0x0800，version = 4，有IP Option
+#define CLASSIFY_MASK_ETHER 0x0000FFFFU
+#define CLASSIFY_MASK_IPV4 0x00FFFFFFU
+#define CLASSIFY_MASK_IPV4_ANY 0x00F0FFFFU
+
+static_assert((uint8_t)PacketClass::UNKNOWN == 0 && (uint8_t)PacketClass::ARP == 1 && (uint8_t)PacketClass::ICMP == 2 &&
+              (uint8_t)PacketClass::UDP == 3 && (uint8_t)PacketClass::TCP == 4,
+              "PacketClass values are used directly by the classifier");
+
+// 本地绑定了的TCP/UDP端口(监听端口和连接的本地端口)，`PacketClassifier`用来丢弃发往其他端口的数据包。
+// 位图按照(UDP时加65536)+网络序端口号索引，共16KB，分类时直接用包头中的端口查找，不用转换字节序；
+// 绑定端口0(通配)时这个协议的所有端口都算绑定了。同一个端口可以被多个监听Task和连接使用，用引用计数记录，计数变为0时才清除
+class LocalPortSet
+{
+    static constexpr uint32_t NB_PORTS = 65536;
+
+    uint32_t bits[2 * NB_PORTS / 32];
+    int32_t any[2];  // 绑定了端口0时为-1(全1，直接用作SIMD的掩码)，否则为0
+    uint32_t *refs;  // 每个(proto, port)的引用计数
+
+public:
+    LocalPortSet(const char *name, int socket_id)
+    {
+        memset(bits, 0, sizeof(bits));
+        any[0] = any[1] = 0;
+        refs = (uint32_t *)rte_zmalloc_socket(name, sizeof(uint32_t) * 2 * NB_PORTS, RTE_CACHE_LINE_SIZE, socket_id);
+        if (!refs)
+            rte_exit(EXIT_FAILURE, "Cannot allocate port set %s\n", name);
+    }
+
+    ~LocalPortSet() { rte_free(refs); }
+
+    LocalPortSet(const LocalPortSet &) = delete;
+    LocalPortSet &operator=(const LocalPortSet &) = delete;
+
+    // `proto`必须是TCP或者UDP，`port`为网络序
+    void Add(uint8_t proto, rte_be16_t port)
+    {
+        const uint32_t i = Index(proto, port);
+        if (refs[i]++ == 0)
+            Set(proto, port, true);
+    }
+
+    void Remove(uint8_t proto, rte_be16_t port)
+    {
+        const uint32_t i = Index(proto, port);
+        if (refs[i] > 0 && --refs[i] == 0)
+            Set(proto, port, false);
+    }
+
+    bool Contains(uint8_t proto, rte_be16_t port) const
+    {
+        const uint32_t i = Index(proto, port);
+        return any[i >> 16] || (bits[i >> 5] >> (i & 31)) & 1;
+    }
+
+    const uint32_t *Bits() const { return bits; }
+    int32_t AnyMask(uint8_t proto) const { return any[proto == IPPROTO_UDP]; }
+
+    static uint32_t Index(uint8_t proto, rte_be16_t port) { return (proto == IPPROTO_UDP ? NB_PORTS : 0) + port; }
+
+private:
+    void Set(uint8_t proto, rte_be16_t port, bool on)
+    {
+        if (port == 0)
+        {
+            any[proto == IPPROTO_UDP] = on ? -1 : 0;
+            return;
+        }
+        const uint32_t i = Index(proto, port);
+        if (on)
+            bits[i >> 5] |= 1U << (i & 31);
+        else
+            bits[i >> 5] &= ~(1U << (i & 31));
+    }
+};
+
+class PacketClassifier
+{
+    using BurstFunc = void (*)(struct rte_mbuf **pkts, uint16_t nb_pkts, rte_be32_t local_ip, const LocalPortSet &ports, uint8_t *classes);
+
+    BurstFunc func;
+    const char *name;
+
+public:
+    enum Impl
+    {
+        BEST,   // CPU支持的最快的SIMD实现
+        PTYPE,  // 使用网卡填写的`packet_type`
+        AVX2,
+        SSE,
+        SCALAR,
+    };
+
+    // `hw_ptype`：网卡填写的`packet_type`是否可以使用
+    PacketClassifier(bool hw_ptype) { Select(hw_ptype ? PTYPE : BEST); }
+
+    // 换成指定的实现，CPU不支持时返回false、实现不变(基准测试用)
+    bool Select(Impl impl)
+    {
+        switch (impl)
+        {
+        case PTYPE:
+            func = ClassifyPtype;
+            name = "hardware ptype";
+            return true;
+#if defined(RTE_ARCH_X86)
+        case BEST:
+        case AVX2:
+            if (rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX2) > 0)
+            {
+                func = ClassifyAVX2;
+                name = "AVX2";
+                return true;
+            }
+            if (impl == AVX2)
+                return false;
+            /* fall through */
+        case SSE:
+            if (rte_cpu_get_flag_enabled(RTE_CPUFLAG_SSE4_2) > 0)
+            {
+                func = ClassifySSE;
+                name = "SSE4.2";
+                return true;
+            }
+            if (impl == SSE)
+                return false;
+            break;
+#else
+        case AVX2:
+        case SSE:
+            return false;
+#endif
+        default:
+            break;
+        }
+        func = ClassifyScalar;
+        name = "scalar";
+        return true;
+    }
+
+    const char *Name() const { return name; }
+
+    // 判断`pkts`中每个数据包的类别，结果是`PacketClass`或者`CLASSIFY_SLOW`，写入`classes`。
+    // 目的端口不在`ports`中的TCP/UDP数据包为`UNKNOWN`
+    void Classify(struct rte_mbuf **pkts, uint16_t nb_pkts, rte_be32_t local_ip, const LocalPortSet &ports, uint8_t *classes) const
+    {
+        func(pkts, nb_pkts, local_ip, ports, classes);
+    }
+
+private:
+    static const uint8_t *Header(struct rte_mbuf *pkt) { return rte_pktmbuf_mtod(pkt, const uint8_t *); }
+    static uint32_t Key(const uint8_t *hdr) { return Load32(hdr + 12); }
+    static uint32_t Proto(const uint8_t *hdr) { return hdr[23]; }
+    static uint32_t DstIP(const uint8_t *hdr) { return Load32(hdr + 30); }
+    static rte_be16_t DstPort(const uint8_t *hdr) { return (rte_be16_t)Load16(hdr + 36); } // 没有IP Option时TCP/UDP的目的端口
+
+    static uint32_t Load32(const uint8_t *p)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint16_t Load16(const uint8_t *p)
+    {
+        uint16_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint8_t ClassifyOne(const uint8_t *hdr, rte_be32_t local_ip, const LocalPortSet &ports)
+    {
+        const uint32_t key = Key(hdr);
+        if ((key & CLASSIFY_MASK_ETHER) == CLASSIFY_KEY_ARP)
+            return (uint8_t)PacketClass::ARP;
+        if ((key & CLASSIFY_MASK_IPV4) != CLASSIFY_KEY_IPV4)
+            return (key & CLASSIFY_MASK_IPV4_ANY) == CLASSIFY_KEY_IPV4_ANY ? CLASSIFY_SLOW : (uint8_t)PacketClass::UNKNOWN;
+        if (DstIP(hdr) != local_ip)
+            return (uint8_t)PacketClass::UNKNOWN;
+        switch (Proto(hdr))
+        {
+        case IPPROTO_ICMP:
+            return (uint8_t)PacketClass::ICMP;
+        case IPPROTO_UDP:
+            return ports.Contains(IPPROTO_UDP, DstPort(hdr)) ? (uint8_t)PacketClass::UDP : (uint8_t)PacketClass::UNKNOWN;
+        case IPPROTO_TCP:
+            return ports.Contains(IPPROTO_TCP, DstPort(hdr)) ? (uint8_t)PacketClass::TCP : (uint8_t)PacketClass::UNKNOWN;
+        default:
+            return (uint8_t)PacketClass::UNKNOWN;
+        }
+    }
+
+    static void ClassifyPtype(struct rte_mbuf **pkts, uint16_t nb_pkts, rte_be32_t local_ip, const LocalPortSet &ports, uint8_t *classes)
+    {
+        for (uint16_t i = 0; i < nb_pkts; i++)
+        {
+            const uint32_t ptype = pkts[i]->packet_type;
+            if ((ptype & RTE_PTYPE_L2_MASK) == RTE_PTYPE_L2_ETHER_ARP)
+            {
+                classes[i] = (uint8_t)PacketClass::ARP;
+                continue;
+            }
+            const uint32_t l3 = ptype & RTE_PTYPE_L3_MASK;
+            if (l3 != RTE_PTYPE_L3_IPV4)
+            {
+                classes[i] = RTE_ETH_IS_IPV4_HDR(ptype) ? CLASSIFY_SLOW : (uint8_t)PacketClass::UNKNOWN;
+                continue;
+            }
+            if (DstIP(Header(pkts[i])) != local_ip)
+            {
+                classes[i] = (uint8_t)PacketClass::UNKNOWN;
+                continue;
+            }
+            switch (ptype & RTE_PTYPE_L4_MASK)
+            {
+            case RTE_PTYPE_L4_ICMP:
+                classes[i] = (uint8_t)PacketClass::ICMP;
+                break;
+            case RTE_PTYPE_L4_UDP:
+                classes[i] = ports.Contains(IPPROTO_UDP, DstPort(Header(pkts[i]))) ? (uint8_t)PacketClass::UDP : (uint8_t)PacketClass::UNKNOWN;
+                break;
+            case RTE_PTYPE_L4_TCP:
+                classes[i] = ports.Contains(IPPROTO_TCP, DstPort(Header(pkts[i]))) ? (uint8_t)PacketClass::TCP : (uint8_t)PacketClass::UNKNOWN;
+                break;
+            default: // 分片等
+                classes[i] = (uint8_t)PacketClass::UNKNOWN;
+                break;
+            }
+        }
+    }
+
+    static void ClassifyScalar(struct rte_mbuf **pkts, uint16_t nb_pkts, rte_be32_t local_ip, const LocalPortSet &ports, uint8_t *classes)
+    {
+        for (uint16_t i = 0; i < nb_pkts; i++)
+            classes[i] = ClassifyOne(Header(pkts[i]), local_ip, ports);
+    }
+
+#if defined(RTE_ARCH_X86)
+    // 8个数据包一组，取下一组的包头时预取再下一组。端口位图用gather查找，不是TCP/UDP的lane查到的结果不使用
+    __attribute__((target("avx2"))) static void ClassifyAVX2(struct rte_mbuf **pkts, uint16_t nb_pkts, rte_be32_t local_ip, const LocalPortSet &ports, uint8_t *classes)
+    {
+        const __m256i mask_ether = _mm256_set1_epi32(CLASSIFY_MASK_ETHER);
+        const __m256i mask_ipv4 = _mm256_set1_epi32(CLASSIFY_MASK_IPV4);
+        const __m256i mask_ipv4_any = _mm256_set1_epi32(CLASSIFY_MASK_IPV4_ANY);
+        const __m256i key_arp = _mm256_set1_epi32(CLASSIFY_KEY_ARP);
+        const __m256i key_ipv4 = _mm256_set1_epi32(CLASSIFY_KEY_IPV4);
+        const __m256i key_ipv4_any = _mm256_set1_epi32(CLASSIFY_KEY_IPV4_ANY);
+        const __m256i local = _mm256_set1_epi32((int)local_ip);
+        const __m256i proto_icmp = _mm256_set1_epi32(IPPROTO_ICMP);
+        const __m256i proto_udp = _mm256_set1_epi32(IPPROTO_UDP);
+        const __m256i proto_tcp = _mm256_set1_epi32(IPPROTO_TCP);
+        const __m256i udp_base = _mm256_set1_epi32((int)LocalPortSet::Index(IPPROTO_UDP, 0));
+        const __m256i any_udp = _mm256_set1_epi32(ports.AnyMask(IPPROTO_UDP));
+        const __m256i any_tcp = _mm256_set1_epi32(ports.AnyMask(IPPROTO_TCP));
+        const __m256i low5 = _mm256_set1_epi32(31);
+        const __m256i one = _mm256_set1_epi32(1);
+        const int *bits = (const int *)ports.Bits();
+
+        uint16_t i = 0;
+        for (; i + 8 <= nb_pkts; i += 8)
+        {
+            for (uint16_t j = i + 8; j < i + 16 && j < nb_pkts; j++)
+                rte_prefetch0(rte_pktmbuf_mtod(pkts[j], void *));
+
+            const uint8_t *h[8];
+            for (int j = 0; j < 8; j++)
+                h[j] = Header(pkts[i + j]);
+            const __m256i key = _mm256_setr_epi32(Key(h[0]), Key(h[1]), Key(h[2]), Key(h[3]), Key(h[4]), Key(h[5]), Key(h[6]), Key(h[7]));
+            const __m256i proto = _mm256_setr_epi32(Proto(h[0]), Proto(h[1]), Proto(h[2]), Proto(h[3]), Proto(h[4]), Proto(h[5]), Proto(h[6]), Proto(h[7]));
+            const __m256i dst_ip = _mm256_setr_epi32(DstIP(h[0]), DstIP(h[1]), DstIP(h[2]), DstIP(h[3]), DstIP(h[4]), DstIP(h[5]), DstIP(h[6]), DstIP(h[7]));
+            const __m256i dst_port = _mm256_setr_epi32(DstPort(h[0]), DstPort(h[1]), DstPort(h[2]), DstPort(h[3]), DstPort(h[4]), DstPort(h[5]), DstPort(h[6]), DstPort(h[7]));
+
+            const __m256i arp = _mm256_cmpeq_epi32(_mm256_and_si256(key, mask_ether), key_arp);
+            const __m256i ipv4 = _mm256_cmpeq_epi32(_mm256_and_si256(key, mask_ipv4), key_ipv4);
+            const __m256i ipv4_any = _mm256_cmpeq_epi32(_mm256_and_si256(key, mask_ipv4_any), key_ipv4_any);
+            const __m256i slow = _mm256_andnot_si256(ipv4, ipv4_any);
+            const __m256i ours = _mm256_and_si256(ipv4, _mm256_cmpeq_epi32(dst_ip, local));
+            const __m256i is_udp = _mm256_cmpeq_epi32(proto, proto_udp);
+            const __m256i is_tcp = _mm256_cmpeq_epi32(proto, proto_tcp);
+
+            // 目的端口是否绑定了：位图下标为(UDP时加65536)+端口，最大131071，所有lane的gather都不会越界
+            const __m256i index = _mm256_or_si256(dst_port, _mm256_and_si256(is_udp, udp_base));
+            const __m256i word = _mm256_i32gather_epi32(bits, _mm256_srli_epi32(index, 5), 4);
+            __m256i bound = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_srlv_epi32(word, _mm256_and_si256(index, low5)), one), one);
+            bound = _mm256_or_si256(bound, _mm256_or_si256(_mm256_and_si256(is_udp, any_udp), _mm256_and_si256(is_tcp, any_tcp)));
+            const __m256i ours_l4 = _mm256_and_si256(ours, bound);
+
+            // 各个掩码互斥，每个lane最多一个为真，直接把对应的类别OR到一起
+            __m256i cls = _mm256_and_si256(arp, _mm256_set1_epi32((int)PacketClass::ARP));
+            cls = _mm256_or_si256(cls, _mm256_and_si256(_mm256_and_si256(ours, _mm256_cmpeq_epi32(proto, proto_icmp)), _mm256_set1_epi32((int)PacketClass::ICMP)));
+            cls = _mm256_or_si256(cls, _mm256_and_si256(_mm256_and_si256(ours_l4, is_udp), _mm256_set1_epi32((int)PacketClass::UDP)));
+            cls = _mm256_or_si256(cls, _mm256_and_si256(_mm256_and_si256(ours_l4, is_tcp), _mm256_set1_epi32((int)PacketClass::TCP)));
+            cls = _mm256_or_si256(cls, _mm256_and_si256(slow, _mm256_set1_epi32(CLASSIFY_SLOW)));
+
+            // 每个lane的低8位依次放到`classes`中
+            const __m256i bytes = _mm256_shuffle_epi8(cls, _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                                            0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+            const uint32_t lo = (uint32_t)_mm256_extract_epi32(bytes, 0);
+            const uint32_t hi = (uint32_t)_mm256_extract_epi32(bytes, 4);
+            memcpy(classes + i, &lo, sizeof(lo));
+            memcpy(classes + i + 4, &hi, sizeof(hi));
+        }
+        for (; i < nb_pkts; i++)
+            classes[i] = ClassifyOne(Header(pkts[i]), local_ip, ports);
+    }
+
+    // 4个数据包一组，和AVX2的版本相同。SSE没有gather，端口逐个在位图中查找
+    __attribute__((target("sse4.2"))) static void ClassifySSE(struct rte_mbuf **pkts, uint16_t nb_pkts, rte_be32_t local_ip, const LocalPortSet &ports, uint8_t *classes)
+    {
+        const __m128i mask_ether = _mm_set1_epi32(CLASSIFY_MASK_ETHER);
+        const __m128i mask_ipv4 = _mm_set1_epi32(CLASSIFY_MASK_IPV4);
+        const __m128i mask_ipv4_any = _mm_set1_epi32(CLASSIFY_MASK_IPV4_ANY);
+        const __m128i key_arp = _mm_set1_epi32(CLASSIFY_KEY_ARP);
+        const __m128i key_ipv4 = _mm_set1_epi32(CLASSIFY_KEY_IPV4);
+        const __m128i key_ipv4_any = _mm_set1_epi32(CLASSIFY_KEY_IPV4_ANY);
+        const __m128i local = _mm_set1_epi32((int)local_ip);
+        const __m128i proto_icmp = _mm_set1_epi32(IPPROTO_ICMP);
+        const __m128i proto_udp = _mm_set1_epi32(IPPROTO_UDP);
+        const __m128i proto_tcp = _mm_set1_epi32(IPPROTO_TCP);
+
+        uint16_t i = 0;
+        for (; i + 4 <= nb_pkts; i += 4)
+        {
+            for (uint16_t j = i + 4; j < i + 8 && j < nb_pkts; j++)
+                rte_prefetch0(rte_pktmbuf_mtod(pkts[j], void *));
+
+            const uint8_t *h[4];
+            for (int j = 0; j < 4; j++)
+                h[j] = Header(pkts[i + j]);
+            const __m128i key = _mm_setr_epi32(Key(h[0]), Key(h[1]), Key(h[2]), Key(h[3]));
+            const __m128i proto = _mm_setr_epi32(Proto(h[0]), Proto(h[1]), Proto(h[2]), Proto(h[3]));
+            const __m128i dst_ip = _mm_setr_epi32(DstIP(h[0]), DstIP(h[1]), DstIP(h[2]), DstIP(h[3]));
+            const __m128i bound = _mm_setr_epi32(-(int)ports.Contains(Proto(h[0]), DstPort(h[0])), -(int)ports.Contains(Proto(h[1]), DstPort(h[1])),
+                                                 -(int)ports.Contains(Proto(h[2]), DstPort(h[2])), -(int)ports.Contains(Proto(h[3]), DstPort(h[3])));
+
+            const __m128i arp = _mm_cmpeq_epi32(_mm_and_si128(key, mask_ether), key_arp);
+            const __m128i ipv4 = _mm_cmpeq_epi32(_mm_and_si128(key, mask_ipv4), key_ipv4);
+            const __m128i ipv4_any = _mm_cmpeq_epi32(_mm_and_si128(key, mask_ipv4_any), key_ipv4_any);
+            const __m128i slow = _mm_andnot_si128(ipv4, ipv4_any);
+            const __m128i ours = _mm_and_si128(ipv4, _mm_cmpeq_epi32(dst_ip, local));
+            const __m128i ours_l4 = _mm_and_si128(ours, bound);
+
+            __m128i cls = _mm_and_si128(arp, _mm_set1_epi32((int)PacketClass::ARP));
+            cls = _mm_or_si128(cls, _mm_and_si128(_mm_and_si128(ours, _mm_cmpeq_epi32(proto, proto_icmp)), _mm_set1_epi32((int)PacketClass::ICMP)));
+            cls = _mm_or_si128(cls, _mm_and_si128(_mm_and_si128(ours_l4, _mm_cmpeq_epi32(proto, proto_udp)), _mm_set1_epi32((int)PacketClass::UDP)));
+            cls = _mm_or_si128(cls, _mm_and_si128(_mm_and_si128(ours_l4, _mm_cmpeq_epi32(proto, proto_tcp)), _mm_set1_epi32((int)PacketClass::TCP)));
+            cls = _mm_or_si128(cls, _mm_and_si128(slow, _mm_set1_epi32(CLASSIFY_SLOW)));
+
+            const uint32_t packed = (uint32_t)_mm_cvtsi128_si32(_mm_shuffle_epi8(cls, _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)));
+            memcpy(classes + i, &packed, sizeof(packed));
+        }
+        for (; i < nb_pkts; i++)
+            classes[i] = ClassifyOne(Header(pkts[i]), local_ip, ports);
+    }
+#endif
+};
+
+#endif // __CLASSIFIER_H__
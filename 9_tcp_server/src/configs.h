@@ -12,12 +12,95 @@ inline bool force_quit = false; // 是否收到了退出信号
 #define PORT 0 // 用哪个网口
 
 #define MAX_PKT_BURST 32       // 突发数据包数量
-#define MEMPOOL_CACHE_SIZE 256 // 暂时还不知道是干嘛的
+#define TX_DRAIN_US 100        // 发送缓冲区中的数据包最多等待多少微秒就会被发出
+#define TX_RETRY_TIMES 3       // TX ring满时重试几次，之后丢弃
+#define PREFETCH_OFFSET 3      // 分批处理收到的数据包时，提前预取后面第几个数据包的包头
+#define MEMPOOL_CACHE_SIZE 256 // 每个lcore在mbuf池上的本地缓存(mbuf个数)，大部分分配/释放只访问本地缓存，不用原子操作访问池中共享的ring
+#define MBUF_POOL_ACTIVE_CONNECTIONS 16 // 估算mbuf池大小时，假设每个lcore同时有多少个TCP连接的发送队列和接收窗口是满的
+#define MBUF_ALLOC_BULK 32              // 每个lcore的mbuf分配器一次从池中取多少个mbuf
+#define MBUF_LOW_WATERMARK_PERCENT 10   // mbuf池剩余低于这个比例时丢弃不重要的数据包、TCP暂停接收应用的数据
+#define MBUF_CHECK_US 10000             // 多久检查一次mbuf池的剩余
 
 // 默认RX和TX队列有多少个descriptor
 #define RX_DESC_DEFAULT 1024
 #define TX_DESC_DEFAULT 1024
 
+// 最多使用多少对RX/TX队列，每个队列由一个lcore负责，实际数量由EAL参数中的lcore数决定(如`-l 0-3`)
+#define MAX_QUEUES 16
+
+// RSS key的长度，大部分网卡为40字节
+#define RSS_KEY_DEFAULT_LEN 40
+#define RSS_KEY_MAX_LEN 64
+
+// 分层定时器轮的精度、层数和每层的槽数(`1 << TIMER_WHEEL_LEVEL_BITS`)
+// 最长可以定时`TIMER_WHEEL_TICK_US << (TIMER_WHEEL_LEVEL_BITS * TIMER_WHEEL_LEVELS)`微秒，约49天
+#define TIMER_WHEEL_TICK_US 1000
+#define TIMER_WHEEL_LEVEL_BITS 8
+#define TIMER_WHEEL_LEVELS 4
+#define TASK_REAP_INTERVAL_US 10000 // 每隔多久清理一次已经结束的Task
+
+/* DHCP */
+#define DHCP_ACK_WAIT_US 1000000 // 发送续约请求之后等待回复的时间
+#define DHCP_RETRY_MIN_S 60      // 续约失败之后至少等待多久再重试
+
+/* ARP */
+#define ARP_RETRY_US 1000000             // ARP请求没有回复时多久之后重发
+#define ARP_MAX_RETRIES 5                // 最多重发几次
+#define ARP_TABLE_SIZE 256               // 每个lcore的ARP表最多有多少项，必须是2的幂
+#define ARP_PENDING_PACKETS 8            // 每个正在解析的地址最多暂存多少个数据包
+#define ARP_REACHABLE_US (30ULL * US_PER_S) // 表项确认之后多久变为STALE，STALE的表项被使用时重新确认
+#define ARP_GC_US (300ULL * US_PER_S)    // STALE的表项多久没有被使用就删除
+#define ARP_SCAN_INTERVAL_US 100000      // 多久检查一次表项的超时和重发
+#define ARP_RING_SIZE 256                // 转发给其他lcore的ARP数据包队列长度，必须是2的幂
+
+/* 路由 */
+#define FIB_MAX_ROUTES 64    // 每个lcore的路由表最多有多少条路由
+#define FIB_NUMBER_TBL8S 256 // rte_lpm中给前缀长度超过24的路由使用的tbl8组数
+// 静态路由，和DHCP得到的直连子网、默认路由一起加入每个lcore的路由表，每一项为{网段, 前缀长度, 网关(0表示直连), 网口}，例如
+// {{RTE_IPV4(10, 0, 0, 0), 8, RTE_IPV4(192, 168, 1, 254), PORT}}
+#define FIB_STATIC_ROUTES {}
+
+/* 监听端口 */
+#define PORT_TABLE_MAX_PORTS 4096 // 每个lcore最多监听多少个端口(TCP和UDP一共)
+#define PORT_REUSE_MAX 8          // 一个端口最多由多少个Task共同监听(reuse_port)
+
+/* UDP */
+#define UDP_RING_SIZE 4096 // 一个UDP端口在协议栈lcore和应用lcore之间的收发队列长度，必须是2的幂
+#define UDP_ECHO_PORT 8080 // UDP echo服务的端口
+// 保留多少个lcore作为应用lcore：不分配网卡队列，从`UDPRing`取出UDP echo端口收到的数据报回复。
+// 只有一个lcore时不保留，为0时由协议栈lcore直接回复
+#define APP_LCORES 1
+
+/* TCP */
+#define TCP_MSS 1460               // 自己的MSS
+#define TCP_WSCALE 7               // 自己的Window Scale
+#define TCP_RCV_WND (256 * 1024)   // 接收窗口大小(字节)，乱序队列中的数据不会超过这个大小
+#define TCP_OOO_MAX_SEGMENTS 64    // 每个连接的乱序队列最多保存多少个数据段
+#define TCP_SND_BUF (256 * 1024)   // 发送队列大小(字节)
+#define TCP_SND_QUEUE_SEGMENTS 256 // 发送队列最多保存多少个数据段，必须是2的幂
+#define TCP_RTO_INIT_US 1000000    // 还没有RTT样本时的RTO
+#define TCP_RTO_MIN_US 200000
+#define TCP_RTO_MAX_US 60000000
+#define TCP_MAX_RETRIES 8          // 连续超时这么多次之后放弃连接
+#define TCP_DUPACK_THRESHOLD 3     // 收到这么多个重复的ACK之后快速重传
+#define TCP_DELACK_US 40000        // 延迟ACK最多等待多久(RFC 1122要求不超过500毫秒)
+#define TCP_DELACK_SEGMENTS 2      // 收到这么多个满MSS的数据段之后立即回复ACK，不再延迟
+#define TCP_QUICKACK_SEGMENTS 16   // 连接刚建立或者空闲超过RTO之后(对方处于慢启动)，这么多个数据段立即回复ACK
+#define TCP_INIT_CWND_SEGMENTS 10  // 初始拥塞窗口(MSS数量)，RFC 6928
+#define TCP_KEEPALIVE_IDLE_US (60ULL * US_PER_S)  // 连接空闲多久之后开始发送keepalive探测
+#define TCP_KEEPALIVE_INTVL_US (10ULL * US_PER_S) // keepalive探测的间隔
+#define TCP_KEEPALIVE_PROBES 6                    // 连续这么多个探测没有回复时断开连接
+#define TCP_MAX_CONNECTIONS 1024                  // 每个lcore最多同时有多少个TCP连接(包括半连接)，连接对象启动时一次性分配
+#define FLOW_TABLE_SIZE TCP_MAX_CONNECTIONS       // 每个lcore的连接表最多放多少个连接
+#define TCP_SYN_BACKLOG 128                       // 每个监听端口最多有多少个半连接，超过之后使用SYN cookie(或者丢弃SYN)
+#define TCP_SYNACK_RETRIES 5                      // SYN,ACK最多重传多少次，之后释放半连接
+#define TCP_FIN_WAIT_2_US (60ULL * US_PER_S)      // 自己关闭之后等待对方关闭的最长时间
+#define TCP_TIME_WAIT_US (60ULL * US_PER_S)       // TIME_WAIT的时间(2MSL)
+#define TCP_TSO_MAX_BYTES (64 * 1024 - 512)       // 连续的数据段合成一个大报文段交给网卡(TSO)或者GSO切分，负载最多这么多字节(加上包头不超过65535)
+#define TCP_TSO_MAX_SEGS 64                       // 大报文段的mbuf链最多有多少个mbuf，网卡的限制更小时以网卡为准
+#define TX_GSO_MAX_SEGS 128                       // 网卡不支持TSO时，一个大报文段最多被GSO切分成多少个数据包
+#define TCP_GRO_MAX_BYTES (64 * 1024 - 512)       // 同一个连接连续到达的数据段合并(LRO/GRO)之后负载最多这么多字节
+
 /* IPv4 header */
 #define IP_DEFTTL 64
 #define IP_VERSION 0x40
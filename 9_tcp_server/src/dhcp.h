@@ -56,6 +56,17 @@ struct dhcp_opt_t
 #define DHCP_OPT_DNS_SERVER_CODE 6
 #define DHCP_OPT_DNS_SERVER_LEN_DIVISIBLE 4
 
+// Ref: https://www.rfc-editor.org/rfc/rfc1533#section-9.2
+// Format: [code][len=4][seconds]
+#define DHCP_OPT_LEASE_TIME_CODE 51
+#define DHCP_OPT_LEASE_TIME_LEN 4
+#define DHCP_LEASE_TIME_INFINITE 0xFFFFFFFFU
+
+// Ref: https://www.rfc-editor.org/rfc/rfc1533#section-9.6
+// Format: [code][len=4][address]
+#define DHCP_OPT_SERVER_ID_CODE 54
+#define DHCP_OPT_SERVER_ID_LEN 4
+
 // Ref: https://www.rfc-editor.org/rfc/rfc1533#section-3.2
 #define DHCP_OPT_END_CODE 255
 
@@ -0,0 +1,207 @@
+// 路由表(FIB)：每个lcore一份，用`rte_lpm`(DIR-24-8)做最长前缀匹配，给每个要发送的IPv4数据包选择下一跳和出口网口。
+// 路由来自DHCP(直连子网和默认网关)以及`FIB_STATIC_ROUTES`中的静态路由。`rte_lpm`中保存的"下一跳"是路由在`routes`中的下标，
+// 网关和出口网口都放在路由里，这样每条路由可以有自己的收发计数。网关为0的路由是直连路由，下一跳就是目的地址。
+// `rte_lpm`不接受前缀长度为0的规则，默认路由(0.0.0.0/0)单独记录在`default_route`中，`rte_lpm`中没有匹配时使用。
+
+#ifndef __FIB_H__
+#define __FIB_H__
+
+#include "common.h"
+#include "configs.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include <rte_byteorder.h>
+#include <rte_debug.h>
+#include <rte_lpm.h>
+
+// `FIB_STATIC_ROUTES`中的一项，地址用`RTE_IPV4`写(主机字节序)
+struct StaticRoute
+{
+    uint32_t prefix;
+    uint8_t depth;
+    uint32_t gateway; // 0表示直连
+    uint16_t port_id;
+};
+
+class FIB
+{
+public:
+    struct Route
+    {
+        rte_be32_t prefix;  // 目的网段(已经按照前缀长度去掉了主机位)
+        uint8_t depth;      // 前缀长度
+        bool used;
+        uint16_t port_id;   // 出口网口
+        rte_be32_t gateway; // 网关，0表示直连
+        uint64_t packets;   // 通过这条路由发送的数据包
+        uint64_t bytes;
+    };
+
+    struct Stats
+    {
+        uint64_t lookups;
+        uint64_t no_route; // 没有匹配的路由，数据包被丢弃
+    };
+
+private:
+    struct rte_lpm *lpm;
+    Route routes[FIB_MAX_ROUTES];
+    int32_t default_route; // 默认路由在`routes`中的下标，-1表示没有
+    uint32_t size;
+    Stats stats;
+
+public:
+    FIB(const char *name, int socket_id) : default_route(-1), size(0)
+    {
+        struct rte_lpm_config config;
+        memset(&config, 0, sizeof(config));
+        config.max_rules = FIB_MAX_ROUTES;
+        config.number_tbl8s = FIB_NUMBER_TBL8S;
+        lpm = rte_lpm_create(name, socket_id, &config);
+        if (!lpm)
+            rte_exit(EXIT_FAILURE, "Cannot create FIB %s\n", name);
+        memset(routes, 0, sizeof(routes));
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    ~FIB() { rte_lpm_free(lpm); }
+
+    FIB(const FIB &) = delete;
+    FIB &operator=(const FIB &) = delete;
+
+    // 添加一条路由，已经有相同的网段时替换它的网关和出口网口(计数保留)。路由表满时返回false
+    bool Add(rte_be32_t prefix, uint8_t depth, rte_be32_t gateway, uint16_t port_id)
+    {
+        if (depth > 32)
+            return false;
+        prefix &= Mask(depth);
+        Route *route = Find(prefix, depth);
+        if (!route)
+        {
+            route = Allocate();
+            if (!route)
+                return false;
+            route->prefix = prefix;
+            route->depth = depth;
+        }
+        route->gateway = gateway;
+        route->port_id = port_id;
+        if (depth == 0)
+        {
+            default_route = (int32_t)(route - routes);
+        }
+        else if (rte_lpm_add(lpm, rte_be_to_cpu_32(prefix), depth, (uint32_t)(route - routes)) < 0)
+        {
+            if (!route->used)
+                memset(route, 0, sizeof(*route));
+            return false;
+        }
+        if (!route->used)
+        {
+            route->used = true;
+            size++;
+        }
+        printf("[FIB] Route %s/%u via %s on port %u\n", format_ipv4(prefix).c_str(), depth,
+               gateway ? format_ipv4(gateway).c_str() : "direct", port_id);
+        return true;
+    }
+
+    // 根据DHCP得到的地址添加直连子网和默认路由
+    void AddConnected(rte_be32_t ip_addr, rte_be32_t netmask, rte_be32_t gateway, uint16_t port_id)
+    {
+        if (netmask && !Add(ip_addr, Depth(netmask), 0, port_id))
+            printf("[FIB] Cannot add connected route %s/%u\n", format_ipv4(ip_addr & netmask).c_str(), Depth(netmask));
+        if (gateway && !Add(0, 0, gateway, port_id))
+            printf("[FIB] Cannot add default route via %s\n", format_ipv4(gateway).c_str());
+    }
+
+    void AddStatic(const StaticRoute &route)
+    {
+        if (!Add(rte_cpu_to_be_32(route.prefix), route.depth, rte_cpu_to_be_32(route.gateway), route.port_id))
+            printf("[FIB] Cannot add static route %s/%u\n", format_ipv4(rte_cpu_to_be_32(route.prefix)).c_str(), route.depth);
+    }
+
+    bool Delete(rte_be32_t prefix, uint8_t depth)
+    {
+        Route *route = Find(prefix & Mask(depth), depth);
+        if (!route)
+            return false;
+        if (depth == 0)
+            default_route = -1;
+        else
+            rte_lpm_delete(lpm, rte_be_to_cpu_32(route->prefix), depth);
+        memset(route, 0, sizeof(*route));
+        size--;
+        return true;
+    }
+
+    // 查找发往`dst_ip`的数据包的下一跳和出口网口，并计入对应路由的计数。没有路由时返回false
+    bool Lookup(rte_be32_t dst_ip, uint32_t pkt_len, rte_be32_t *next_hop, uint16_t *port_id)
+    {
+        stats.lookups++;
+        uint32_t index;
+        if (rte_lpm_lookup(lpm, rte_be_to_cpu_32(dst_ip), &index) != 0)
+        {
+            if (default_route < 0)
+            {
+                stats.no_route++;
+                return false;
+            }
+            index = (uint32_t)default_route;
+        }
+        Route *route = &routes[index];
+        route->packets++;
+        route->bytes += pkt_len;
+        *next_hop = route->gateway ? route->gateway : dst_ip;
+        *port_id = route->port_id;
+        return true;
+    }
+
+    uint32_t Size() const { return size; }
+    const Stats &GetStats() const { return stats; }
+
+    // 输出每条路由的计数
+    void Dump(uint16_t queue_id) const
+    {
+        printf("[FIB] Queue %u: %u routes, %" PRIu64 " lookups, %" PRIu64 " without route\n",
+               queue_id, size, stats.lookups, stats.no_route);
+        for (uint32_t i = 0; i < FIB_MAX_ROUTES; i++)
+        {
+            const Route &route = routes[i];
+            if (!route.used)
+                continue;
+            printf("\t%s/%u via %s on port %u: %" PRIu64 " packets, %" PRIu64 " bytes\n",
+                   format_ipv4(route.prefix).c_str(), route.depth,
+                   route.gateway ? format_ipv4(route.gateway).c_str() : "direct", route.port_id,
+                   route.packets, route.bytes);
+        }
+    }
+
+private:
+    static rte_be32_t Mask(uint8_t depth) { return depth ? rte_cpu_to_be_32(~0U << (32 - depth)) : 0; }
+    static uint8_t Depth(rte_be32_t netmask) { return (uint8_t)__builtin_popcount(netmask); }
+
+    Route *Find(rte_be32_t prefix, uint8_t depth)
+    {
+        for (uint32_t i = 0; i < FIB_MAX_ROUTES; i++)
+        {
+            if (routes[i].used && routes[i].prefix == prefix && routes[i].depth == depth)
+                return &routes[i];
+        }
+        return nullptr;
+    }
+
+    Route *Allocate()
+    {
+        for (uint32_t i = 0; i < FIB_MAX_ROUTES; i++)
+        {
+            if (!routes[i].used)
+                return &routes[i];
+        }
+        return nullptr;
+    }
+};
+
+#endif // __FIB_H__
@@ -0,0 +1,176 @@
+// 连接表：按照(proto, local port, remote ip, remote port)查找连接。
+// 预先分配好、按cache line对齐的开放寻址哈希表，插入/删除/查找都不会分配内存。
+// 每个bucket正好一个cache line，放4个key和它们的16位签名，查找时一般只需要访问一个cache line；
+// bucket满了之后线性探测下一个bucket，并记录有多少个key越过了这个bucket，没有key越过时查找可以提前结束，
+// 因此删除时可以直接清空，不需要墓碑。
+
+#ifndef __FLOW_TABLE_H__
+#define __FLOW_TABLE_H__
+
+#include <cstdint>
+#include <cstring>
+
+#include <rte_common.h>
+#include <rte_debug.h>
+#include <rte_jhash.h>
+#include <rte_malloc.h>
+#include <rte_prefetch.h>
+
+struct FlowKey
+{
+    rte_be32_t remote_ip;
+    rte_be16_t local_port;
+    rte_be16_t remote_port;
+    uint8_t proto;
+    uint8_t pad[3]; // 必须为0，比较时整个结构体一起比较
+
+    FlowKey() { memset(this, 0, sizeof(*this)); }
+    FlowKey(uint8_t proto, rte_be16_t local_port, rte_be32_t remote_ip, rte_be16_t remote_port)
+        : remote_ip(remote_ip), local_port(local_port), remote_port(remote_port), proto(proto), pad{0, 0, 0}
+    {
+    }
+
+    bool operator==(const FlowKey &o) const
+    {
+        return remote_ip == o.remote_ip && local_port == o.local_port && remote_port == o.remote_port && proto == o.proto;
+    }
+
+    uint32_t Hash() const
+    {
+        return rte_jhash_3words(remote_ip, ((uint32_t)local_port << 16) | remote_port, proto, 0);
+    }
+};
+static_assert(sizeof(FlowKey) == 12);
+
+template <typename T>
+class FlowTable
+{
+    static constexpr int BUCKET_ENTRIES = 4;
+
+    struct alignas(RTE_CACHE_LINE_SIZE) Bucket
+    {
+        uint16_t sigs[BUCKET_ENTRIES]; // 0表示空
+        uint16_t overflow;             // 有多少个key的home bucket在这个bucket之前、但是越过了这个bucket
+        uint16_t pad[3];
+        FlowKey keys[BUCKET_ENTRIES];
+    };
+    static_assert(sizeof(Bucket) == RTE_CACHE_LINE_SIZE);
+
+    Bucket *buckets;
+    T **values; // 第i个bucket的第j个key对应values[i * BUCKET_ENTRIES + j]
+    uint32_t bucket_mask;
+    uint32_t size;
+    uint32_t capacity; // 最多放多少个key，留出一部分空位保证探测长度
+
+public:
+    // `max_entries`为最多放多少个key，实际分配的空间会向上取整到2的幂
+    FlowTable(const char *name, uint32_t max_entries, int socket_id) : size(0)
+    {
+        const uint32_t nb_buckets = rte_align32pow2((max_entries + BUCKET_ENTRIES - 1) / BUCKET_ENTRIES * 5 / 4); // 负载不超过80%
+        buckets = (Bucket *)rte_zmalloc_socket(name, sizeof(Bucket) * nb_buckets, RTE_CACHE_LINE_SIZE, socket_id);
+        values = (T **)rte_zmalloc_socket(name, sizeof(T *) * nb_buckets * BUCKET_ENTRIES, RTE_CACHE_LINE_SIZE, socket_id);
+        if (!buckets || !values)
+            rte_exit(EXIT_FAILURE, "Cannot allocate flow table %s\n", name);
+        bucket_mask = nb_buckets - 1;
+        capacity = max_entries;
+    }
+
+    ~FlowTable()
+    {
+        rte_free(buckets);
+        rte_free(values);
+    }
+
+    FlowTable(const FlowTable &) = delete;
+    FlowTable &operator=(const FlowTable &) = delete;
+
+    uint32_t Size() const { return size; }
+
+    // 提前把`hash`对应的bucket读进cache
+    void Prefetch(uint32_t hash) const { rte_prefetch0(&buckets[hash & bucket_mask]); }
+
+    T *Lookup(const FlowKey &key) const { return Lookup(key, key.Hash()); }
+
+    T *Lookup(const FlowKey &key, uint32_t hash) const
+    {
+        const uint16_t sig = Signature(hash);
+        for (uint32_t b = hash & bucket_mask, n = 0; n <= bucket_mask; b = (b + 1) & bucket_mask, n++)
+        {
+            const Bucket &bucket = buckets[b];
+            for (int i = 0; i < BUCKET_ENTRIES; i++)
+            {
+                if (bucket.sigs[i] == sig && bucket.keys[i] == key)
+                    return values[b * BUCKET_ENTRIES + i];
+            }
+            if (bucket.overflow == 0)
+                break;
+        }
+        return nullptr;
+    }
+
+    // 插入一个key，已经存在或者表满时返回false
+    bool Insert(const FlowKey &key, T *value)
+    {
+        const uint32_t hash = key.Hash();
+        if (size >= capacity || Lookup(key, hash))
+            return false;
+
+        const uint16_t sig = Signature(hash);
+        const uint32_t home = hash & bucket_mask;
+        for (uint32_t b = home;; b = (b + 1) & bucket_mask)
+        {
+            Bucket &bucket = buckets[b];
+            for (int i = 0; i < BUCKET_ENTRIES; i++)
+            {
+                if (bucket.sigs[i] == 0)
+                {
+                    bucket.sigs[i] = sig;
+                    bucket.keys[i] = key;
+                    values[b * BUCKET_ENTRIES + i] = value;
+                    // 记录越过了哪些bucket
+                    for (uint32_t p = home; p != b; p = (p + 1) & bucket_mask)
+                        buckets[p].overflow++;
+                    size++;
+                    return true;
+                }
+            }
+        }
+    }
+
+    // 删除一个key，不存在时返回false
+    bool Remove(const FlowKey &key)
+    {
+        const uint32_t hash = key.Hash();
+        const uint16_t sig = Signature(hash);
+        const uint32_t home = hash & bucket_mask;
+        for (uint32_t b = home, n = 0; n <= bucket_mask; b = (b + 1) & bucket_mask, n++)
+        {
+            Bucket &bucket = buckets[b];
+            for (int i = 0; i < BUCKET_ENTRIES; i++)
+            {
+                if (bucket.sigs[i] == sig && bucket.keys[i] == key)
+                {
+                    bucket.sigs[i] = 0;
+                    values[b * BUCKET_ENTRIES + i] = nullptr;
+                    for (uint32_t p = home; p != b; p = (p + 1) & bucket_mask)
+                        buckets[p].overflow--;
+                    size--;
+                    return true;
+                }
+            }
+            if (bucket.overflow == 0)
+                break;
+        }
+        return false;
+    }
+
+private:
+    // 16位签名，0保留表示空位
+    static uint16_t Signature(uint32_t hash)
+    {
+        const uint16_t sig = hash >> 16;
+        return sig ? sig : 1;
+    }
+};
+
+#endif // __FLOW_TABLE_H__
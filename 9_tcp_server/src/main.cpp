@@ -1,11 +1,30 @@
 #include "configs.h"
 #include "dhcp.h"
 #include "common.h"
+#include "packet.h"
+#include "tx_buffer.h"
+#include "tcp.h"
+#include "tcp_cc.h"
+#include "timer_wheel.h"
+#include "flow_table.h"
+#include "object_pool.h"
+#include "syncookie.h"
+#include "arp.h"
+#include "fib.h"
+#include "classifier.h"
+#include "checksum.h"
+#include "mbuf_alloc.h"
+#include "packet_template.h"
+#include "udp.h"
+#include "port_table.h"
 
 #include <vector>
 #include <memory>
-#include <map>
-#include <queue>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+
+#include <sys/uio.h>
 
 #include <signal.h>
 
@@ -20,15 +39,21 @@
 #include <rte_ip.h>
 #include <rte_udp.h>
 #include <rte_tcp.h>
+#include <rte_jhash.h>
+#include <rte_lcore.h>
+#include <rte_launch.h>
+#include <rte_ring.h>
+#include <rte_prefetch.h>
 
 // 默认网卡配置
 static struct rte_eth_conf port_conf = {
     .rxmode = {
+        .mq_mode = RTE_ETH_MQ_RX_NONE,
         .offloads = (RTE_ETH_RX_OFFLOAD_CHECKSUM | RTE_ETH_RX_OFFLOAD_SCATTER),
     },
     .txmode = {
         .mq_mode = RTE_ETH_MQ_TX_NONE,
-        .offloads = (RTE_ETH_TX_OFFLOAD_IPV4_CKSUM | RTE_ETH_TX_OFFLOAD_TCP_CKSUM | RTE_ETH_TX_OFFLOAD_MULTI_SEGS),
+        .offloads = (RTE_ETH_TX_OFFLOAD_IPV4_CKSUM | RTE_ETH_TX_OFFLOAD_TCP_CKSUM | RTE_ETH_TX_OFFLOAD_UDP_CKSUM | RTE_ETH_TX_OFFLOAD_MULTI_SEGS),
     },
 };
 
@@ -42,9 +67,98 @@ static void signal_handler(int signum)
     }
 }
 
-int port_init(int port, struct rte_mempool *mbuf_pool)
+// 网卡的收包能力，`port_init`中根据网卡支持的功能设置，之后只读
+static struct
+{
+    bool hw_ptype; // 网卡能识别ARP/IPv4/TCP/UDP/ICMP，`packet_type`可以直接使用
+    bool lro;      // 网卡支持LRO，否则由`Dispatcher`在每一批数据包中合并TCP数据段(GRO)
+} port_rx_capa;
+
+// 网卡的发包能力，`port_init`中根据网卡支持的功能设置，之后只读
+static struct
+{
+    bool tso;          // 网卡支持TSO，否则大报文段由`TxBuffer`用GSO切分
+    uint16_t max_segs; // 一个数据包的mbuf链最多有多少个mbuf
+} port_tx_capa;
+
+// 对称的Toeplitz RSS key(0x6d5a重复)，保证同一个TCP/UDP连接两个方向的数据包被分到同一个队列
+static uint8_t rss_key[RSS_KEY_MAX_LEN];
+
+// 每个队列由哪个lcore负责：0号队列是主lcore，第i个worker负责第i个队列
+static unsigned queue_lcores[MAX_QUEUES];
+
+// 应用lcore(没有分配网卡队列)，第i个应用lcore处理`udp_app_rings[i]`中的数据报
+static unsigned app_lcores[RTE_MAX_LCORE];
+static UDPRing *udp_app_rings[RTE_MAX_LCORE];
+static unsigned nb_app_lcores;
+
+// 每个NUMA节点一个mbuf池，由这个节点上的lcore负责的队列共用；`queue_mbuf_pools[i]`是第i个队列使用的池
+static struct rte_mempool *socket_mbuf_pools[RTE_MAX_NUMA_NODES];
+static struct rte_mempool *queue_mbuf_pools[MAX_QUEUES];
+
+static unsigned queue_socket_id(uint16_t queue_id)
+{
+    const int socket_id = rte_lcore_to_socket_id(queue_lcores[queue_id]);
+    return socket_id == SOCKET_ID_ANY ? 0 : (unsigned)socket_id;
+}
+
+// 一个队列(lcore)最多同时占用多少个mbuf
+static uint32_t mbufs_per_queue(uint16_t nb_rxd, uint16_t nb_txd)
+{
+    // 发送队列中的数据和它们发出去之后还在TX ring中的clone，加上乱序队列和交给应用还没有释放的数据
+    const uint32_t tcp_mbufs_per_conn = TCP_SND_BUF / TCP_MSS * 2 + TCP_RCV_WND / TCP_MSS;
+    return nb_rxd + nb_txd                              // RX ring中等待收包的mbuf，TX ring中还没有发送完成的mbuf
+           + MAX_PKT_BURST * 2                          // 正在处理的一批数据包，以及发送缓冲区
+           + TX_GSO_MAX_SEGS * 2                        // GSO切分出来的包头(direct)和负载(indirect)
+           + ARP_RING_SIZE                              // 其他lcore转发过来、还没有处理的ARP数据包
+           + ARP_TABLE_SIZE * ARP_PENDING_PACKETS       // 等待ARP回复的数据包
+           + MEMPOOL_CACHE_SIZE * 3 / 2                 // 本地缓存最多保存1.5倍`MEMPOOL_CACHE_SIZE`个mbuf
+           + MBUF_ALLOC_BULK                            // `MbufAllocator`取出来还没有用的mbuf
+           + MBUF_POOL_ACTIVE_CONNECTIONS * tcp_mbufs_per_conn;
+}
+
+// 按照队列所在的NUMA节点创建mbuf池，每个池的大小为这个节点上的队列数乘以`mbufs_per_queue`
+static int create_mbuf_pools(int port, uint16_t nb_queues, uint16_t nb_rxd, uint16_t nb_txd)
+{
+    uint16_t queues_on_socket[RTE_MAX_NUMA_NODES] = {};
+    for (uint16_t q = 0; q < nb_queues; q++)
+        queues_on_socket[queue_socket_id(q)]++;
+
+    const int port_socket = rte_eth_dev_socket_id(port);
+    const uint32_t per_queue = mbufs_per_queue(nb_rxd, nb_txd);
+    for (unsigned socket = 0; socket < RTE_MAX_NUMA_NODES; socket++)
+    {
+        if (queues_on_socket[socket] == 0)
+            continue;
+        if (port_socket != SOCKET_ID_ANY && (unsigned)port_socket != socket)
+            printf("Port %u is on socket %d, but %u queue(s) are polled from socket %u\n",
+                   port, port_socket, queues_on_socket[socket], socket);
+
+        char name[RTE_MEMPOOL_NAMESIZE];
+        snprintf(name, sizeof(name), "mbuf_pool_s%u", socket);
+        const uint32_t nb_mbufs = per_queue * queues_on_socket[socket];
+        struct rte_mempool *pool = rte_pktmbuf_pool_create(name, nb_mbufs, MEMPOOL_CACHE_SIZE, 0,
+                                                           RTE_MBUF_DEFAULT_BUF_SIZE, socket);
+        if (!pool)
+        {
+            printf("Cannot create %s with %u mbufs: %s\n", name, nb_mbufs, rte_strerror(rte_errno));
+            return -1;
+        }
+        printf("Created %s: %u mbufs (%" PRIu64 " MB) for %u queue(s), %u per queue (%u RX + %u TX descriptors)\n",
+               name, nb_mbufs, (uint64_t)nb_mbufs * (pool->header_size + pool->elt_size + pool->trailer_size) >> 20,
+               queues_on_socket[socket], per_queue, nb_rxd, nb_txd);
+        socket_mbuf_pools[socket] = pool;
+    }
+    for (uint16_t q = 0; q < nb_queues; q++)
+        queue_mbuf_pools[q] = socket_mbuf_pools[queue_socket_id(q)];
+    return 0;
+}
+
+// 初始化网卡，`nb_queues`为RX/TX队列对的数量，大于1时开启RSS。
+// 确定descriptor数量之后创建mbuf池，每个队列的descriptor ring和mbuf都分配在负责它的lcore所在的NUMA节点上
+int port_init(int port, uint16_t nb_queues)
 {
-    const uint16_t rx_rings = 1, tx_rings = 1;
+    const uint16_t rx_rings = nb_queues, tx_rings = nb_queues;
 
     if (!rte_eth_dev_is_valid_port(port))
         return -1;
@@ -62,6 +176,63 @@ int port_init(int port, struct rte_mempool *mbuf_pool)
     if (dev_info.tx_offload_capa & RTE_ETH_TX_OFFLOAD_MBUF_FAST_FREE)
         port_conf.txmode.offloads |= RTE_ETH_TX_OFFLOAD_MBUF_FAST_FREE;
 
+    // 网卡不支持的RX offload不开启，对应的检查由软件完成(数据包的ol_flags为UNKNOWN)
+    if ((port_conf.rxmode.offloads & dev_info.rx_offload_capa) != port_conf.rxmode.offloads)
+    {
+        printf("Port %u does not support RX offloads 0x%" PRIx64 ", checking in software\n",
+               port, port_conf.rxmode.offloads & ~dev_info.rx_offload_capa);
+        port_conf.rxmode.offloads &= dev_info.rx_offload_capa;
+    }
+    // 网卡支持LRO时由网卡合并同一个TCP连接连续到达的数据段，合并后的数据包是mbuf链(需要RX_OFFLOAD_SCATTER)
+    port_rx_capa.lro = (dev_info.rx_offload_capa & RTE_ETH_RX_OFFLOAD_TCP_LRO) && (port_conf.rxmode.offloads & RTE_ETH_RX_OFFLOAD_SCATTER);
+    if (port_rx_capa.lro)
+    {
+        port_conf.rxmode.offloads |= RTE_ETH_RX_OFFLOAD_TCP_LRO;
+        port_conf.rxmode.max_lro_pkt_size = dev_info.max_lro_pkt_size ? RTE_MIN(dev_info.max_lro_pkt_size, (uint32_t)TCP_GRO_MAX_BYTES) : TCP_GRO_MAX_BYTES;
+    }
+    printf("Port %u %s\n", port, port_rx_capa.lro ? "supports LRO" : "does not support LRO, using GRO");
+    // 网卡不支持的TX checksum offload由`TxBuffer`用软件计算(`Checksum::SoftwareTxOffload`)
+    const uint64_t tx_cksum_offloads = RTE_ETH_TX_OFFLOAD_IPV4_CKSUM | RTE_ETH_TX_OFFLOAD_TCP_CKSUM | RTE_ETH_TX_OFFLOAD_UDP_CKSUM;
+    if ((tx_cksum_offloads & dev_info.tx_offload_capa) != tx_cksum_offloads)
+        printf("Port %u does not support TX offloads 0x%" PRIx64 ", computing checksums in software (%s)\n",
+               port, tx_cksum_offloads & ~dev_info.tx_offload_capa, Checksum::Name());
+    port_conf.txmode.offloads = (port_conf.txmode.offloads & ~tx_cksum_offloads) | (tx_cksum_offloads & dev_info.tx_offload_capa);
+
+    // TCP总是把连续的数据段合成最大64KB的报文段，网卡支持TSO时由网卡切分，否则由GSO切分
+    port_tx_capa.tso = (dev_info.tx_offload_capa & RTE_ETH_TX_OFFLOAD_TCP_TSO) != 0;
+    if (port_tx_capa.tso)
+        port_conf.txmode.offloads |= RTE_ETH_TX_OFFLOAD_TCP_TSO;
+    port_tx_capa.max_segs = TCP_TSO_MAX_SEGS;
+    if (port_tx_capa.tso && dev_info.tx_desc_lim.nb_seg_max)
+        port_tx_capa.max_segs = RTE_MIN(port_tx_capa.max_segs, dev_info.tx_desc_lim.nb_seg_max);
+    printf("Port %u %s\n", port, port_tx_capa.tso ? "supports TSO" : "does not support TSO, using GSO");
+
+    if (nb_queues > 1)
+    {
+        const uint8_t key_len = dev_info.hash_key_size ? dev_info.hash_key_size : RSS_KEY_DEFAULT_LEN;
+        if (key_len > RSS_KEY_MAX_LEN)
+        {
+            printf("Port %u RSS key size %u is not supported\n", port, key_len);
+            return -1;
+        }
+        for (int i = 0; i < key_len; i += 2)
+        {
+            rss_key[i] = 0x6d;
+            rss_key[i + 1] = 0x5a;
+        }
+        port_conf.rxmode.mq_mode = RTE_ETH_MQ_RX_RSS;
+        port_conf.rx_adv_conf.rss_conf.rss_key = rss_key;
+        port_conf.rx_adv_conf.rss_conf.rss_key_len = key_len;
+        port_conf.rx_adv_conf.rss_conf.rss_hf = (RTE_ETH_RSS_IPV4 | RTE_ETH_RSS_NONFRAG_IPV4_TCP | RTE_ETH_RSS_NONFRAG_IPV4_UDP) & dev_info.flow_type_rss_offloads;
+        if (port_conf.rx_adv_conf.rss_conf.rss_hf == 0)
+        {
+            printf("Port %u does not support RSS over IPv4 TCP/UDP\n", port);
+            return -1;
+        }
+        if (dev_info.rx_offload_capa & RTE_ETH_RX_OFFLOAD_RSS_HASH)
+            port_conf.rxmode.offloads |= RTE_ETH_RX_OFFLOAD_RSS_HASH;
+    }
+
     /* Configure the Ethernet device. */
     retval = rte_eth_dev_configure(port, rx_rings, tx_rings, &port_conf);
     if (retval != 0)
@@ -73,22 +244,26 @@ int port_init(int port, struct rte_mempool *mbuf_pool)
     if (retval != 0)
         return retval;
 
-    /* Allocate and set up 1 RX queue per Ethernet port. */
+    retval = create_mbuf_pools(port, nb_queues, nb_rxd, nb_txd);
+    if (retval != 0)
+        return retval;
+
+    /* Allocate and set up `nb_queues` RX queues per Ethernet port. */
     for (int q = 0; q < rx_rings; q++)
     {
         retval = rte_eth_rx_queue_setup(port, q, nb_rxd,
-                                        rte_eth_dev_socket_id(port), nullptr, mbuf_pool);
+                                        queue_socket_id(q), nullptr, queue_mbuf_pools[q]);
         if (retval < 0)
             return retval;
     }
 
     struct rte_eth_txconf txconf = dev_info.default_txconf;
     txconf.offloads = port_conf.txmode.offloads;
-    /* Allocate and set up 1 TX queue per Ethernet port. */
+    /* Allocate and set up `nb_queues` TX queues per Ethernet port. */
     for (int q = 0; q < tx_rings; q++)
     {
         retval = rte_eth_tx_queue_setup(port, q, nb_txd,
-                                        rte_eth_dev_socket_id(port), &txconf);
+                                        queue_socket_id(q), &txconf);
         if (retval < 0)
             return retval;
     }
@@ -99,6 +274,23 @@ int port_init(int port, struct rte_mempool *mbuf_pool)
     if (retval < 0)
         return retval;
 
+    // 网卡能识别所有需要的包类型时才使用`packet_type`
+    {
+        uint32_t ptypes[64];
+        const int nb_ptypes = rte_eth_dev_get_supported_ptypes(port, RTE_PTYPE_L2_MASK | RTE_PTYPE_L3_MASK | RTE_PTYPE_L4_MASK, ptypes, RTE_DIM(ptypes));
+        bool arp = false, ipv4 = false, tcp = false, udp = false, icmp = false;
+        for (int i = 0; i < nb_ptypes; i++)
+        {
+            arp |= ptypes[i] == RTE_PTYPE_L2_ETHER_ARP;
+            ipv4 |= ptypes[i] == RTE_PTYPE_L3_IPV4 || ptypes[i] == RTE_PTYPE_L3_IPV4_EXT_UNKNOWN;
+            tcp |= ptypes[i] == RTE_PTYPE_L4_TCP;
+            udp |= ptypes[i] == RTE_PTYPE_L4_UDP;
+            icmp |= ptypes[i] == RTE_PTYPE_L4_ICMP;
+        }
+        port_rx_capa.hw_ptype = arp && ipv4 && tcp && udp && icmp;
+        printf("Port %u %s hardware packet type\n", port, port_rx_capa.hw_ptype ? "uses" : "does not use");
+    }
+
     /* Display the port MAC address. */
     struct rte_ether_addr addr;
     retval = rte_eth_macaddr_get(port, &addr);
@@ -106,8 +298,8 @@ int port_init(int port, struct rte_mempool *mbuf_pool)
         return retval;
 
     printf("Port %u MAC: %02" PRIx8 " %02" PRIx8 " %02" PRIx8
-           " %02" PRIx8 " %02" PRIx8 " %02" PRIx8 "\n",
-           port, RTE_ETHER_ADDR_BYTES(&addr));
+           " %02" PRIx8 " %02" PRIx8 " %02" PRIx8 ", %u queue(s)\n",
+           port, RTE_ETHER_ADDR_BYTES(&addr), nb_queues);
 
     /* Enable RX in promiscuous mode for the Ethernet device. */
     retval = rte_eth_promiscuous_enable(port);
@@ -161,14 +353,33 @@ enum class Status
     DHCP_START,         // 开始DHCP
     DHCP_DISCOVER_SENT, // 已经发送了DHCP::Discover
 
-    MAIN_LOOP, // 初始化结束，接收数据的主循环
+    SETUP_TASKS, // 创建常驻任务，每个lcore各自创建一份
+    MAIN_LOOP,   // 初始化结束，接收数据的主循环
 
     END, // 结束
 };
 
+class Dispatcher;
+class TCPConnectionTask;
+struct TCPQueueStats;
+class UDPSocket;
+
+// 每个lcore一个Context，负责一对RX/TX队列，拥有自己的Task和连接表，lcore之间不共享状态
 struct Context
 {
-    struct rte_mempool *mbuf_pool;
+    struct rte_mempool *mbuf_pool; // 本lcore所在NUMA节点的mbuf池
+    MbufAllocator *mbufs;          // 本lcore的mbuf分配器，新的数据包都从这里分配
+    Dispatcher *dispatcher; // 收到的数据包通过它分发给对应的Task
+    TxBuffer *tx;           // 所有要发送的数据包都先放到本lcore的发送缓冲区
+    TimerWheel *timers;     // 本lcore的定时器(TCP重传等)
+    ObjectPool<TCPConnectionTask> *tcp_connections; // 本lcore的TCP连接都从这里分配
+    TCPQueueStats *tcp_stats; // 本lcore已经释放的TCP连接的统计信息之和，退出时输出
+    ARPTable *arp;          // 本lcore的ARP表，发往IPv4地址的数据包都通过它发送
+    FIB *fib;               // 本lcore的路由表，决定发往IPv4地址的数据包的下一跳
+    std::vector<UDPSocket *> *udp_ring_sockets; // 绑定了`UDPRing`的UDP Socket，主循环每一轮从它们的发送队列取出数据报发送
+
+    uint16_t queue_id;  // 本lcore负责的RX/TX队列
+    uint16_t nb_queues; // 网卡一共配置了多少个队列
 
     Status status; // 当前的状态
 
@@ -181,28 +392,46 @@ struct Context
 
     struct
     {
-        rte_be32_t xid; // current transaction id
+        rte_be32_t xid;         // current transaction id
+        uint16_t poll_queue_id; // DHCP Offer可能被RSS分到任意一个队列，所以要轮询所有队列
+        rte_be32_t server_addr; // DHCP服务器的地址，续约时使用
+        uint32_t lease_time;    // 租约时长(秒)
     } dhcp_context;
-
-    // 一个局域网内参与测试的其他服务器的mac地址，需要用ARP协议获取。
-    struct rte_ether_addr lan_dst_mac_addr;
-
-    struct rte_ether_addr gateway_mac_addr; // 网关的MAC地址
 };
 
-// 返回`mac_addr`是否为空(全0)
-bool is_mac_addr_empty(const struct rte_ether_addr *mac_addr)
+// 发送一个目的地址为`dst_ip`的IPv4数据包：由路由表选择下一跳，以太网头的MAC地址由ARP表填写
+static void send_ipv4(Context *context, struct rte_mbuf *pkt, rte_be32_t dst_ip)
 {
-    for (int i = 0; i < RTE_ETHER_ADDR_LEN; i++)
+    rte_be32_t next_hop;
+    uint16_t port_id;
+    // 目前只驱动`PORT`一个网口，出口是其他网口的路由也当作不可达
+    if (!context->fib->Lookup(dst_ip, pkt->pkt_len, &next_hop, &port_id) || port_id != PORT)
     {
-        if (mac_addr->addr_bytes[i] > 0)
-        {
-            return false;
-        }
+        rte_pktmbuf_free(pkt);
+        return;
     }
-    return true;
+    context->arp->Output(pkt, next_hop);
+}
+
+// 收到的数据包能否原地改成回复发出去：只有没有其他人引用它(例如被转发给其他lcore、被clone)时才可以修改
+static bool can_reply_in_place(const struct rte_mbuf *pkt)
+{
+    return RTE_MBUF_DIRECT(pkt) && rte_mbuf_refcnt_read(pkt) == 1;
 }
 
+// 把已经原地改好的回复发回给发送方：交换以太网头的MAC地址之后交给发送缓冲区，`pkt`归发送缓冲区所有，
+// 调用者的`TryProcess`要返回`TAKEN`
+static void send_reply_in_place(Context *context, struct rte_mbuf *pkt)
+{
+    struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
+    rte_ether_addr_copy(&eth_hdr->src_addr, &eth_hdr->dst_addr);
+    rte_ether_addr_copy(&context->mac_addr, &eth_hdr->src_addr);
+    context->tx->Send(pkt);
+}
+
+// 收到ARP数据包的lcore把它转发给其他lcore，每个lcore一个队列(ARP数据包不经过RSS，一般都在0号队列)
+static struct rte_ring *arp_rings[MAX_QUEUES];
+
 // 表示一个任务，可能是短期任务也可能是长期任务
 class Task
 {
@@ -220,53 +449,440 @@ public:
     // 如果初始化过程中需要发送什么数据包，可以在这里发送。
     virtual void Setup() {}
 
-    // 这个函数会被不断调用，可以在这个函数中添加定时检查，定时发送数据包。
-    virtual void Tick() {}
+    // 需要定时做的事情(定时发送数据包、重传、超时等)通过`context->timers`注册定时器，
+    // 主循环只会调用已经到期的定时器，不会轮询所有的Task。Task析构前要取消自己的定时器。
 
     enum ProcessResult
     {
         NOT_PROCESSED,
         PROCESSED,
+        TAKEN, // 已经处理，并且数据包被Task接管了(例如放入了乱序队列)，调用者不能再释放它
     };
-    // 处理一个收到的数据包，如果这个数据包属于改Task，就返回`PROCESSED`，否则返回`NOT_PROCESSED`。
-    // 每个数据包只能被一个Task处理。
-    virtual ProcessResult TryProcess(struct rte_mbuf *pkt) { return ProcessResult::NOT_PROCESSED; }
+    // 处理一个收到的数据包，如果这个数据包属于改Task，就返回`PROCESSED`(或`TAKEN`)，否则返回`NOT_PROCESSED`。
+    // 每个数据包只能被一个Task处理。`info`是`ClassifyPacket`解析好的包头信息，Task不需要再重复解析。
+    // 只有在`Dispatcher`中注册过的Task才会收到数据包，见`Setup`。
+    virtual ProcessResult TryProcess(struct rte_mbuf *pkt, const PacketInfo &info) { return ProcessResult::NOT_PROCESSED; }
+
+    // 一批数据包分发完之后调用，只有在这一批中通过`Dispatcher::DeferEndBurst`登记过的Task才会被调用。
+    // 用于把一批中收到的数据包攒起来一次交给应用
+    virtual void EndBurst() {}
 
     // 任务是否还活着
     virtual bool IsAlive() { return true; }
 };
 
+// 根据`PacketInfo`把数据包分发给对应的Task，每个数据包的查找代价是常数，和连接数无关。
+// 查找顺序：
+// 1. ARP：依次交给注册了ARP的Task
+// 2. ICMP：依次交给注册了ICMP的Task
+// 3. TCP/UDP：先按照(proto, local port, remote ip, remote port)查找连接，找不到再按照(proto, local port)在`PortTable`中查找监听的Task，
+//    一个端口有多个监听的Task(`reuse_port`)时按照对端地址选择
+class Dispatcher
+{
+public:
+    struct Stats
+    {
+        uint64_t slow_path;    // 需要逐个解析的数据包(带IP Option)
+        uint64_t dropped;      // 不认识、格式错误或者不是发给自己的数据包
+        uint64_t bad_ip_cksum; // IP包头checksum错误而丢弃的数据包
+        uint64_t bad_l4_cksum; // TCP/UDP/ICMP checksum错误而丢弃的数据包
+        uint64_t gro_merged;   // 被合并到同一个连接前一个数据段中的TCP数据段
+    };
+
+private:
+    Context *context;
+    PacketClassifier classifier;
+    const bool gro; // 网卡不支持LRO时在每一批数据包中合并TCP数据段
+    Stats stats;
+
+    FlowTable<Task> flows;  // 预先分配好的连接表，建立/断开连接时不会分配内存
+    PortTable<Task> ports;  // 监听端口，按照端口直接索引
+    LocalPortSet local_ports; // 监听端口和连接的本地端口，分类时丢弃发往其他端口的数据包
+    Task *end_burst[MAX_PKT_BURST]; // 这一批中要调用`EndBurst`的Task
+    uint16_t nb_end_burst;
+    std::vector<Task *> arp_handlers;
+    std::vector<Task *> icmp_handlers;
+
+    std::unordered_map<Task *, std::vector<uint32_t>> task_listeners; // 每个Task注册过的监听端口，用于`Unbind`
+
+    static uint32_t ListenerKey(uint8_t proto, rte_be16_t local_port) { return ((uint32_t)proto << 16) | local_port; }
+
+public:
+    Dispatcher(Context *context)
+        : context(context), classifier(port_rx_capa.hw_ptype), gro(!port_rx_capa.lro), flows("flow_table", FLOW_TABLE_SIZE, rte_socket_id()),
+          ports("port_table", rte_socket_id()), local_ports("local_ports", rte_socket_id()), nb_end_burst(0)
+    {
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    const char *ClassifierName() const { return classifier.Name(); }
+    const Stats &GetStats() const { return stats; }
+
+    void BindARP(Task *task) { arp_handlers.push_back(task); }
+    void BindICMP(Task *task) { icmp_handlers.push_back(task); }
+
+    // 注册一个监听端口，所有发往该端口且不属于已知连接的数据包都交给`task`，`local_port`为0时监听所有没有被注册的端口。
+    // UDP端口可以关闭软件checksum校验(`verify_l4_cksum`)，网卡已经检查出错误的数据包仍然丢弃。
+    // 所有Task都设置了`reuse_port`时同一个端口可以注册多个Task，同一个对端的数据包总是交给同一个Task。
+    // 端口已经被注册或者端口表满时返回false
+    bool BindListener(Task *task, uint8_t proto, rte_be16_t local_port, bool verify_l4_cksum = true, bool reuse_port = false)
+    {
+        if (!ports.Insert(proto, local_port, task, reuse_port, verify_l4_cksum || proto != IPPROTO_UDP))
+            return false;
+        local_ports.Add(proto, local_port);
+        task_listeners[task].push_back(ListenerKey(proto, local_port));
+        return true;
+    }
+
+    // 在`TryProcess`中调用：这一批数据包都分发完之后调用`task->EndBurst`，同一批中重复登记只调用一次
+    void DeferEndBurst(Task *task)
+    {
+        for (uint16_t i = 0; i < nb_end_burst; i++)
+        {
+            if (end_burst[i] == task)
+                return;
+        }
+        end_burst[nb_end_burst++] = task; // 每个数据包最多登记一个Task，不会超过`MAX_PKT_BURST`
+    }
+
+    // 注册一个连接，连接已经存在或者连接表满时返回false
+    bool BindFlow(Task *task, uint8_t proto, rte_be16_t local_port, rte_be32_t remote_ip, rte_be16_t remote_port)
+    {
+        if (!flows.Insert(FlowKey(proto, local_port, remote_ip, remote_port), task))
+            return false;
+        local_ports.Add(proto, local_port);
+        return true;
+    }
+
+    // 删除一个连接，连接结束时必须调用
+    void UnbindFlow(uint8_t proto, rte_be16_t local_port, rte_be32_t remote_ip, rte_be16_t remote_port)
+    {
+        if (flows.Remove(FlowKey(proto, local_port, remote_ip, remote_port)))
+            local_ports.Remove(proto, local_port);
+    }
+
+    uint32_t NumFlows() const { return flows.Size(); }
+
+    // 删除`task`的ARP/ICMP/监听端口注册信息，Task结束之后必须调用(连接用`UnbindFlow`)
+    void Unbind(Task *task)
+    {
+        arp_handlers.erase(std::remove(arp_handlers.begin(), arp_handlers.end(), task), arp_handlers.end());
+        icmp_handlers.erase(std::remove(icmp_handlers.begin(), icmp_handlers.end(), task), icmp_handlers.end());
+
+        auto lit = task_listeners.find(task);
+        if (lit != task_listeners.end())
+        {
+            for (auto &&key : lit->second)
+            {
+                ports.Remove((uint8_t)(key >> 16), (rte_be16_t)key, task);
+                local_ports.Remove((uint8_t)(key >> 16), (rte_be16_t)key);
+            }
+            task_listeners.erase(lit);
+        }
+    }
+
+    // 分批处理一次收到的数据包，没有被Task接管的数据包都会被释放。分为几个阶段，每个阶段处理完整批数据包再进入下一个阶段：
+    // 1. 用`PacketClassifier`一次判断多个数据包的类别，按照类别分组，不需要处理的数据包(包括发往没有绑定的端口的)直接释放，不解析；
+    //    其余的每一组用`ParseClassified`连续解析，只检查长度、填写`PacketInfo`，不重复分类时已经检查过的字段
+    // 2. 计算TCP/UDP数据包的连接哈希，预取连接表中对应的bucket；网卡不支持LRO时合并同一个连接连续到达的TCP数据段(GRO)
+    // 3. 依次处理ARP、ICMP、UDP、TCP数据包，同一个协议的数据包连续处理，分支预测和指令cache更友好；
+    //    ARP先处理，同一批中等待ARP回复的数据包可以马上发出去。同一个连接的数据包仍然按照收到的顺序处理
+    void DispatchBurst(struct rte_mbuf **pkts, uint16_t nb_pkts)
+    {
+        static_assert(MAX_PKT_BURST <= 64, "parsed packets are tracked in a 64-bit mask");
+        PacketInfo infos[MAX_PKT_BURST];
+
+        uint8_t classes[MAX_PKT_BURST];
+        for (uint16_t i = 0; i < nb_pkts && i < PREFETCH_OFFSET; i++)
+            rte_prefetch0(rte_pktmbuf_mtod(pkts[i], void *));
+        classifier.Classify(pkts, nb_pkts, context->ip_addr, local_ports, classes);
+
+        // 按照类别分组，同一组中保持收到的顺序，分组不需要按照类别的分支。带IP Option的数据包在这里逐个解析，之后不再解析
+        uint16_t groups[CLASSIFY_NB_CLASSES][MAX_PKT_BURST];
+        uint16_t nb_groups[CLASSIFY_NB_CLASSES] = {0};
+        uint64_t parsed = 0;
+        for (uint16_t i = 0; i < nb_pkts; i++)
+        {
+            uint8_t cls = classes[i];
+            if (unlikely(cls == CLASSIFY_SLOW))
+            {
+                stats.slow_path++;
+                cls = (uint8_t)ClassifySlow(pkts[i], &infos[i]);
+                parsed |= 1ULL << i;
+            }
+            groups[cls][nb_groups[cls]++] = i;
+        }
+        for (uint16_t k = 0; k < nb_groups[(uint8_t)PacketClass::UNKNOWN]; k++)
+            rte_pktmbuf_free(pkts[groups[(uint8_t)PacketClass::UNKNOWN][k]]);
+        stats.dropped += nb_groups[(uint8_t)PacketClass::UNKNOWN];
+
+        uint16_t *arp = groups[(uint8_t)PacketClass::ARP], *icmp = groups[(uint8_t)PacketClass::ICMP];
+        uint16_t *udp = groups[(uint8_t)PacketClass::UDP], *tcp = groups[(uint8_t)PacketClass::TCP];
+        const uint16_t nb_arp = ParseGroup<PacketClass::ARP>(pkts, infos, arp, nb_groups[(uint8_t)PacketClass::ARP], parsed);
+        const uint16_t nb_icmp = ParseGroup<PacketClass::ICMP>(pkts, infos, icmp, nb_groups[(uint8_t)PacketClass::ICMP], parsed);
+        const uint16_t nb_udp = ParseGroup<PacketClass::UDP>(pkts, infos, udp, nb_groups[(uint8_t)PacketClass::UDP], parsed);
+        uint16_t nb_tcp = ParseGroup<PacketClass::TCP>(pkts, infos, tcp, nb_groups[(uint8_t)PacketClass::TCP], parsed);
+
+        FlowKey udp_keys[MAX_PKT_BURST], tcp_keys[MAX_PKT_BURST];
+        uint32_t udp_hashes[MAX_PKT_BURST], tcp_hashes[MAX_PKT_BURST];
+        PrefetchFlows(infos, udp, nb_udp, udp_keys, udp_hashes);
+        PrefetchFlows(infos, tcp, nb_tcp, tcp_keys, tcp_hashes);
+        if (gro && nb_tcp > 1)
+            nb_tcp = CoalesceTCP(pkts, infos, tcp, nb_tcp, tcp_keys, tcp_hashes);
+
+        for (uint16_t i = 0; i < nb_arp; i++)
+            Finish(pkts[arp[i]], DispatchList(arp_handlers, pkts[arp[i]], infos[arp[i]]));
+        for (uint16_t i = 0; i < nb_icmp; i++)
+            Finish(pkts[icmp[i]], DispatchList(icmp_handlers, pkts[icmp[i]], infos[icmp[i]]));
+        for (uint16_t i = 0; i < nb_udp; i++)
+            Finish(pkts[udp[i]], DispatchFlow(pkts[udp[i]], infos[udp[i]], udp_keys[i], udp_hashes[i]));
+        for (uint16_t i = 0; i < nb_tcp; i++)
+            Finish(pkts[tcp[i]], DispatchFlow(pkts[tcp[i]], infos[tcp[i]], tcp_keys[i], tcp_hashes[i]));
+
+        for (uint16_t i = 0; i < nb_end_burst; i++)
+            end_burst[i]->EndBurst();
+        nb_end_burst = 0;
+    }
+
+private:
+    // 带IP Option的数据包：完整解析之后再检查目的IP和端口
+    PacketClass ClassifySlow(struct rte_mbuf *pkt, PacketInfo *info) const
+    {
+        const PacketClass cls = ClassifyPacket(pkt, info);
+        if (cls != PacketClass::ARP && info->dst_ip != context->ip_addr)
+            return PacketClass::UNKNOWN;
+        if ((cls == PacketClass::TCP || cls == PacketClass::UDP) && !local_ports.Contains(info->proto, info->dst_port))
+            return PacketClass::UNKNOWN;
+        return cls;
+    }
+
+    // 连续解析同一类别的一组数据包(分组时已经解析过的跳过)并检查checksum，不合格的释放，合格的在`group`中原地压缩，返回剩下的数量
+    template <PacketClass CLS>
+    uint16_t ParseGroup(struct rte_mbuf **pkts, PacketInfo *infos, uint16_t *group, uint16_t n, uint64_t parsed)
+    {
+        uint16_t nb_kept = 0;
+        for (uint16_t k = 0; k < n; k++)
+        {
+            const uint16_t i = group[k];
+            // 快速分类只看了包头中的几个字段，长度不对说明数据包格式错误
+            if (!((parsed >> i) & 1) && unlikely(ParseClassified<CLS>(pkts[i], &infos[i]) != CLS))
+            {
+                stats.dropped++;
+                rte_pktmbuf_free(pkts[i]);
+                continue;
+            }
+            if (CLS != PacketClass::ARP)
+            {
+                if (unlikely(!VerifyIPv4Checksum(pkts[i], infos[i])))
+                {
+                    stats.bad_ip_cksum++;
+                    rte_pktmbuf_free(pkts[i]);
+                    continue;
+                }
+                if (unlikely(!VerifyL4Checksum(pkts[i], infos[i], WantsL4Checksum(infos[i]))))
+                {
+                    stats.bad_l4_cksum++;
+                    rte_pktmbuf_free(pkts[i]);
+                    continue;
+                }
+            }
+            group[nb_kept++] = i;
+        }
+        return nb_kept;
+    }
+
+    void PrefetchFlows(const PacketInfo *infos, const uint16_t *indexes, uint16_t n, FlowKey *keys, uint32_t *hashes) const
+    {
+        for (uint16_t i = 0; i < n; i++)
+        {
+            const PacketInfo &info = infos[indexes[i]];
+            keys[i] = FlowKey(info.proto, info.dst_port, info.src_ip, info.src_port);
+            hashes[i] = keys[i].Hash();
+            flows.Prefetch(hashes[i]);
+        }
+    }
+
+    // 软件GRO：把同一个连接按序连续到达的数据段接到这个连接在本批中最后一个保留的数据段后面(只改包头中的长度、窗口和PSH)，
+    // 连接只处理一次、只回复一个ACK。返回保留下来的TCP数据包数量，`tcp`/`keys`/`hashes`被原地压缩。
+    // 没有用`rte_gro`：它把不能合并的数据包(纯ACK、FIN等)排在合并结果后面，会打乱同一个连接中数据包的顺序。
+    // 这一步在checksum校验之后，合并后的数据包的checksum不再正确，之后也不会再校验
+    uint16_t CoalesceTCP(struct rte_mbuf **pkts, PacketInfo *infos, uint16_t *tcp, uint16_t nb_tcp, FlowKey *keys, uint32_t *hashes)
+    {
+        uint16_t nb_kept = 0;
+        for (uint16_t i = 0; i < nb_tcp; i++)
+        {
+            // 同一个连接在本批中最后一个保留的数据段，只往它后面接，保证同一个连接的数据包顺序不变
+            int32_t k = nb_kept - 1;
+            while (k >= 0 && (hashes[k] != hashes[i] || !(keys[k] == keys[i])))
+                k--;
+            if (k >= 0 && TryMerge(pkts[tcp[k]], &infos[tcp[k]], pkts[tcp[i]], infos[tcp[i]]))
+            {
+                stats.gro_merged++;
+                continue;
+            }
+            tcp[nb_kept] = tcp[i];
+            keys[nb_kept] = keys[i];
+            hashes[nb_kept] = hashes[i];
+            nb_kept++;
+        }
+        return nb_kept;
+    }
+
+    // 和Linux GRO的条件相同：序列号连续、确认号和TCP Option完全相同，前一个数据段只有ACK标志，后一个只有ACK或者ACK,PSH。
+    // 成功时`pkt`被接到`head`后面
+    static bool TryMerge(struct rte_mbuf *head, PacketInfo *head_info, struct rte_mbuf *pkt, const PacketInfo &info)
+    {
+        struct rte_tcp_hdr *head_tcp = (struct rte_tcp_hdr *)head_info->l4_hdr;
+        const struct rte_tcp_hdr *tcp_hdr = (const struct rte_tcp_hdr *)info.l4_hdr;
+        const uint32_t tcp_hdr_len = (tcp_hdr->data_off >> 4) * 4;
+        if (head_tcp->tcp_flags != RTE_TCP_ACK_FLAG || (tcp_hdr->tcp_flags & ~RTE_TCP_PSH_FLAG) != RTE_TCP_ACK_FLAG ||
+            head_info->payload_length == 0 || info.payload_length == 0 ||
+            head_info->payload_length + info.payload_length > TCP_GRO_MAX_BYTES ||
+            rte_be_to_cpu_32(head_tcp->sent_seq) + head_info->payload_length != rte_be_to_cpu_32(tcp_hdr->sent_seq) ||
+            head_tcp->recv_ack != tcp_hdr->recv_ack || head_tcp->data_off != tcp_hdr->data_off ||
+            memcmp(head_tcp + 1, tcp_hdr + 1, tcp_hdr_len - sizeof(*tcp_hdr)) != 0 ||
+            head->nb_segs + pkt->nb_segs > RTE_MBUF_MAX_NB_SEGS)
+            return false;
+
+        // 去掉两个数据包末尾的以太网填充，`pkt`只保留负载
+        mbuf_trim_tail(head, (uint32_t)(head_info->payload - rte_pktmbuf_mtod(head, uint8_t *)) + head_info->payload_length);
+        head_tcp->rx_win = tcp_hdr->rx_win;
+        head_tcp->tcp_flags |= tcp_hdr->tcp_flags;
+        rte_pktmbuf_adj(pkt, info.payload - rte_pktmbuf_mtod(pkt, uint8_t *));
+        mbuf_trim_tail(pkt, info.payload_length);
+        rte_pktmbuf_chain(head, pkt);
+
+        head_info->payload_length += info.payload_length;
+        head_info->ip_hdr->total_length = rte_cpu_to_be_16(rte_be_to_cpu_16(head_info->ip_hdr->total_length) + info.payload_length);
+        return true;
+    }
+
+    // 先按照连接查找，找不到或者连接不处理再交给监听端口的Task
+    Task::ProcessResult DispatchFlow(struct rte_mbuf *pkt, const PacketInfo &info, const FlowKey &key, uint32_t hash)
+    {
+        Task *flow = flows.Lookup(key, hash);
+        if (flow)
+        {
+            Task::ProcessResult result = flow->TryProcess(pkt, info);
+            if (result != Task::ProcessResult::NOT_PROCESSED)
+                return result;
+        }
+
+        const PortTable<Task>::Group *group = ports.Lookup(info.proto, info.dst_port);
+        if (group)
+            return PortTable<Task>::Select(group, hash)->TryProcess(pkt, info);
+        return Task::ProcessResult::NOT_PROCESSED;
+    }
+
+    // 只有发往关闭了校验的UDP端口的数据包不用软件校验L4 checksum
+    bool WantsL4Checksum(const PacketInfo &info) const
+    {
+        if (info.cls != PacketClass::UDP)
+            return true;
+        const PortTable<Task>::Group *group = ports.Lookup(info.proto, info.dst_port);
+        return !group || group->verify_l4_cksum;
+    }
+
+    static void Finish(struct rte_mbuf *pkt, Task::ProcessResult result)
+    {
+        if (result != Task::ProcessResult::TAKEN)
+            rte_pktmbuf_free(pkt);
+    }
+
+    static Task::ProcessResult DispatchList(const std::vector<Task *> &handlers, struct rte_mbuf *pkt, const PacketInfo &info)
+    {
+        for (auto &&task : handlers)
+        {
+            Task::ProcessResult result = task->TryProcess(pkt, info);
+            if (result != Task::ProcessResult::NOT_PROCESSED)
+                return result;
+        }
+        return Task::ProcessResult::NOT_PROCESSED;
+    }
+};
+
 // 常驻任务，响应ARP Request
 class ARPReplyTask : public Task
 {
 public:
-    using Task::Task;
+    struct Stats
+    {
+        uint64_t replied_in_place; // 直接把请求改成回复发送
+        uint64_t replied;          // 分配新的mbuf构造回复(请求被转发给了其他lcore)
+        uint64_t alloc_failed;     // 没有mbuf，没有回复
+    };
+
+private:
+    Stats stats;
+
+public:
+    ARPReplyTask(const std::string &name, Context *context) : Task(name, context) { memset(&stats, 0, sizeof(stats)); }
+
+    virtual void Setup() override final
+    {
+        context->dispatcher->BindARP(this);
+    }
 
-    virtual ProcessResult TryProcess(struct rte_mbuf *pkt) override final
+    virtual ProcessResult TryProcess(struct rte_mbuf *pkt, const PacketInfo &info) override final
     {
-        struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
-        assert(eth_hdr);
-        if (rte_be_to_cpu_16(eth_hdr->ether_type) == RTE_ETHER_TYPE_ARP)
+        struct rte_arp_hdr *arp_hdr = (struct rte_arp_hdr *)info.l4_hdr;
+        // 请求和回复都可以用来更新ARP表，其他lcore的ARP表也要更新
+        context->arp->Input(arp_hdr);
+        Forward(pkt);
+
+        if (rte_be_to_cpu_16(arp_hdr->arp_opcode) == RTE_ARP_OP_REQUEST)
         {
-            struct rte_arp_hdr *arp_hdr = (struct rte_arp_hdr *)(eth_hdr + 1);
-            if (rte_be_to_cpu_16(arp_hdr->arp_hardware) == RTE_ARP_HRD_ETHER && rte_be_to_cpu_16(arp_hdr->arp_protocol) == RTE_ETHER_TYPE_IPV4 && rte_be_to_cpu_16(arp_hdr->arp_opcode) == RTE_ARP_OP_REQUEST)
+            if (arp_hdr->arp_data.arp_tip == context->ip_addr) // 查询的是我的IP地址
             {
-                if (arp_hdr->arp_data.arp_tip == context->ip_addr) // 查询的是我的IP地址
+                // 转发给了其他lcore的请求它们还要读取，不能修改
+                if (can_reply_in_place(pkt))
                 {
-                    SendARPReply(arp_hdr->arp_data.arp_sha, arp_hdr->arp_data.arp_sip);
-                    return ProcessResult::PROCESSED;
+                    ReplyInPlace(pkt, arp_hdr);
+                    return ProcessResult::TAKEN;
                 }
+                SendARPReply(arp_hdr->arp_data.arp_sha, arp_hdr->arp_data.arp_sip);
             }
         }
-        return ProcessResult::NOT_PROCESSED;
+        return ProcessResult::PROCESSED;
     }
 
+    const Stats &GetStats() const { return stats; }
+
 private:
+    // 把`pkt`交给其他lcore，它们只用来更新自己的ARP表，不会回复
+    void Forward(struct rte_mbuf *pkt)
+    {
+        for (uint16_t queue_id = 0; queue_id < context->nb_queues; queue_id++)
+        {
+            if (queue_id == context->queue_id || !arp_rings[queue_id])
+                continue;
+            rte_mbuf_refcnt_update(pkt, 1);
+            if (rte_ring_enqueue(arp_rings[queue_id], pkt) != 0)
+                rte_mbuf_refcnt_update(pkt, -1);
+        }
+    }
+
+    // 把ARP请求原地改成回复
+    void ReplyInPlace(struct rte_mbuf *pkt, struct rte_arp_hdr *arp_hdr)
+    {
+        arp_hdr->arp_opcode = rte_cpu_to_be_16(RTE_ARP_OP_REPLY);
+        arp_hdr->arp_data.arp_tha = arp_hdr->arp_data.arp_sha;
+        arp_hdr->arp_data.arp_tip = arp_hdr->arp_data.arp_sip;
+        arp_hdr->arp_data.arp_sha = context->mac_addr;
+        arp_hdr->arp_data.arp_sip = context->ip_addr;
+        send_reply_in_place(context, pkt);
+        stats.replied_in_place++;
+    }
+
     void SendARPReply(struct rte_ether_addr dst_mac_addr, rte_be32_t dst_ip_addr)
     {
-        struct rte_mbuf *pkt = rte_pktmbuf_alloc(context->mbuf_pool);
+        // mbuf不够时不回复，对方会重发ARP请求
+        struct rte_mbuf *pkt = context->mbufs->Alloc(MbufPriority::NORMAL);
         if (!pkt)
-            rte_exit(EXIT_FAILURE, "Failed to alloc pkt\n");
+        {
+            stats.alloc_failed++;
+            return;
+        }
 
         struct rte_ether_hdr *seth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
         rte_ether_addr_copy(&context->mac_addr, &seth_hdr->src_addr);
@@ -290,10 +906,8 @@ private:
         pkt->data_len = pkt->pkt_len;
         pkt->l2_len = sizeof(struct rte_ether_hdr) + sizeof(struct rte_arp_hdr);
 
-        const uint16_t nb_tx = rte_eth_tx_burst(PORT, 0, &pkt, 1);
-        assert(nb_tx == 1);
-
-        printf("[ARP] Reply ARP Request\n");
+        context->tx->Send(pkt);
+        stats.replied++;
     }
 };
 
@@ -301,51 +915,87 @@ private:
 class PingReplyTask : public Task
 {
 public:
-    using Task::Task;
+    struct Stats
+    {
+        uint64_t replied_in_place; // 直接把请求改成回复发送
+        uint64_t replied;          // 分配新的mbuf构造回复
+        uint64_t alloc_failed;     // 没有mbuf，没有回复
+    };
+
+private:
+    Stats stats;
+
+public:
+    PingReplyTask(const std::string &name, Context *context) : Task(name, context) { memset(&stats, 0, sizeof(stats)); }
 
-    virtual ProcessResult TryProcess(struct rte_mbuf *pkt) override final
+    virtual void Setup() override final
     {
-        struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
-        assert(eth_hdr);
-        if (rte_be_to_cpu_16(eth_hdr->ether_type) == RTE_ETHER_TYPE_IPV4)
+        context->dispatcher->BindICMP(this);
+    }
+
+    virtual ProcessResult TryProcess(struct rte_mbuf *pkt, const PacketInfo &info) override final
+    {
+        struct rte_icmp_hdr *icmp_hdr = (struct rte_icmp_hdr *)info.l4_hdr;
+        if (icmp_hdr->icmp_type == RTE_IP_ICMP_ECHO_REQUEST)
         {
-            struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
-            if (ip_hdr->next_proto_id == IPPROTO_ICMP && ip_hdr->dst_addr == context->ip_addr)
+            if (can_reply_in_place(pkt))
             {
-                struct rte_icmp_hdr *icmp_hdr = (struct rte_icmp_hdr *)(ip_hdr + 1);
-                if (icmp_hdr->icmp_type == RTE_IP_ICMP_ECHO_REQUEST)
-                {
-                    SendPingReply(eth_hdr->src_addr, ip_hdr->src_addr, icmp_hdr->icmp_ident, icmp_hdr->icmp_seq_nb, (uint8_t *)(icmp_hdr + 1), rte_be_to_cpu_16(ip_hdr->total_length) - sizeof(*ip_hdr) - sizeof(icmp_hdr));
-                    return ProcessResult::PROCESSED;
-                }
+                ReplyInPlace(pkt, info);
+                return ProcessResult::TAKEN;
             }
+            SendPingReply(info.eth_hdr->src_addr, info.src_ip, icmp_hdr->icmp_ident, icmp_hdr->icmp_seq_nb, info.payload, info.payload_length);
+            return ProcessResult::PROCESSED;
         }
         return ProcessResult::NOT_PROCESSED;
     }
 
+    const Stats &GetStats() const { return stats; }
+
 private:
+    // 把Echo Request原地改成Echo Reply：交换IP地址(不影响checksum)，重置TTL，修改ICMP类型，两个checksum都增量更新，负载不动
+    void ReplyInPlace(struct rte_mbuf *pkt, const PacketInfo &info)
+    {
+        struct rte_ipv4_hdr *ip_hdr = info.ip_hdr;
+        ip_hdr->dst_addr = ip_hdr->src_addr;
+        ip_hdr->src_addr = context->ip_addr;
+        const uint16_t old_ttl_proto = *(const uint16_t *)&ip_hdr->time_to_live;
+        ip_hdr->time_to_live = IP_DEFTTL;
+        if ((pkt->ol_flags & RTE_MBUF_F_RX_IP_CKSUM_MASK) == RTE_MBUF_F_RX_IP_CKSUM_NONE)
+        {
+            // 收到的包头中checksum字段本来就不对(网卡只保证了包头完整)，不能增量更新
+            ip_hdr->hdr_checksum = 0;
+            ip_hdr->hdr_checksum = Checksum::IPv4Header(ip_hdr);
+        }
+        else
+        {
+            ip_hdr->hdr_checksum = Checksum::Update16(ip_hdr->hdr_checksum, old_ttl_proto, *(const uint16_t *)&ip_hdr->time_to_live);
+        }
+
+        struct rte_icmp_hdr *icmp_hdr = (struct rte_icmp_hdr *)info.l4_hdr;
+        const uint16_t old_type_code = *(const uint16_t *)icmp_hdr;
+        icmp_hdr->icmp_type = RTE_IP_ICMP_ECHO_REPLY;
+        icmp_hdr->icmp_code = 0;
+        icmp_hdr->icmp_cksum = Checksum::Update16(icmp_hdr->icmp_cksum, old_type_code, *(const uint16_t *)icmp_hdr);
+
+        send_reply_in_place(context, pkt);
+        stats.replied_in_place++;
+    }
+
     void SendPingReply(struct rte_ether_addr dst_mac_addr, rte_be32_t dst_ip_addr, rte_be16_t icmp_ident, rte_be16_t icmp_seq_nb, uint8_t *payload, uint32_t payload_length)
     {
-        struct rte_mbuf *pkt = rte_pktmbuf_alloc(context->mbuf_pool);
+        struct rte_mbuf *pkt = context->mbufs->Alloc(MbufPriority::NORMAL);
         if (!pkt)
-            rte_exit(EXIT_FAILURE, "Failed to alloc pkt\n");
+        {
+            stats.alloc_failed++;
+            return;
+        }
 
+        // 回复发给请求的来源，不经过路由表和ARP表，目的MAC直接填写
+        PacketTemplate tmpl;
+        tmpl.Init(IPPROTO_ICMP, context->mac_addr, context->ip_addr, dst_ip_addr);
+        struct rte_ipv4_hdr *ip_hdr = tmpl.Apply(pkt, 0, payload_length);
         struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
-        rte_ether_addr_copy(&context->mac_addr, &eth_hdr->src_addr);
         rte_ether_addr_copy(&dst_mac_addr, &eth_hdr->dst_addr);
-        eth_hdr->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
-
-        struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
-        memset(ip_hdr, 0, sizeof(*ip_hdr));
-        ip_hdr->version_ihl = IP_VHL_DEF;
-        ip_hdr->type_of_service = 0;
-        ip_hdr->fragment_offset = 0;
-        ip_hdr->time_to_live = IP_DEFTTL;
-        ip_hdr->packet_id = 0;
-        ip_hdr->src_addr = context->ip_addr;
-        ip_hdr->dst_addr = dst_ip_addr;
-        ip_hdr->next_proto_id = IPPROTO_ICMP;
-        ip_hdr->total_length = rte_cpu_to_be_16(sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_icmp_hdr) + payload_length);
 
         struct rte_icmp_hdr *icmp_hdr = (struct rte_icmp_hdr *)(ip_hdr + 1);
         icmp_hdr->icmp_type = RTE_IP_ICMP_ECHO_REPLY;
@@ -354,155 +1004,215 @@ private:
         icmp_hdr->icmp_seq_nb = icmp_seq_nb;
         icmp_hdr->icmp_cksum = 0;
         rte_memcpy((void *)(icmp_hdr + 1), payload, payload_length);
-        icmp_hdr->icmp_cksum = CalculateChecksum(reinterpret_cast<uint16_t *>(icmp_hdr), sizeof(*icmp_hdr) + payload_length);
-
-        // Fill other DPDK metadata
-        pkt->packet_type = RTE_PTYPE_L2_ETHER | RTE_PTYPE_L3_IPV4 | RTE_PTYPE_L4_ICMP;
-        const uint32_t PKT_LEN = sizeof(*eth_hdr) + sizeof(*ip_hdr) + sizeof(*icmp_hdr) + payload_length;
-        pkt->pkt_len = PKT_LEN;
-        pkt->data_len = pkt->pkt_len;
-        pkt->l2_len = sizeof(struct rte_ether_hdr);
-        pkt->l3_len = sizeof(struct rte_ipv4_hdr);
-        pkt->l4_len = sizeof(struct rte_icmp_hdr);
-        pkt->ol_flags |= (RTE_MBUF_F_TX_IPV4 | RTE_MBUF_F_TX_IP_CKSUM);
+        icmp_hdr->icmp_cksum = ~Checksum::Raw(icmp_hdr, sizeof(*icmp_hdr) + payload_length);
 
-        const uint16_t nb_tx = rte_eth_tx_burst(PORT, 0, &pkt, 1);
-        assert(nb_tx == 1);
-
-        printf("[PING] Reply Ping Request\n");
-    }
-
-    uint16_t CalculateChecksum(uint16_t *addr, int len)
-    {
-        uint32_t sum = 0;
-        uint16_t result = 0;
-        while (len > 1)
-        {
-            sum += *addr++;
-            len -= 2;
-        }
-        if (len == 1)
-        {
-            sum += *(unsigned char *)addr;
-        }
-        sum = (sum >> 16) + (sum & 0xFFFF);
-        sum += (sum >> 16);
-        result = ~sum;
-        return result;
+        context->tx->Send(pkt);
+        stats.replied++;
     }
 };
 
-// 接收指定端口的UDP数据包
-class UDPReceiveTask : public Task
+// UDP应用：同一个lcore上的`UDPSocket`每一批收到的数据报调用一次`OnReceive`
+class UDPApplication
 {
-    int port;
+public:
+    virtual ~UDPApplication() {}
+
+    // `dgrams`直接指向收包mbuf中的负载，没有复制，返回之后由`UDPSocket`释放。
+    // 要保留(或者交给`SendBatch`)的数据报把`dgrams[i].mbuf`设为nullptr，之后由应用负责释放
+    virtual void OnReceive(UDPSocket *sock, UDPDatagram *dgrams, uint16_t n) = 0;
+};
 
+// UDP Socket：绑定一个本地端口，每个lcore一个(RSS把同一个端口的数据报分散到所有队列)。
+// 一批中收到的数据报攒起来，在这一批分发完之后一次交给同一个lcore上的`UDPApplication`，或者放入`UDPRing`交给应用lcore，
+// 不复制负载，也不分配内存。发送时在应用的mbuf前面填写包头(`SendBatch`)，包头从创建时构造的模板复制。
+// `verify_cksum`为false时网卡没有检查的数据报不用软件校验；`tx_cksum`为false时不计算UDP checksum(填0，IPv4允许)。
+// 多个应用lcore分担一个端口时，给每个应用lcore一个`UDPRing`，每个lcore上为每个`UDPRing`创建一个`reuse_port`的Socket，
+// 数据报按照对端地址分到各个`UDPRing`，同一个对端的数据报总是由同一个应用lcore处理
+class UDPSocket : public Task
+{
 public:
-    UDPReceiveTask(int port, const std::string &name, Context *context)
-        : Task(name, context), port(port)
+    struct Stats
     {
-    }
+        uint64_t rx_datagrams;
+        uint64_t rx_dropped; // `UDPRing`满而丢弃
+        uint64_t tx_datagrams;
+        uint64_t tx_failed;  // headroom不够或者数据报太长
+    };
 
-    virtual ProcessResult TryProcess(struct rte_mbuf *pkt) override final
-    {
-        struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
-        assert(eth_hdr);
-        if (rte_be_to_cpu_16(eth_hdr->ether_type) == RTE_ETHER_TYPE_IPV4)
-        {
-            struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
-            if (ip_hdr->dst_addr == context->ip_addr && ip_hdr->next_proto_id == IPPROTO_UDP)
-            {
-                struct rte_udp_hdr *udp_hdr = (struct rte_udp_hdr *)(ip_hdr + 1);
-                if (rte_be_to_cpu_16(udp_hdr->dst_port) == port)
-                {
-                    printf("[UDP] Received from %s:%d to %s:%d with message = `%s`\n",
-                           format_ipv4(ip_hdr->src_addr).c_str(), (int)rte_be_to_cpu_16(udp_hdr->src_port),
-                           format_ipv4(ip_hdr->dst_addr).c_str(), (int)rte_be_to_cpu_16(udp_hdr->dst_port),
-                           std::string((char *)(udp_hdr + 1), rte_be_to_cpu_16(udp_hdr->dgram_len) - sizeof(*udp_hdr)).c_str());
-                    return ProcessResult::PROCESSED;
-                }
-            }
-        }
-        return ProcessResult::NOT_PROCESSED;
-    }
-};
+private:
+    rte_be16_t local_port;
+    UDPApplication *app;
+    UDPRing *ring; // 不为nullptr时收到的数据报交给应用lcore，不调用`app`
+    const bool verify_cksum;
+    const bool tx_cksum;
+    const bool reuse_port;
+    PacketTemplate hdr_template;
 
-// 使用ARP协议查询MAC地址
-class ARPRequestTask : public Task
-{
-    rte_be32_t query_ip;             // 要查询的IP
-    struct rte_ether_addr *write_to; // 查询到MAC地址之后写到这里
+    struct rte_mbuf *pending[MAX_PKT_BURST]; // 这一批收到、还没有交给应用的数据报
+    uint16_t nb_pending;
+    Stats stats;
 
 public:
-    ARPRequestTask(rte_be32_t query_ip, struct rte_ether_addr *write_to, const std::string &name, Context *context)
-        : Task(name, context), query_ip(query_ip), write_to(write_to)
+    UDPSocket(const std::string &name, Context *context, rte_be16_t local_port, UDPApplication *app, UDPRing *ring = nullptr,
+              bool verify_cksum = true, bool tx_cksum = true, bool reuse_port = false)
+        : Task(name, context), local_port(local_port), app(app), ring(ring), verify_cksum(verify_cksum), tx_cksum(tx_cksum),
+          reuse_port(reuse_port), nb_pending(0)
+    {
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    virtual ~UDPSocket() override
     {
+        if (nb_pending)
+            rte_pktmbuf_free_bulk(pending, nb_pending);
+        if (ring)
+        {
+            std::vector<UDPSocket *> &sockets = *context->udp_ring_sockets;
+            sockets.erase(std::remove(sockets.begin(), sockets.end(), this), sockets.end());
+        }
+        printf("[UDP] %s: received %" PRIu64 ", dropped %" PRIu64 ", sent %" PRIu64 ", failed %" PRIu64 "\n",
+               name.c_str(), stats.rx_datagrams, stats.rx_dropped, stats.tx_datagrams, stats.tx_failed);
     }
 
     virtual void Setup() override final
     {
-        struct rte_mbuf *pkt = rte_pktmbuf_alloc(context->mbuf_pool);
-        if (!pkt)
-            rte_exit(EXIT_FAILURE, "Failed to alloc pkt\n");
+        hdr_template.Init(IPPROTO_UDP, context->mac_addr, context->ip_addr, 0, local_port, 0);
+        if (!context->dispatcher->BindListener(this, IPPROTO_UDP, local_port, verify_cksum, reuse_port))
+            printf("[UDP] %s: cannot bind port %u\n", name.c_str(), rte_be_to_cpu_16(local_port));
+        if (ring)
+            context->udp_ring_sockets->push_back(this);
+    }
 
-        struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
-        rte_ether_addr_copy(&context->mac_addr, &eth_hdr->src_addr);
-        memset(&eth_hdr->dst_addr, 0xFF, sizeof(eth_hdr->dst_addr));
-        eth_hdr->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_ARP);
-
-        struct rte_arp_hdr *arp_hdr = (struct rte_arp_hdr *)(eth_hdr + 1);
-        arp_hdr->arp_hardware = rte_cpu_to_be_16(RTE_ARP_HRD_ETHER);
-        arp_hdr->arp_protocol = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
-        arp_hdr->arp_hlen = 6;
-        arp_hdr->arp_plen = 4;
-        arp_hdr->arp_opcode = rte_cpu_to_be_16(RTE_ARP_OP_REQUEST);
-        arp_hdr->arp_data.arp_sha = context->mac_addr;
-        arp_hdr->arp_data.arp_sip = context->ip_addr;
-        memset(&arp_hdr->arp_data.arp_tha, 0, sizeof(arp_hdr->arp_data.arp_tha));
-        arp_hdr->arp_data.arp_tip = query_ip;
+    virtual ProcessResult TryProcess(struct rte_mbuf *pkt, const PacketInfo &info) override final
+    {
+        // 描述符根据这两个长度找到UDP包头，数据报交给其他lcore之后也不需要重新解析
+        pkt->l2_len = (uint8_t *)info.ip_hdr - (uint8_t *)info.eth_hdr;
+        pkt->l3_len = (uint8_t *)info.l4_hdr - (uint8_t *)info.ip_hdr;
+        if (nb_pending == 0)
+            context->dispatcher->DeferEndBurst(this);
+        pending[nb_pending++] = pkt;
+        stats.rx_datagrams++;
+        return ProcessResult::TAKEN;
+    }
 
-        // Fill other DPDK metadata
-        pkt->packet_type = RTE_PTYPE_L2_ETHER_ARP;
-        const uint32_t PKT_LEN = sizeof(*eth_hdr) + sizeof(*arp_hdr);
-        pkt->pkt_len = PKT_LEN;
-        pkt->data_len = pkt->pkt_len;
-        pkt->l2_len = sizeof(struct rte_ether_hdr) + sizeof(struct rte_arp_hdr);
+    virtual void EndBurst() override final
+    {
+        if (ring)
+        {
+            const uint16_t delivered = ring->Deliver(pending, nb_pending);
+            if (delivered < nb_pending)
+            {
+                stats.rx_dropped += nb_pending - delivered;
+                rte_pktmbuf_free_bulk(pending + delivered, nb_pending - delivered);
+            }
+        }
+        else
+        {
+            UDPDatagram dgrams[MAX_PKT_BURST];
+            for (uint16_t i = 0; i < nb_pending; i++)
+                UDPDatagramFromMbuf(pending[i], &dgrams[i]);
+            app->OnReceive(this, dgrams, nb_pending);
+            for (uint16_t i = 0; i < nb_pending; i++)
+            {
+                if (dgrams[i].mbuf)
+                    rte_pktmbuf_free(dgrams[i].mbuf);
+            }
+        }
+        nb_pending = 0;
+    }
 
-        const uint16_t nb_tx = rte_eth_tx_burst(PORT, 0, &pkt, 1);
-        assert(nb_tx == 1);
+    // 类似`sendmmsg`：依次发送`msgs`，返回发送的数量，之后的mbuf(headroom不够)仍然归调用者所有
+    uint16_t SendBatch(const UDPMessage *msgs, uint16_t n)
+    {
+        uint16_t i = 0;
+        for (; i < n; i++)
+        {
+            if (!UDPReserveHeaders(msgs[i].mbuf, msgs[i].remote_ip, msgs[i].remote_port))
+            {
+                stats.tx_failed++;
+                break;
+            }
+            Transmit(msgs[i].mbuf);
+        }
+        return i;
+    }
 
-        printf("[ARP] Sent ARP request for %s\n", format_ipv4(query_ip).c_str());
+    // 主循环调用：发送应用lcore放入`UDPRing`的数据报
+    void PollRing()
+    {
+        struct rte_mbuf *pkts[MAX_PKT_BURST];
+        const uint16_t nb = ring->Collect(pkts, MAX_PKT_BURST);
+        for (uint16_t i = 0; i < nb; i++)
+            Transmit(pkts[i]);
     }
 
-    virtual ProcessResult TryProcess(struct rte_mbuf *pkt) override final
+    const Stats &GetStats() const { return stats; }
+
+private:
+    // `pkt`前面已经预留了包头并写好了目的地址和端口，其余字段从模板复制
+    void Transmit(struct rte_mbuf *pkt)
     {
-        if (!IsAlive())
-            return ProcessResult::NOT_PROCESSED;
+        if (unlikely(pkt->pkt_len - sizeof(struct rte_ether_hdr) > UINT16_MAX))
+        {
+            stats.tx_failed++;
+            rte_pktmbuf_free(pkt);
+            return;
+        }
 
-        struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
-        assert(eth_hdr);
-        if (rte_be_to_cpu_16(eth_hdr->ether_type) == RTE_ETHER_TYPE_ARP)
+        const struct rte_ipv4_hdr *reserved = rte_pktmbuf_mtod_offset(pkt, const struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+        const rte_be32_t remote_ip = reserved->dst_addr;
+        const rte_be16_t remote_port = ((const struct rte_udp_hdr *)(reserved + 1))->dst_port;
+
+        // 应用可能直接回复收到的mbuf，清掉收包时的offload标志，只保留mbuf本身的属性
+        pkt->ol_flags &= RTE_MBUF_F_INDIRECT | RTE_MBUF_F_EXTERNAL;
+        struct rte_ipv4_hdr *ip_hdr = hdr_template.ApplyInPlace(pkt);
+        struct rte_udp_hdr *udp_hdr = (struct rte_udp_hdr *)(ip_hdr + 1);
+        ip_hdr->dst_addr = remote_ip;
+        udp_hdr->dst_port = remote_port;
+        if (tx_cksum)
         {
-            struct rte_arp_hdr *arp_hdr = (struct rte_arp_hdr *)(eth_hdr + 1);
-            if (rte_be_to_cpu_16(arp_hdr->arp_hardware) == RTE_ARP_HRD_ETHER && rte_be_to_cpu_16(arp_hdr->arp_protocol) == RTE_ETHER_TYPE_IPV4 && rte_be_to_cpu_16(arp_hdr->arp_opcode) == RTE_ARP_OP_REPLY)
-            {
-                if (arp_hdr->arp_data.arp_sip == query_ip)
-                {
-                    *write_to = arp_hdr->arp_data.arp_sha;
-                    printf("[ARP] MAC address for %s is " RTE_ETHER_ADDR_PRT_FMT "\n",
-                           format_ipv4(query_ip).c_str(),
-                           RTE_ETHER_ADDR_BYTES(write_to));
-                    return ProcessResult::PROCESSED;
-                }
-            }
+            udp_hdr->dgram_cksum = rte_ipv4_phdr_cksum(ip_hdr, pkt->ol_flags);
         }
-        return ProcessResult::NOT_PROCESSED;
+        else
+        {
+            pkt->ol_flags &= ~RTE_MBUF_F_TX_L4_MASK;
+            udp_hdr->dgram_cksum = 0;
+        }
+
+        stats.tx_datagrams++;
+        send_ipv4(context, pkt, remote_ip);
+    }
+};
+
+// 把收到的UDP数据报原样发回去：直接用收包mbuf发送，不分配也不复制
+class UDPEchoApplication : public UDPApplication
+{
+public:
+    virtual void OnReceive(UDPSocket *sock, UDPDatagram *dgrams, uint16_t n) override
+    {
+        UDPMessage msgs[MAX_PKT_BURST];
+        const uint16_t nb_msgs = PrepareReplies(dgrams, n, msgs);
+        const uint16_t sent = sock->SendBatch(msgs, nb_msgs);
+        for (uint16_t i = sent; i < nb_msgs; i++)
+            rte_pktmbuf_free(msgs[i].mbuf);
     }
 
-    // 根据`write_to`是否被写入了数据判断本次ARP请求是否结束
-    virtual bool IsAlive() override final
+    // 把收到的数据报改成发回给对方的消息，mbuf交给`msgs`的数据报`mbuf`设为nullptr，返回消息的数量。应用lcore也用它回复
+    static uint16_t PrepareReplies(UDPDatagram *dgrams, uint16_t n, UDPMessage *msgs)
     {
-        return is_mac_addr_empty(write_to);
+        uint16_t nb_msgs = 0;
+        for (uint16_t i = 0; i < n; i++)
+        {
+            struct rte_mbuf *pkt = dgrams[i].mbuf;
+            if (!can_reply_in_place(pkt))
+                continue;
+            // 只保留负载(去掉包头和以太网填充)，包头空间由`SendBatch`/`UDPRing::Send`重新预留
+            rte_pktmbuf_adj(pkt, dgrams[i].data - rte_pktmbuf_mtod(pkt, uint8_t *));
+            mbuf_trim_tail(pkt, dgrams[i].length);
+            msgs[nb_msgs++] = UDPMessage{dgrams[i].remote_ip, dgrams[i].remote_port, pkt};
+            dgrams[i].mbuf = nullptr;
+        }
+        return nb_msgs;
     }
 };
 
@@ -512,63 +1222,249 @@ class UDPSendTask : public Task
     int src_port;
     rte_be32_t dst_ip;
     int dst_port;
-    struct rte_ether_addr *dst_mac_addr;
 
-    uint64_t tsc_hz;
-    uint64_t last_sent_at_tsc;
+    PacketTemplate hdr_template;
+    Timer send_timer; // 每秒发送一次
 
 public:
-    UDPSendTask(int src_port, rte_be32_t dst_ip, int dst_port, struct rte_ether_addr *dst_mac_addr, const std::string &name, Context *context)
-        : Task(name, context), src_port(src_port), dst_ip(dst_ip), dst_port(dst_port), dst_mac_addr(dst_mac_addr)
+    UDPSendTask(int src_port, rte_be32_t dst_ip, int dst_port, const std::string &name, Context *context)
+        : Task(name, context), src_port(src_port), dst_ip(dst_ip), dst_port(dst_port), send_timer(OnSendTimer, this)
     {
-        this->tsc_hz = rte_get_tsc_hz();
-        this->last_sent_at_tsc = rte_get_tsc_cycles();
     }
 
-    virtual void Tick() override final
+    virtual ~UDPSendTask() override
     {
-        uint64_t now_tsc = rte_get_tsc_cycles();
-        if (now_tsc - last_sent_at_tsc < tsc_hz)
-        {
-            return;
-        }
-        last_sent_at_tsc = now_tsc;
+        context->timers->Cancel(&send_timer);
+    }
+
+    virtual void Setup() override final
+    {
+        hdr_template.Init(IPPROTO_UDP, context->mac_addr, context->ip_addr, dst_ip, rte_cpu_to_be_16(src_port), rte_cpu_to_be_16(dst_port));
+        context->timers->Schedule(&send_timer, US_PER_S);
+    }
 
-        struct rte_mbuf *pkt = rte_pktmbuf_alloc(context->mbuf_pool);
+private:
+    static void OnSendTimer(Timer *timer, void *arg)
+    {
+        UDPSendTask *self = static_cast<UDPSendTask *>(arg);
+        self->context->timers->Schedule(timer, US_PER_S);
+        self->SendMessage();
+    }
+
+    void SendMessage()
+    {
+        struct rte_mbuf *pkt = context->mbufs->Alloc(MbufPriority::NORMAL);
         if (!pkt)
-            rte_exit(EXIT_FAILURE, "Failed to alloc pkt\n");
+            return;
 
         // UDP要发送的数据
         const char *message = "Hello DPDK\n";
+        const uint32_t message_length = strlen(message);
+
+        struct rte_ipv4_hdr *ip_hdr = hdr_template.Apply(pkt, 0, message_length);
+        struct rte_udp_hdr *udp_hdr = (struct rte_udp_hdr *)(ip_hdr + 1);
+        rte_memcpy((void *)(udp_hdr + 1), message, message_length);
+        udp_hdr->dgram_cksum = rte_ipv4_phdr_cksum(ip_hdr, pkt->ol_flags);
+
+        send_ipv4(context, pkt, dst_ip);
+
+        printf("[UDP] Send UDP message from %s:%d to %s:%d\n",
+               format_ipv4(context->ip_addr).c_str(), src_port,
+               format_ipv4(dst_ip).c_str(), dst_port);
+    }
+};
+
+// DHCP续约的结果，所有lcore共享。续约请求只由主lcore发送，但是DHCP ACK会被RSS分到任意一个队列，
+// 由收到它的lcore写入这里，主lcore上的`DHCPLeaseTask`在定时器中读取。
+static struct
+{
+    std::atomic<uint32_t> xid;        // 当前续约请求的xid
+    std::atomic<uint32_t> nb_acks;    // 一共收到了多少个DHCP ACK
+    std::atomic<uint32_t> lease_time; // 最近一次DHCP ACK中的租约时间(秒)
+} dhcp_renewal;
+
+// DHCP租约续约(RFC 2131 4.4.5)：到T1(租约的1/2)时向DHCP服务器单播DHCPREQUEST，
+// 到T2(租约的7/8)还没有续约成功时广播DHCPREQUEST，租约到期时只输出警告。
+// 每个lcore都有一个，用于接收DHCP ACK；只有主lcore上的负责定时发送请求。
+class DHCPLeaseTask : public Task
+{
+    bool owner; // 是否负责发送续约请求
+
+    Timer timer;
+    uint64_t lease_start_tsc; // 当前租约开始的时间
+    uint32_t lease_time;      // 当前租约的时长(秒)
+    uint32_t acks_seen;       // 已经处理过的DHCP ACK数量
+    bool awaiting_ack;        // 刚刚发送了请求，等待回复
+
+public:
+    DHCPLeaseTask(const std::string &name, Context *context)
+        : Task(name, context), owner(context->queue_id == 0), timer(OnTimer, this), lease_start_tsc(0), lease_time(0), acks_seen(0), awaiting_ack(false)
+    {
+    }
+
+    virtual ~DHCPLeaseTask() override
+    {
+        context->timers->Cancel(&timer);
+    }
+
+    virtual void Setup() override final
+    {
+        context->dispatcher->BindListener(this, IPPROTO_UDP, rte_cpu_to_be_16(68));
+        if (owner)
+        {
+            acks_seen = dhcp_renewal.nb_acks.load(std::memory_order_acquire);
+            StartLease(context->dhcp_context.lease_time);
+        }
+    }
+
+    virtual ProcessResult TryProcess(struct rte_mbuf *pkt, const PacketInfo &info) override final
+    {
+        if (info.payload_length < sizeof(dhcp_t))
+            return ProcessResult::NOT_PROCESSED;
+        const dhcp_t *dhcp = (const dhcp_t *)info.payload;
+        if (dhcp->op != DHCP_OP_BOOTREPLY || dhcp->magic_cookie != DHCP_MAGIC_COOKIE_BE || dhcp->xid != dhcp_renewal.xid.load(std::memory_order_relaxed))
+            return ProcessResult::NOT_PROCESSED;
+
+        uint8_t message_type = 0;
+        uint32_t lease = 0;
+        const uint8_t *options = (const uint8_t *)(dhcp + 1);
+        const uint32_t options_length = info.payload_length - sizeof(dhcp_t);
+        for (uint32_t pos = 0; pos + 2 <= options_length;)
+        {
+            const dhcp_opt_t *option = reinterpret_cast<const dhcp_opt_t *>(options + pos);
+            if (option->code == DHCP_OPT_END_CODE || pos + 2 + option->len > options_length)
+                break;
+            pos += 2 + option->len;
+
+            if (option->code == DHCP_OPT_DHCP_MESSAGE_CODE && option->len == DHCP_OPT_DHCP_MESSAGE_LEN)
+                message_type = option->value[0];
+            if (option->code == DHCP_OPT_LEASE_TIME_CODE && option->len == DHCP_OPT_LEASE_TIME_LEN)
+                lease = rte_be_to_cpu_32(*reinterpret_cast<const rte_be32_t *>(option->value));
+        }
+
+        if (message_type == DHCP_OPT_DHCP_MESSAGE_VALUE_DHCPACK)
+        {
+            dhcp_renewal.lease_time.store(lease, std::memory_order_relaxed);
+            dhcp_renewal.nb_acks.fetch_add(1, std::memory_order_release);
+            printf("[DHCP] Lease of %s renewed for %u seconds\n", format_ipv4(context->ip_addr).c_str(), lease);
+        }
+        else if (message_type == DHCP_OPT_DHCP_MESSAGE_VALUE_DHCPNAK)
+        {
+            printf("[DHCP] Server refused to renew the lease of %s\n", format_ipv4(context->ip_addr).c_str());
+        }
+        return ProcessResult::PROCESSED;
+    }
+
+private:
+    void StartLease(uint32_t lease)
+    {
+        lease_start_tsc = rte_get_tsc_cycles();
+        lease_time = lease;
+        awaiting_ack = false;
+        if (lease == 0 || lease == DHCP_LEASE_TIME_INFINITE)
+            return; // 永久租约不需要续约
+        context->timers->Schedule(&timer, (uint64_t)(lease / 2) * US_PER_S);
+    }
+
+    static void OnTimer(Timer *timer, void *arg)
+    {
+        DHCPLeaseTask *self = static_cast<DHCPLeaseTask *>(arg);
+        Context *context = self->context;
+
+        const uint32_t nb_acks = dhcp_renewal.nb_acks.load(std::memory_order_acquire);
+        if (nb_acks != self->acks_seen)
+        {
+            self->acks_seen = nb_acks;
+            self->StartLease(dhcp_renewal.lease_time.load(std::memory_order_relaxed));
+            return;
+        }
+
+        const uint64_t elapsed = (rte_get_tsc_cycles() - self->lease_start_tsc) / rte_get_tsc_hz();
+        const uint64_t t2 = (uint64_t)self->lease_time * 7 / 8;
+        if (elapsed >= self->lease_time)
+        {
+            printf("[DHCP] Lease of %s expired\n", format_ipv4(context->ip_addr).c_str());
+            return;
+        }
+
+        if (self->awaiting_ack)
+        {
+            // 没有等到回复，在距离下一个阶段的一半时间之后重发，但不少于60秒(RFC 2131 4.4.5)
+            self->awaiting_ack = false;
+            const uint64_t deadline = elapsed < t2 ? t2 : self->lease_time;
+            const uint64_t wait = RTE_MIN(RTE_MAX((deadline - elapsed) / 2, (uint64_t)DHCP_RETRY_MIN_S), deadline - elapsed);
+            context->timers->Schedule(timer, RTE_MAX(wait, (uint64_t)1) * US_PER_S);
+            return;
+        }
+
+        self->SendRequest(elapsed >= t2);
+        self->awaiting_ack = true;
+        context->timers->Schedule(timer, DHCP_ACK_WAIT_US);
+    }
+
+    // 发送DHCPREQUEST，`rebinding`时广播，否则单播给DHCP服务器
+    void SendRequest(bool rebinding)
+    {
+        const rte_be32_t xid = rte_cpu_to_be_32(rand());
+        dhcp_renewal.xid.store(xid, std::memory_order_relaxed);
+
+        const uint32_t options_length = (2 + DHCP_OPT_DHCP_MESSAGE_LEN) + (2 + DHCP_OPT_CLIENT_ID_LEN) + 1;
+        const uint32_t dhcp_total_length = sizeof(dhcp_t) + options_length;
+
+        struct rte_mbuf *pkt = context->mbufs->Alloc(MbufPriority::CRITICAL);
+        if (!pkt)
+            return;
 
         struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
         rte_ether_addr_copy(&context->mac_addr, &eth_hdr->src_addr);
-        rte_ether_addr_copy(dst_mac_addr, &eth_hdr->dst_addr);
+        memset(&eth_hdr->dst_addr, 0xFF, sizeof(eth_hdr->dst_addr)); // 还没有DHCP服务器的MAC地址
         eth_hdr->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
 
         struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
         memset(ip_hdr, 0, sizeof(*ip_hdr));
         ip_hdr->version_ihl = IP_VHL_DEF;
-        ip_hdr->type_of_service = 0;
-        ip_hdr->fragment_offset = 0;
         ip_hdr->time_to_live = IP_DEFTTL;
-        ip_hdr->packet_id = 0;
         ip_hdr->src_addr = context->ip_addr;
-        ip_hdr->dst_addr = dst_ip;
+        ip_hdr->dst_addr = rebinding ? 0xFFFFFFFF : context->dhcp_context.server_addr;
         ip_hdr->next_proto_id = IPPROTO_UDP;
-        ip_hdr->total_length = rte_cpu_to_be_16(sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + strlen(message));
+        ip_hdr->total_length = rte_cpu_to_be_16(sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + dhcp_total_length);
 
         struct rte_udp_hdr *udp_hdr = (struct rte_udp_hdr *)(ip_hdr + 1);
-        udp_hdr->src_port = rte_cpu_to_be_16(src_port);
-        udp_hdr->dst_port = rte_cpu_to_be_16(dst_port);
-        udp_hdr->dgram_len = rte_cpu_to_be_16(sizeof(*udp_hdr) + strlen(message));
-        udp_hdr->dgram_cksum = 0; // IPv4中UDP的Checksum可以不计算
-
-        rte_memcpy((void *)(udp_hdr + 1), message, strlen(message));
+        udp_hdr->src_port = rte_cpu_to_be_16(68);
+        udp_hdr->dst_port = rte_cpu_to_be_16(67);
+        udp_hdr->dgram_cksum = 0;
+        udp_hdr->dgram_len = rte_cpu_to_be_16(sizeof(*udp_hdr) + dhcp_total_length);
+
+        // RENEWING/REBINDING状态下ciaddr是自己的IP，不带Requested IP和Server Identifier
+        dhcp_t *dhcp = (dhcp_t *)(udp_hdr + 1);
+        memset(dhcp, 0, sizeof(dhcp_t));
+        dhcp->op = DHCP_OP_BOOTREQUEST;
+        dhcp->htype = DHCP_HTYPE_ETHERNET;
+        dhcp->hlen = DHCP_HTYPE_ETHERNET_HLEN;
+        dhcp->xid = xid;
+        dhcp->ciaddr = context->ip_addr;
+        rte_ether_addr_copy(&context->mac_addr, &dhcp->chaddr);
+        dhcp->magic_cookie = DHCP_MAGIC_COOKIE_BE;
+
+        uint8_t *options = (uint8_t *)(dhcp + 1);
+        dhcp_opt_t *dhcp_message_type = reinterpret_cast<dhcp_opt_t *>(options);
+        dhcp_message_type->code = DHCP_OPT_DHCP_MESSAGE_CODE;
+        dhcp_message_type->len = DHCP_OPT_DHCP_MESSAGE_LEN;
+        dhcp_message_type->value[0] = DHCP_OPT_DHCP_MESSAGE_VALUE_DHCPREQUEST;
+        options += 2 + DHCP_OPT_DHCP_MESSAGE_LEN;
+
+        dhcp_opt_t *dhcp_client_id = reinterpret_cast<dhcp_opt_t *>(options);
+        dhcp_client_id->code = DHCP_OPT_CLIENT_ID_CODE;
+        dhcp_client_id->len = DHCP_OPT_CLIENT_ID_LEN;
+        dhcp_client_id->value[0] = DHCP_OPT_CLIENT_ID_ERHERNET_TYPE;
+        *reinterpret_cast<struct rte_ether_addr *>(&dhcp_client_id->value[1]) = context->mac_addr;
+        options += 2 + DHCP_OPT_CLIENT_ID_LEN;
+
+        options[0] = DHCP_OPT_END_CODE;
 
         // Fill other DPDK metadata
         pkt->packet_type = RTE_PTYPE_L2_ETHER | RTE_PTYPE_L3_IPV4 | RTE_PTYPE_L4_UDP;
-        const uint32_t PKT_LEN = sizeof(*eth_hdr) + sizeof(*ip_hdr) + sizeof(*udp_hdr) + strlen(message);
+        const uint32_t PKT_LEN = sizeof(*eth_hdr) + sizeof(*ip_hdr) + sizeof(*udp_hdr) + dhcp_total_length;
         pkt->pkt_len = PKT_LEN;
         pkt->data_len = pkt->pkt_len;
         pkt->l2_len = sizeof(struct rte_ether_hdr);
@@ -576,19 +1472,16 @@ public:
         pkt->l4_len = sizeof(struct rte_udp_hdr);
         pkt->ol_flags |= (RTE_MBUF_F_TX_IPV4 | RTE_MBUF_F_TX_IP_CKSUM);
 
-        const uint16_t nb_tx = rte_eth_tx_burst(PORT, 0, &pkt, 1);
-        assert(nb_tx == 1);
-
-        printf("[UDP] Send UDP message from %s:%d to %s:%d\n",
-               format_ipv4(context->ip_addr).c_str(), src_port,
-               format_ipv4(dst_ip).c_str(), dst_port);
+        context->tx->Send(pkt);
+        printf("[DHCP] Sent DHCPREQUEST to %s to %s the lease of %s\n",
+               rebinding ? "all servers" : format_ipv4(context->dhcp_context.server_addr).c_str(),
+               rebinding ? "rebind" : "renew", format_ipv4(context->ip_addr).c_str());
     }
 };
 
 // 表示一个TCP上下文，包含当前的状态/序列号等信息
 struct TCB
 {
-    struct rte_ether_addr remote_mac_addr;
     rte_be32_t remote_ip;
     rte_be16_t remote_port;
     rte_be16_t local_port;
@@ -609,440 +1502,1525 @@ struct TCB
     };
     Status status;
 
-    uint32_t seq;
-    uint32_t ack;
+    uint32_t iss;     // 自己的初始序列号
+    uint32_t snd_una; // 最早的没有被确认的序列号
+    uint32_t snd_nxt; // 下一个要发送的序列号
+    uint32_t snd_wnd; // 对方的接收窗口(字节，已经按照Window Scale放大)
+    uint32_t rcv_nxt; // 下一个期望收到的序列号
+
+    uint32_t rcv_wnd;      // 接收窗口(字节)
+    uint32_t rcv_buffered; // 已经交给应用、应用还没有处理完的字节数，从通告的接收窗口中扣除
+    uint8_t rcv_wscale; // 自己的Window Scale，发出去的窗口要右移这么多位
+    uint8_t snd_wscale; // 对方的Window Scale，收到的窗口要左移这么多位
+    uint16_t snd_mss;   // 对方的MSS
+    bool sack_ok;       // 双方都支持SACK
+    bool ts_ok;         // 双方都支持Timestamp
+    uint32_t ts_recent; // 最近收到的对方的TSval，需要在TSecr中回显
+    bool wscale_ok;     // 双方都支持Window Scale
+
+    TCPCongestionControlType cc_type; // 使用哪一种拥塞控制算法
+    bool delayed_ack;                 // 是否延迟ACK(RFC 1122)，由监听端口或者主动连接时指定
+
+    // 通告给对方的接收窗口
+    uint32_t RcvWindow() const { return rcv_wnd > rcv_buffered ? rcv_wnd - rcv_buffered : 0; }
+
+    // 根据对方SYN(或SYN,ACK)中的Option确定双方协商的结果
+    void Negotiate(const TCPOptions &opts)
+    {
+        snd_mss = opts.mss ? opts.mss : TCP_DEFAULT_MSS;
+        sack_ok = opts.sack_permitted;
+        ts_ok = opts.has_timestamp;
+        ts_recent = opts.ts_val;
+        wscale_ok = opts.has_wscale;
+        if (opts.has_wscale)
+        {
+            snd_wscale = opts.wscale;
+            rcv_wscale = TCP_WSCALE;
+            rcv_wnd = TCP_RCV_WND;
+        }
+        else
+        {
+            // 不支持Window Scale时窗口最大只有64KB
+            snd_wscale = 0;
+            rcv_wscale = 0;
+            rcv_wnd = RTE_MIN(TCP_RCV_WND, UINT16_MAX);
+        }
+    }
+};
+
+// 一个监听端口的统计信息，连接处于SYN_RECEIVED状态时也会更新它
+struct TCPListenerStats
+{
+    uint32_t half_open;          // 当前处于SYN_RECEIVED状态的连接数
+    uint64_t syns_received;
+    uint64_t syns_dropped;       // backlog满且没有开启SYN cookie，或者连接池满时丢弃的SYN
+    uint64_t half_open_timeouts; // SYN,ACK重传多次之后仍然没有收到ACK而被释放的半连接
+    uint64_t half_open_resets;   // 收到RST而被释放的半连接
+    uint64_t accepted;           // 完成三次握手的连接(包括SYN cookie)
+    uint64_t cookies_sent;
+    uint64_t cookies_validated;
+    uint64_t cookies_failed;     // 不属于任何连接、cookie也校验失败的ACK
+};
+
+// 一个TCP连接的统计信息
+struct TCPConnectionStats
+{
+    uint64_t bytes_sent;         // 第一次发送的数据字节数
+    uint64_t bytes_retransmitted;
+    uint64_t bytes_received;     // 按序交给上层的字节数
+    uint64_t ooo_segments;       // 乱序到达、放入乱序队列的报文段
+    uint64_t segs_sent;
+    uint64_t tso_sends;          // 合成一个TSO报文段发送的次数
+    uint64_t segs_retransmitted;
+    uint64_t fast_retransmits;
+    uint64_t timeouts;
+    uint64_t acks_sent;          // 单独发送的ACK(没有顺便带在数据段上)
+    uint64_t acks_delayed;       // 延迟发送的ACK
+
+    // 拥塞控制的当前状态
+    const char *cc_name;
+    TCPCongestionState cc_state;
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t srtt; // 微秒
+    uint32_t rto;  // 微秒
+};
+
+// 一个lcore上已经释放的TCP连接的统计信息之和，连接释放时累加，不在每个连接关闭时输出
+struct TCPQueueStats
+{
+    uint64_t connections;
+    uint64_t bytes_sent;
+    uint64_t bytes_retransmitted;
+    uint64_t bytes_received;
+    uint64_t ooo_segments;
+    uint64_t segs_sent;
+    uint64_t tso_sends;
+    uint64_t segs_retransmitted;
+    uint64_t fast_retransmits;
+    uint64_t timeouts;
+    uint64_t acks_sent;
+    uint64_t acks_delayed;
+
+    void Add(const TCPConnectionStats &s)
+    {
+        connections++;
+        bytes_sent += s.bytes_sent;
+        bytes_retransmitted += s.bytes_retransmitted;
+        bytes_received += s.bytes_received;
+        ooo_segments += s.ooo_segments;
+        segs_sent += s.segs_sent;
+        tso_sends += s.tso_sends;
+        segs_retransmitted += s.segs_retransmitted;
+        fast_retransmits += s.fast_retransmits;
+        timeouts += s.timeouts;
+        acks_sent += s.acks_sent;
+        acks_delayed += s.acks_delayed;
+    }
+};
+
+class TCPConnectionTask;
+
+// 应用程序接口：应用实现这些回调，协议栈在对应的事件发生时调用。所有回调都在连接所在的lcore上执行，不需要加锁。
+// 每个连接可以用`SetUserData`保存应用自己的状态
+class TCPApplication
+{
+public:
+    virtual ~TCPApplication() {}
+
+    // 被动连接建立(三次握手完成)，返回false时拒绝这个连接(发送RST)
+    virtual bool OnAccept(TCPConnectionTask *conn) { return true; }
+
+    // 主动连接建立
+    virtual void OnConnected(TCPConnectionTask *conn) {}
+
+    // 收到按序到达的数据，`data`是去掉包头之后的收包mbuf链，没有复制。
+    // `data`交给应用，处理完之后调用`conn->Release(data)`(或者转交给`conn->Send`之后调用`conn->Consume`)，
+    // 在此之前这部分数据占用接收窗口
+    virtual void OnData(TCPConnectionTask *conn, struct rte_mbuf *data) = 0;
+
+    // 之前`Send`因为发送队列满而没有全部放入，现在发送队列有空间了
+    virtual void OnSendable(TCPConnectionTask *conn) {}
+
+    // 对方关闭了连接(收到FIN)，之后不会再有`OnData`，默认也关闭自己这一端
+    virtual void OnPeerClosed(TCPConnectionTask *conn);
+
+    // 连接已经结束(正常关闭、超时或者被重置)，返回之后`conn`不能再使用
+    virtual void OnClosed(TCPConnectionTask *conn) {}
 };
 
-// 一个TCP连接，包含建立连接/接收消息和定时发送消息/断开连接3个阶段
-// 不会主动断开连接，对方断开连接时Task结束
+// 一个TCP连接，包含建立连接/收发数据/断开连接3个阶段
+// 收到的数据、连接的建立和断开通过`TCPApplication`通知应用，应用通过`Send`/`Close`等函数操作连接。
+// 从`context->tcp_connections`中分配，不放在`running_tasks`中，结束时由`SetClosed`交还给对象池
 class TCPConnectionTask : public Task
 {
     TCB tcb;
-
-    bool period_send_message;
-    uint64_t tsc_hz;
-    uint64_t last_sent_at_tsc;
+    PacketTemplate hdr_template; // 这个连接的包头模板，所有报文段都从它复制包头
+    TCPReassemblyQueue ooo;  // 乱序到达的数据
+    TCPSendQueue snd_queue;  // 已经交给TCP、还没有被确认的数据
+    TCPRtoEstimator rto;
+    Timer rto_timer;         // 重传定时器，有数据没有被确认时一直在运行
+    uint32_t dupacks;        // 连续收到的重复ACK数量
+    uint32_t nb_retries;     // 连续超时的次数
+    bool fin_pending;        // 发送队列中的数据发完之后发送FIN
+    uint32_t snd_max;        // 发送过的最大序列号，重传超时时`snd_nxt`回退到`snd_una`，之前发出去的数据的ACK仍然有效
+    bool bound;              // 是否已经在`Dispatcher`中注册
+    TCPListenerStats *listener; // 被动连接时所属的监听端口的统计信息，主动连接时为nullptr
+    TCPCongestionControl *cc; // 知道对方的MSS之后才创建，创建在`cc_storage`中
+    TCPCongestionControlStorage cc_storage;
+    TCPConnectionStats stats;
+
+    Timer keepalive_timer;      // 连接空闲一段时间之后发送keepalive探测
+    uint32_t keepalive_probes;  // 已经发送了多少个没有回复的探测
+
+    Timer close_timer; // FIN_WAIT_2和TIME_WAIT的超时
+
+    Timer delack_timer;         // 延迟ACK的超时
+    uint32_t ack_pending_bytes; // 收到之后还没有确认的字节数，任何带ACK的报文段发出之后清零
+    bool ack_now;               // 乱序/重复的数据、FIN等需要立即确认
+    uint32_t quickack;          // 还有多少个数据段立即确认(quick-ACK模式)
+    uint64_t last_rcv_tsc;      // 最近一次收到数据的时间，空闲超过RTO之后重新进入quick-ACK模式
+    uint32_t rcv_adv;           // 通告过的接收窗口的右边界
+
+    TCPApplication *app;
+    void *user_data;  // 应用自己的状态
+    bool snd_blocked; // `Send`因为发送队列满而没有全部放入，发送队列有空间时通知应用
 
 public:
     TCPConnectionTask(const std::string &name,
                       Context *context,
-                      struct rte_ether_addr remote_mac_addr,
+                      TCPApplication *app,
                       rte_be32_t remote_ip,
                       rte_be16_t remote_port,
-                      rte_be16_t local_port) : Task(name, context)
+                      rte_be16_t local_port,
+                      TCPCongestionControlType cc_type = TCPCongestionControlType::CUBIC,
+                      bool delayed_ack = true)
+        : Task(name, context), rto_timer(OnRTOTimer, this), keepalive_timer(OnKeepaliveTimer, this), close_timer(OnCloseTimer, this),
+          delack_timer(OnDelackTimer, this)
     {
         memset(&tcb, 0, sizeof(tcb));
-        tcb.remote_mac_addr = remote_mac_addr;
         tcb.remote_ip = remote_ip;
         tcb.remote_port = remote_port;
         tcb.local_port = local_port;
         tcb.status = TCB::Status::LISTEN;
-        tcb.seq = rand();
-
-        this->period_send_message = true;
-        this->tsc_hz = rte_get_tsc_hz();
-        this->last_sent_at_tsc = rte_get_tsc_cycles();
+        tcb.iss = tcp_new_isn(context->ip_addr, remote_ip, local_port, remote_port);
+        tcb.snd_una = tcb.snd_nxt = tcb.iss;
+        tcb.rcv_wscale = TCP_WSCALE;
+        tcb.rcv_wnd = TCP_RCV_WND;
+        tcb.cc_type = cc_type;
+        tcb.delayed_ack = delayed_ack;
+        dupacks = nb_retries = 0;
+        fin_pending = false;
+        snd_max = tcb.snd_nxt;
+        bound = false;
+        listener = nullptr;
+        cc = nullptr;
+        memset(&stats, 0, sizeof(stats));
+        keepalive_probes = 0;
+        this->app = app;
+        user_data = nullptr;
+        snd_blocked = false;
+        ack_pending_bytes = 0;
+        ack_now = false;
+        quickack = TCP_QUICKACK_SEGMENTS;
+        last_rcv_tsc = 0;
+        rcv_adv = this->tcb.rcv_nxt;
+        InitTemplate(context, this->tcb, &hdr_template);
     }
 
-    // 直接从TCB创建，一般表示一个已经建立的TCP连接
-    TCPConnectionTask(const std::string &name, Context *context, const TCB &tcb) : Task(name, context)
+    // 直接从TCB创建，一般是`TCPServerTask`收到SYN之后创建的，状态为SYN_RECEIVED；
+    // 通过SYN cookie建立的连接没有经过SYN_RECEIVED，状态直接是ESTABLISHED
+    TCPConnectionTask(const std::string &name, Context *context, const TCB &tcb, TCPApplication *app, TCPListenerStats *listener = nullptr)
+        : Task(name, context), rto_timer(OnRTOTimer, this), keepalive_timer(OnKeepaliveTimer, this), close_timer(OnCloseTimer, this),
+          delack_timer(OnDelackTimer, this)
     {
         this->tcb = tcb;
-        this->period_send_message = false;
+        dupacks = nb_retries = 0;
+        fin_pending = false;
+        snd_max = tcb.snd_nxt;
+        bound = false;
+        this->listener = listener;
+        if (listener && tcb.status == TCB::Status::SYN_RECEIVED)
+            listener->half_open++;
+        cc = nullptr;
+        memset(&stats, 0, sizeof(stats));
+        ResetCongestionControl();
+        keepalive_probes = 0;
+        this->app = app;
+        user_data = nullptr;
+        snd_blocked = false;
+        ack_pending_bytes = 0;
+        ack_now = false;
+        quickack = TCP_QUICKACK_SEGMENTS;
+        last_rcv_tsc = 0;
+        rcv_adv = this->tcb.rcv_nxt;
+        InitTemplate(context, this->tcb, &hdr_template);
+    }
+
+    virtual ~TCPConnectionTask() override
+    {
+        context->timers->Cancel(&rto_timer);
+        context->timers->Cancel(&keepalive_timer);
+        context->timers->Cancel(&close_timer);
+        context->timers->Cancel(&delack_timer);
+        if (bound)
+            context->dispatcher->UnbindFlow(IPPROTO_TCP, tcb.local_port, tcb.remote_ip, tcb.remote_port);
+        if (cc)
+        {
+            context->tcp_stats->Add(stats);
+            cc->~TCPCongestionControl();
+        }
     }
 
-    virtual void Tick() override final
+    virtual void Setup() override final
     {
+        bound = context->dispatcher->BindFlow(this, IPPROTO_TCP, tcb.local_port, tcb.remote_ip, tcb.remote_port);
+        if (!bound)
+        {
+            printf("[TCP] Failed to register connection, flow table is full\n");
+            SetClosed();
+            return;
+        }
+
         switch (tcb.status)
         {
         case TCB::Status::LISTEN:
+            // 主动连接
+            SendSYN();
+            tcb.snd_nxt = tcb.iss + 1;
+            tcb.status = TCB::Status::SYN_SENT;
+            ArmRTO();
+            break;
+        case TCB::Status::SYN_RECEIVED:
+            // 被动连接，回复SYN,ACK，等待对方的ACK
+            SendSYN();
+            tcb.snd_nxt = tcb.iss + 1;
+            ArmRTO();
+            break;
+        case TCB::Status::ESTABLISHED:
+            // SYN cookie校验通过，三次握手已经完成
+            snd_queue.Init(tcb.snd_nxt);
+            OnEstablished();
+            break;
+        default:
+            break;
+        }
+    }
+
+    virtual ProcessResult TryProcess(struct rte_mbuf *pkt, const PacketInfo &info) override final
+    {
+        struct rte_tcp_hdr *tcp_hdr = (struct rte_tcp_hdr *)info.l4_hdr;
+        if (keepalive_timer.Pending())
         {
-            auto _ = CreatePKT(4 + 2 + 10 + 1 + 3, 0);
-            struct rte_mbuf *pkt = std::get<0>(_);
-            struct rte_tcp_hdr *tcp_hdr = std::get<2>(_);
-            tcp_hdr->tcp_flags |= RTE_TCP_SYN_FLAG;
-
-            uint8_t *options = (uint8_t *)(tcp_hdr + 1);
-            { // MSS Option
-                options[0] = 2;
-                options[1] = 4;
-                *(rte_be16_t *)(options + 2) = rte_cpu_to_be_16(1460);
-                options += 4;
+            // 收到任何数据包都说明连接还活着
+            context->timers->Schedule(&keepalive_timer, TCP_KEEPALIVE_IDLE_US);
+            keepalive_probes = 0;
+        }
+        switch (tcb.status)
+        {
+        case TCB::Status::SYN_SENT:
+        {
+            if ((tcp_hdr->tcp_flags & RTE_TCP_SYN_FLAG) && (tcp_hdr->tcp_flags & RTE_TCP_ACK_FLAG) && (rte_be_to_cpu_32(tcp_hdr->recv_ack) == tcb.iss + 1))
+            {
+                printf("[TCP] SYN,ACK Received\n");
+
+                TCPOptions opts;
+                ParseTCPOptions(tcp_hdr, &opts);
+                tcb.Negotiate(opts);
+
+                tcb.snd_una = tcb.snd_nxt = tcb.iss + 1;
+                tcb.snd_wnd = rte_be_to_cpu_16(tcp_hdr->rx_win); // SYN,ACK中的窗口不缩放
+                tcb.rcv_nxt = rte_be_to_cpu_32(tcp_hdr->sent_seq) + 1;
+                snd_queue.Init(tcb.snd_nxt);
+                ResetCongestionControl();
+                context->timers->Cancel(&rto_timer);
+                nb_retries = 0;
+
+                SendACK();
+                printf("[TCP] Sent ACK\n");
+                tcb.status = TCB::Status::ESTABLISHED;
+                OnEstablished();
+
+                return ProcessResult::PROCESSED;
             }
-            { // SACK permitted
-                options[0] = 4;
-                options[1] = 2;
-                options += 2;
+        }
+        break;
+        case TCB::Status::SYN_RECEIVED:
+        {
+            if (tcp_hdr->tcp_flags & RTE_TCP_RST_FLAG)
+            {
+                // 先检查RST(RFC 793 3.9)：序列号在接收窗口内时释放半连接，RST|ACK也不能当作完成握手的ACK
+                const uint32_t seg_seq = rte_be_to_cpu_32(tcp_hdr->sent_seq);
+                if (tcp_seq_geq(seg_seq, tcb.rcv_nxt) && tcp_seq_lt(seg_seq, tcb.rcv_nxt + RTE_MAX(tcb.RcvWindow(), 1U)))
+                {
+                    if (listener)
+                        listener->half_open_resets++;
+                    SetClosed();
+                }
+                return ProcessResult::PROCESSED;
             }
-            { // Timestamp Option
-                options[0] = 8;
-                options[1] = 10;
-                *(rte_be32_t *)(options + 2) = rte_cpu_to_be_32(clock());
-                options += 10;
+            if (tcp_hdr->tcp_flags & RTE_TCP_SYN_FLAG)
+            {
+                // 对方重传了SYN，说明SYN,ACK丢了
+                SendSYN();
+                return ProcessResult::PROCESSED;
             }
-            { // No OP
-                options[0] = 1;
-                options += 1;
+            if (!(tcp_hdr->tcp_flags & RTE_TCP_ACK_FLAG) || rte_be_to_cpu_32(tcp_hdr->recv_ack) != tcb.iss + 1)
+                return ProcessResult::PROCESSED;
+
+            tcb.snd_una = tcb.snd_nxt = tcb.iss + 1;
+            tcb.snd_wnd = (uint32_t)rte_be_to_cpu_16(tcp_hdr->rx_win) << tcb.snd_wscale;
+            snd_queue.Init(tcb.snd_nxt);
+            context->timers->Cancel(&rto_timer);
+            nb_retries = 0;
+            if (listener)
+            {
+                listener->half_open--;
+                listener->accepted++;
             }
-            { // Window scale
-                options[0] = 3;
-                options[1] = 3;
-                options[2] = 7;
-                options += 3;
+            tcb.status = TCB::Status::ESTABLISHED;
+            OnEstablished();
+
+            // 应用拒绝了这个连接
+            if (tcb.status == TCB::Status::CLOSED)
+                return ProcessResult::PROCESSED;
+        }
+            // ACK中可能已经带了数据，继续按照ESTABLISHED处理
+            [[fallthrough]];
+        case TCB::Status::ESTABLISHED:
+        case TCB::Status::CLOSE_WAIT:
+        case TCB::Status::FIN_WAIT_1:
+        case TCB::Status::FIN_WAIT_2:
+        case TCB::Status::CLOSING:
+        case TCB::Status::LAST_ACK:
+        case TCB::Status::TIME_WAIT:
+            return ProcessSegment(pkt, info, tcp_hdr);
+        default:
+            // nothing
+            break;
+        };
+
+        return ProcessResult::NOT_PROCESSED;
+    }
+
+    virtual bool IsAlive() override final { return tcb.status != TCB::Status::CLOSED; }
+
+    const TCPConnectionStats &GetStats()
+    {
+        stats.cc_name = cc ? cc->Name() : "none";
+        stats.cc_state = cc ? cc->State() : TCPCongestionState::SLOW_START;
+        stats.cwnd = cc ? cc->Cwnd() : 0;
+        stats.ssthresh = cc ? cc->Ssthresh() : 0;
+        stats.srtt = rto.srtt;
+        stats.rto = rto.rto;
+        return stats;
+    }
+
+    // 主动连接`remote_ip:remote_port`，连接建立后调用`app->OnConnected`，失败时调用`app->OnClosed`。
+    // 连接池或者连接表满时返回nullptr
+    static TCPConnectionTask *Connect(Context *context, TCPApplication *app,
+                                      rte_be32_t remote_ip, rte_be16_t remote_port, rte_be16_t local_port,
+                                      TCPCongestionControlType cc_type = TCPCongestionControlType::CUBIC,
+                                      bool delayed_ack = true)
+    {
+        TCPConnectionTask *conn = context->tcp_connections->Alloc("TCPConnection", context, app,
+                                                                  remote_ip, remote_port, local_port, cc_type, delayed_ack);
+        if (!conn)
+            return nullptr;
+        conn->Setup();
+        return conn->IsAlive() ? conn : nullptr;
+    }
+
+    rte_be32_t RemoteIP() const { return tcb.remote_ip; }
+    rte_be16_t RemotePort() const { return tcb.remote_port; }
+    rte_be16_t LocalPort() const { return tcb.local_port; }
+    void *GetUserData() const { return user_data; }
+    void SetUserData(void *data) { user_data = data; }
+
+    // 发送队列还能放多少字节，mbuf池快用完时为0
+    uint32_t SendSpace() const { return CanSend() && !Throttled() ? TCP_SND_BUF - snd_queue.Bytes() : 0; }
+
+    // 把数据复制到发送队列并尽量发送出去，返回放入发送队列的字节数，发送队列满时可能小于`length`
+    uint32_t Send(const uint8_t *data, uint32_t length)
+    {
+        if (!CanSend())
+            return 0;
+        if (Throttled())
+        {
+            snd_blocked = true;
+            return 0;
+        }
+        const uint32_t queued = snd_queue.Append(data, length, SendMSS(), context->mbufs);
+        if (queued < length)
+            snd_blocked = true;
+        TrySend();
+        return queued;
+    }
+
+    // 同上，依次发送`iov`中的数据，遇到发送队列满时停止
+    uint32_t Send(const struct iovec *iov, int iovcnt)
+    {
+        if (!CanSend())
+            return 0;
+        if (Throttled())
+        {
+            snd_blocked = true;
+            return 0;
+        }
+        uint32_t queued = 0;
+        for (int i = 0; i < iovcnt; i++)
+        {
+            const uint32_t n = snd_queue.Append((const uint8_t *)iov[i].iov_base, iov[i].iov_len, SendMSS(), context->mbufs);
+            queued += n;
+            if (n < iov[i].iov_len)
+            {
+                snd_blocked = true;
+                break;
             }
+        }
+        TrySend();
+        return queued;
+    }
+
+    // 零拷贝发送mbuf链`data`(只包含payload，可以是`OnData`收到的数据)。
+    // 成功时接管`data`；发送队列放不下时返回false，`data`仍然属于调用者，发送队列有空间时调用`OnSendable`
+    bool Send(struct rte_mbuf *data)
+    {
+        if (!CanSend())
+            return false;
+        if (Throttled() || !snd_queue.Append(data, SendMSS(), context->mbufs))
+        {
+            snd_blocked = true;
+            return false;
+        }
+        TrySend();
+        return true;
+    }
+
+    // 应用处理完了`length`字节收到的数据，重新打开接收窗口
+    void Consume(uint32_t length)
+    {
+        const uint32_t old_wnd = tcb.RcvWindow();
+        tcb.rcv_buffered -= RTE_MIN(length, tcb.rcv_buffered);
+        // 窗口从不到一半恢复到一半以上时主动通知对方，否则对方只能等到窗口探测
+        if (old_wnd < tcb.rcv_wnd / 2 && tcb.RcvWindow() >= tcb.rcv_wnd / 2 && CanReceive())
+            SendACK();
+    }
 
-            const uint16_t nb_tx = rte_eth_tx_burst(PORT, 0, &pkt, 1);
-            assert(nb_tx == 1);
+    // 释放`OnData`交给应用的数据
+    void Release(struct rte_mbuf *data)
+    {
+        Consume(data->pkt_len);
+        rte_pktmbuf_free(data);
+    }
+
+    // 关闭自己这一端：发送队列中的数据发完之后发送FIN，对方关闭之前还会继续收到数据。
+    // 连接建立之前调用时直接放弃连接
+    void Close()
+    {
+        switch (tcb.status)
+        {
+        case TCB::Status::LISTEN:
+        case TCB::Status::SYN_SENT:
+        case TCB::Status::SYN_RECEIVED:
+            Abort();
+            break;
+        case TCB::Status::ESTABLISHED:
+        case TCB::Status::CLOSE_WAIT:
+            if (!fin_pending)
+            {
+                fin_pending = true;
+                TrySend();
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    // 立即断开连接，丢弃发送队列中的数据，发送RST
+    void Abort()
+    {
+        if (tcb.status == TCB::Status::CLOSED)
+            return;
+        if (tcb.status != TCB::Status::LISTEN && tcb.status != TCB::Status::SYN_SENT)
+            Output(tcb.snd_nxt, RTE_TCP_RST_FLAG | RTE_TCP_ACK_FLAG, nullptr);
+        SetClosed();
+    }
+
+private:
+    bool CanSend() const
+    {
+        return (tcb.status == TCB::Status::ESTABLISHED || tcb.status == TCB::Status::CLOSE_WAIT) && !fin_pending;
+    }
+
+    // 对方还没有发送FIN，还能收到数据
+    bool CanReceive() const
+    {
+        return tcb.status == TCB::Status::ESTABLISHED || tcb.status == TCB::Status::FIN_WAIT_1 || tcb.status == TCB::Status::FIN_WAIT_2;
+    }
+
+    // 自己的FIN已经发送出去了
+    bool FinSent() const
+    {
+        return tcb.status == TCB::Status::FIN_WAIT_1 || tcb.status == TCB::Status::CLOSING || tcb.status == TCB::Status::LAST_ACK;
+    }
+
+    // 处理同步状态(ESTABLISHED及之后)下收到的报文段：ACK、数据、FIN和RST
+    ProcessResult ProcessSegment(struct rte_mbuf *pkt, const PacketInfo &info, struct rte_tcp_hdr *tcp_hdr)
+    {
+        const uint32_t seg_seq = rte_be_to_cpu_32(tcp_hdr->sent_seq);
+        const uint32_t seg_len = info.payload_length;
+
+        if (tcp_hdr->tcp_flags & RTE_TCP_RST_FLAG)
+        {
+            // 只接受序列号在接收窗口内的RST，避免被伪造的RST断开
+            if (tcp_seq_geq(seg_seq, tcb.rcv_nxt) && tcp_seq_lt(seg_seq, tcb.rcv_nxt + RTE_MAX(tcb.RcvWindow(), 1U)))
+            {
+                printf("[TCP] Connection reset by peer\n");
+                SetClosed();
+            }
+            return ProcessResult::PROCESSED;
+        }
+
+        if (tcb.status == TCB::Status::TIME_WAIT)
+        {
+            // 对方重传了FIN，说明最后的ACK丢了，重新回复并重新计时
+            if (tcp_hdr->tcp_flags & RTE_TCP_FIN_FLAG)
+            {
+                SendACK();
+                context->timers->Schedule(&close_timer, TCP_TIME_WAIT_US);
+            }
+            return ProcessResult::PROCESSED;
+        }
+
+        TCPOptions opts;
+        ParseTCPOptions(tcp_hdr, &opts);
+        if (tcb.ts_ok && opts.has_timestamp)
+            tcb.ts_recent = opts.ts_val;
+
+        if (tcp_hdr->tcp_flags & RTE_TCP_ACK_FLAG)
+        {
+            ProcessACK(tcp_hdr, opts, seg_len);
+            if (FinSent() && tcb.snd_una == tcb.snd_nxt)
+                OnFinAcked();
+            if (tcb.status == TCB::Status::CLOSED)
+                return ProcessResult::PROCESSED;
+            if (snd_blocked && snd_queue.Bytes() < TCP_SND_BUF)
+            {
+                snd_blocked = false;
+                if (app)
+                    app->OnSendable(this);
+            }
+        }
+
+        ProcessResult result = ProcessResult::PROCESSED;
+        if (seg_len > 0)
+            OnDataReceived(seg_len);
+        if (seg_len > 0 && CanReceive())
+        {
+            if (tcp_seq_leq(seg_seq + seg_len, tcb.rcv_nxt))
+            {
+                // 重复的数据，对方可能没有收到ACK，立即重新回复一个
+                ack_now = true;
+            }
+            else if (tcp_seq_leq(seg_seq, tcb.rcv_nxt))
+            {
+                // 按序到达(开头可能和已经收到的数据重叠)，去掉包头和重叠的部分之后直接把收包mbuf交给应用，
+                // 再把乱序队列中接上的数据一起交上去
+                rte_pktmbuf_adj(pkt, info.payload - rte_pktmbuf_mtod(pkt, uint8_t *));
+                mbuf_trim_tail(pkt, seg_len);
+                struct rte_mbuf *data = mbuf_trim_head(pkt, tcb.rcv_nxt - seg_seq);
+                result = ProcessResult::TAKEN;
+                tcb.rcv_nxt = seg_seq + seg_len;
+                Deliver(data);
+                while (tcb.status != TCB::Status::CLOSED)
+                {
+                    struct rte_mbuf *next = ooo.PopContiguous(&tcb.rcv_nxt);
+                    if (!next)
+                        break;
+                    // 填上了乱序队列前面的空洞，立即确认让对方尽快退出快速恢复
+                    ack_now = true;
+                    Deliver(next);
+                }
+                if (tcb.status == TCB::Status::CLOSED)
+                    return result;
+            }
+            else if (tcp_seq_lt(seg_seq, tcb.rcv_nxt + tcb.RcvWindow()))
+            {
+                // 乱序到达，只保留payload放入乱序队列，超出接收窗口的部分丢弃
+                rte_pktmbuf_adj(pkt, info.payload - rte_pktmbuf_mtod(pkt, uint8_t *));
+                mbuf_trim_tail(pkt, RTE_MIN(seg_len, tcb.rcv_nxt + tcb.RcvWindow() - seg_seq));
+                if (ooo.Insert(seg_seq, pkt))
+                    result = ProcessResult::TAKEN;
+                // 乱序时立即回复带SACK的duplicate ACK，之后一段时间也立即确认
+                ack_now = true;
+                quickack = TCP_QUICKACK_SEGMENTS;
+                stats.ooo_segments++;
+            }
+        }
+
+        if (seg_len > 0 && !CanReceive())
+            ack_now = true;
+        if ((tcp_hdr->tcp_flags & RTE_TCP_FIN_FLAG) && CanReceive() && seg_seq + seg_len == tcb.rcv_nxt)
+        {
+            // FIN按序到达时才能关闭，FIN本身占用一个序列号，立即确认
+            tcb.rcv_nxt++;
+            ooo.Clear();
+            ack_now = true;
+            switch (tcb.status)
+            {
+            case TCB::Status::ESTABLISHED:
+                tcb.status = TCB::Status::CLOSE_WAIT;
+                break;
+            case TCB::Status::FIN_WAIT_1:
+                // 双方同时关闭，自己的FIN还没有被确认
+                tcb.status = TCB::Status::CLOSING;
+                break;
+            default:
+                EnterTimeWait();
+                break;
+            }
+            if (tcb.status == TCB::Status::CLOSE_WAIT)
+            {
+                if (app)
+                    app->OnPeerClosed(this);
+                else
+                    Close();
+            }
+        }
+
+        // 对方的ACK可能打开了窗口，应用也可能在回调中发送了数据，数据段会顺便带上ACK
+        TrySend();
+        FlushACK();
+        return result;
+    }
+
+    // 收到`seg_len`字节的数据，需要确认。连接刚建立或者空闲超过RTO之后对方处于慢启动，立即确认让它的拥塞窗口尽快增长
+    void OnDataReceived(uint32_t seg_len)
+    {
+        const uint64_t now_tsc = rte_get_tsc_cycles();
+        if (last_rcv_tsc != 0 && (now_tsc - last_rcv_tsc) * US_PER_S / rte_get_tsc_hz() > rto.rto)
+            quickack = TCP_QUICKACK_SEGMENTS;
+        last_rcv_tsc = now_tsc;
+        ack_pending_bytes += seg_len;
+        if (quickack > 0)
+        {
+            quickack--;
+            ack_now = true;
+        }
+    }
+
+    // 处理完一个数据包之后确认收到的数据(RFC 1122 4.2.3.2)：这期间发出的数据段已经带上了ACK时什么都不做；
+    // 需要立即确认、不延迟ACK或者累计了`TCP_DELACK_SEGMENTS`个满MSS的数据时马上发送，否则最多延迟`TCP_DELACK_US`
+    void FlushACK()
+    {
+        if (!ack_now && ack_pending_bytes == 0)
+            return;
+        if (ack_now || !tcb.delayed_ack || ack_pending_bytes >= TCP_DELACK_SEGMENTS * RcvMSS())
+        {
+            SendACK();
+            return;
+        }
+        if (!delack_timer.Pending())
+        {
+            stats.acks_delayed++;
+            context->timers->Schedule(&delack_timer, TCP_DELACK_US);
+        }
+    }
+
+    static void OnDelackTimer(Timer *timer, void *arg)
+    {
+        TCPConnectionTask *self = static_cast<TCPConnectionTask *>(arg);
+        if (self->tcb.status != TCB::Status::CLOSED && self->ack_pending_bytes > 0)
+            self->SendACK();
+    }
+
+    // 对方发来的满MSS数据段有多少字节的数据
+    uint32_t RcvMSS() const { return TCP_MSS - (tcb.ts_ok ? TCP_OPT_TIMESTAMP_ALIGNED_LEN : 0); }
+
+    // 把按序到达的数据交给应用
+    void Deliver(struct rte_mbuf *data)
+    {
+        stats.bytes_received += data->pkt_len;
+        tcb.rcv_buffered += data->pkt_len;
+        if (app)
+            app->OnData(this, data);
+        else
+            Release(data);
+    }
+
+    // 自己的FIN被确认了
+    void OnFinAcked()
+    {
+        switch (tcb.status)
+        {
+        case TCB::Status::FIN_WAIT_1:
+            // 等待对方关闭，对方一直不关闭时超时释放
+            tcb.status = TCB::Status::FIN_WAIT_2;
+            context->timers->Schedule(&close_timer, TCP_FIN_WAIT_2_US);
+            break;
+        case TCB::Status::CLOSING:
+            EnterTimeWait();
+            break;
+        case TCB::Status::LAST_ACK:
+            printf("[TCP] Closed\n");
+            SetClosed();
+            break;
+        default:
+            break;
+        }
+    }
+
+    // 等待2MSL，保证对方收到了最后的ACK，并且网络中这个连接的旧报文段都已经消失
+    void EnterTimeWait()
+    {
+        tcb.status = TCB::Status::TIME_WAIT;
+        context->timers->Cancel(&rto_timer);
+        context->timers->Cancel(&keepalive_timer);
+        context->timers->Schedule(&close_timer, TCP_TIME_WAIT_US);
+    }
+
+    static void OnCloseTimer(Timer *timer, void *arg)
+    {
+        TCPConnectionTask *self = static_cast<TCPConnectionTask *>(arg);
+        if (self->tcb.status == TCB::Status::FIN_WAIT_2)
+            printf("[TCP] FIN_WAIT_2 timeout\n");
+        else
+            printf("[TCP] Closed\n");
+        self->SetClosed();
+    }
+
+    // mbuf池快用完时暂停接收应用的数据。发送队列为空时不暂停，否则没有ACK来触发`OnSendable`
+    bool Throttled() const { return context->mbufs->UnderPressure() && snd_queue.Bytes() > 0; }
+
+    // 通告给对方的接收窗口。mbuf池快用完时不再向右移动已经通告过的右边界，窗口随着收到的数据逐渐关闭，对方因此减速；
+    // 已经通告的窗口不收回(RFC 9293 3.8.6)
+    uint32_t AdvertiseWindow()
+    {
+        uint32_t wnd = tcb.RcvWindow();
+        if (context->mbufs->UnderPressure())
+            wnd = RTE_MIN(wnd, tcp_seq_gt(rcv_adv, tcb.rcv_nxt) ? rcv_adv - tcb.rcv_nxt : 0);
+        const uint32_t edge = tcb.rcv_nxt + ((wnd >> tcb.rcv_wscale) << tcb.rcv_wscale);
+        if (tcp_seq_gt(edge, rcv_adv))
+            rcv_adv = edge;
+        return wnd;
+    }
+
+    // 每个数据段最多能放多少字节的数据，Timestamp Option也要占用MSS
+    uint32_t SendMSS() const
+    {
+        return RTE_MIN(tcb.snd_mss, (uint16_t)TCP_MSS) - (tcb.ts_ok ? TCP_OPT_TIMESTAMP_ALIGNED_LEN : 0);
+    }
+
+    // 处理对方的ACK：释放被确认的数据、更新RTT和发送窗口、检测重复ACK
+    void ProcessACK(const struct rte_tcp_hdr *tcp_hdr, const TCPOptions &opts, uint32_t seg_len)
+    {
+        const uint32_t ack = rte_be_to_cpu_32(tcp_hdr->recv_ack);
+        const uint32_t wnd = (uint32_t)rte_be_to_cpu_16(tcp_hdr->rx_win) << tcb.snd_wscale;
+        if (tcp_seq_gt(tcb.snd_nxt, snd_max))
+            snd_max = tcb.snd_nxt;
+        if (tcp_seq_gt(ack, snd_max))
+        {
+            // 确认了还没有发送的数据，忽略
+            return;
+        }
+
+        if (tcp_seq_gt(ack, tcb.snd_una))
+        {
+            uint64_t sent_tsc;
+            const uint32_t acked = snd_queue.Ack(ack, &sent_tsc);
+            // 优先使用Timestamp计算RTT，重传过的数据段也能得到准确的样本
+            if (tcb.ts_ok && opts.has_timestamp && opts.ts_ecr != 0)
+                rto.Sample((tcp_ts_now() - opts.ts_ecr) * 1000);
+            else if (sent_tsc != 0)
+                rto.Sample((rte_get_tsc_cycles() - sent_tsc) * US_PER_S / rte_get_tsc_hz());
+
+            tcb.snd_una = ack;
+            if (tcp_seq_gt(ack, tcb.snd_nxt))
+                tcb.snd_nxt = ack; // 回退之后还没有重新发送的数据已经被确认了
+            dupacks = 0;
+            nb_retries = 0;
+            if (cc->OnAck(acked, ack, rto.srtt) == TCPCongestionControl::ACK_PARTIAL)
+            {
+                // 快速恢复中的partial ACK说明下一个数据段也丢了
+                RetransmitFront();
+            }
+            if (tcb.snd_una == tcb.snd_nxt)
+                context->timers->Cancel(&rto_timer);
+            else
+                ArmRTO();
+        }
+        else if (ack == tcb.snd_una && seg_len == 0 && wnd == tcb.snd_wnd && tcb.snd_una != tcb.snd_nxt)
+        {
+            // 重复的ACK，说明对方收到了乱序的数据，可能有数据段丢失了
+            if (cc->OnDupAck(++dupacks, tcb.snd_nxt - tcb.snd_una, tcb.snd_nxt))
+            {
+                stats.fast_retransmits++;
+                RetransmitFront();
+            }
+        }
+        tcb.snd_wnd = wnd;
+    }
+
+    // 在对方接收窗口和拥塞窗口允许的范围内发送还没有发送过的数据，返回发送的报文段数量
+    int TrySend()
+    {
+        // FIN发出之后，只有重传超时回退了`snd_nxt`时还有数据要(重新)发送
+        if (tcb.status != TCB::Status::ESTABLISHED && tcb.status != TCB::Status::CLOSE_WAIT && !FinSent())
+            return 0;
+
+        const uint32_t wnd = RTE_MIN(tcb.snd_wnd, cc->Cwnd());
+        int sent = 0;
+        while (TCPSendQueue::Segment *seg = snd_queue.NextUnsent())
+        {
+            if (tcb.snd_nxt - tcb.snd_una + seg->len > wnd)
+                break;
+
+            // 窗口允许的连续数据段合成一个最大`TCP_TSO_MAX_BYTES`的报文段，由网卡(TSO)或者GSO切分成MSS大小
+            struct rte_mbuf *datas[TCP_TSO_MAX_SEGS];
+            uint32_t nb_datas = 0, len = 0, nb_mbufs = 1;
+            while (nb_datas < RTE_DIM(datas))
+            {
+                TCPSendQueue::Segment *s = snd_queue.UnsentAt(nb_datas);
+                if (!s)
+                    break;
+                if (nb_datas > 0 && (len + s->len > TCP_TSO_MAX_BYTES || nb_mbufs + s->data->nb_segs > port_tx_capa.max_segs ||
+                                     tcb.snd_nxt - tcb.snd_una + len + s->len > wnd))
+                    break;
+                datas[nb_datas++] = s->data;
+                len += s->len;
+                nb_mbufs += s->data->nb_segs;
+            }
+            if (!Output(seg->seq, RTE_TCP_ACK_FLAG | RTE_TCP_PSH_FLAG, datas, nb_datas))
+                break;
+
+            const uint64_t now_tsc = rte_get_tsc_cycles();
+            for (uint32_t i = 0; i < nb_datas; i++)
+                snd_queue.MarkSent(now_tsc);
+            tcb.snd_nxt = seg->seq + len;
+            stats.bytes_sent += len;
+            stats.segs_sent += nb_datas;
+            if (nb_datas > 1)
+                stats.tso_sends++;
+            sent++;
+        }
+
+        if (fin_pending && !snd_queue.NextUnsent() && Output(tcb.snd_nxt, RTE_TCP_FIN_FLAG | RTE_TCP_ACK_FLAG, nullptr))
+        {
+            printf("[TCP] Sent FIN\n");
+            fin_pending = false;
+            tcb.snd_nxt++;
+            tcb.status = tcb.status == TCB::Status::ESTABLISHED ? TCB::Status::FIN_WAIT_1 : TCB::Status::LAST_ACK;
+            sent++;
+        }
+        else if (FinSent() && !snd_queue.NextUnsent() && tcb.snd_nxt == snd_queue.EndSeq() &&
+                 Output(tcb.snd_nxt, RTE_TCP_FIN_FLAG | RTE_TCP_ACK_FLAG, nullptr))
+        {
+            // 回退之后重新发送FIN
+            tcb.snd_nxt++;
+            sent++;
+        }
+
+        // 有数据在路上时等待ACK；窗口为0时定时发送窗口探测
+        if (!rto_timer.Pending() && (tcb.snd_una != tcb.snd_nxt || snd_queue.NextUnsent() || fin_pending))
+            ArmRTO();
+        return sent;
+    }
+
+    // 重传最早的一个没有被确认的数据段(或FIN)
+    void RetransmitFront()
+    {
+        if (TCPSendQueue::Segment *seg = snd_queue.FrontSent())
+        {
+            if (Output(seg->seq, RTE_TCP_ACK_FLAG | RTE_TCP_PSH_FLAG, seg->data))
+            {
+                seg->retransmitted = true;
+                stats.bytes_retransmitted += seg->len;
+                stats.segs_retransmitted++;
+            }
+        }
+        else if (FinSent())
+        {
+            Output(tcb.snd_nxt - 1, RTE_TCP_FIN_FLAG | RTE_TCP_ACK_FLAG, nullptr);
+        }
+    }
+
+    void ArmRTO() { context->timers->Schedule(&rto_timer, rto.rto); }
+
+    // 不管窗口发送下一个还没有发送的数据段
+    void SendProbe()
+    {
+        TCPSendQueue::Segment *seg = snd_queue.NextUnsent();
+        if (seg && Output(seg->seq, RTE_TCP_ACK_FLAG | RTE_TCP_PSH_FLAG, seg->data))
+        {
+            snd_queue.MarkSent(rte_get_tsc_cycles());
+            tcb.snd_nxt = seg->seq + seg->len;
+        }
+    }
+
+    void OnEstablished()
+    {
+        context->timers->Schedule(&keepalive_timer, TCP_KEEPALIVE_IDLE_US);
+        if (!app)
+            return;
+        if (listener)
+        {
+            if (!app->OnAccept(this))
+                Abort();
+        }
+        else
+        {
+            app->OnConnected(this);
+        }
+    }
+
+    // 连接空闲超时：发送一个序列号为snd_una - 1的空ACK，对方会回复一个ACK(RFC 9293 3.8.4)
+    static void OnKeepaliveTimer(Timer *timer, void *arg)
+    {
+        TCPConnectionTask *self = static_cast<TCPConnectionTask *>(arg);
+        if (self->tcb.status != TCB::Status::ESTABLISHED && self->tcb.status != TCB::Status::CLOSE_WAIT)
+            return;
+        if (self->keepalive_probes >= TCP_KEEPALIVE_PROBES)
+        {
+            printf("[TCP] Keepalive timeout, connection aborted\n");
+            self->SetClosed();
+            return;
+        }
+        self->keepalive_probes++;
+        self->Output(self->tcb.snd_una - 1, RTE_TCP_ACK_FLAG, nullptr);
+        self->context->timers->Schedule(timer, TCP_KEEPALIVE_INTVL_US);
+    }
+
+    static void OnRTOTimer(Timer *timer, void *arg) { static_cast<TCPConnectionTask *>(arg)->OnRetransmitTimeout(); }
+
+    // 重传超时：`snd_nxt`回退到`snd_una`，窗口中没有被确认的数据都当作丢失，由慢启动从最早的数据段开始重新发送，
+    // 不用每个丢失的数据段都等一次RTO；RTO翻倍(RFC 5681 3.1、RFC 6298 5.4-5.6)
+    void OnRetransmitTimeout()
+    {
+        if (tcb.status == TCB::Status::SYN_RECEIVED && nb_retries + 1 > TCP_SYNACK_RETRIES)
+        {
+            // 半连接不能一直占着连接池
+            if (listener)
+                listener->half_open_timeouts++;
+            SetClosed();
+            return;
+        }
+        if (++nb_retries > TCP_MAX_RETRIES)
+        {
+            printf("[TCP] Too many retransmissions, connection aborted\n");
+            SetClosed();
+            return;
+        }
+
+        if (tcb.status == TCB::Status::SYN_SENT || tcb.status == TCB::Status::SYN_RECEIVED)
+        {
+            SendSYN();
+        }
+        else if (tcb.snd_una != tcb.snd_nxt)
+        {
+            stats.timeouts++;
+            cc->OnTimeout(tcb.snd_nxt - tcb.snd_una);
+            if (tcp_seq_gt(tcb.snd_nxt, snd_max))
+                snd_max = tcb.snd_nxt;
+            snd_queue.Rewind();
+            tcb.snd_nxt = tcb.snd_una;
+            // 拥塞窗口是1个MSS，一般会重新发送最早的数据段；对方的窗口为0时作为窗口探测发送
+            if (TrySend() == 0)
+                SendProbe();
+        }
+        else if (snd_queue.NextUnsent())
+        {
+            // 对方的窗口为0，不管窗口发送一个数据段作为窗口探测
+            SendProbe();
+        }
+        else if (fin_pending)
+        {
+            // 之前没有mbuf发送FIN
+            TrySend();
+            return;
+        }
+        else
+        {
+            return;
+        }
+        rto.Backoff();
+        ArmRTO();
+    }
+
+    void SetClosed()
+    {
+        if (tcb.status == TCB::Status::CLOSED)
+            return;
+        if (listener && tcb.status == TCB::Status::SYN_RECEIVED)
+            listener->half_open--;
+        tcb.status = TCB::Status::CLOSED;
+        context->timers->Cancel(&rto_timer);
+        context->timers->Cancel(&keepalive_timer);
+        context->timers->Cancel(&close_timer);
+        context->timers->Cancel(&delack_timer);
+        context->tcp_connections->Retire(this);
+        if (app)
+            app->OnClosed(this);
+    }
+
+    void ResetCongestionControl()
+    {
+        if (cc)
+            cc->~TCPCongestionControl();
+        cc = TCPCongestionControl::Create(tcb.cc_type, SendMSS(), &cc_storage);
+    }
+
+    void SendSYN()
+    {
+        SendSYN(context, hdr_template, tcb, tcp_ts_now());
+    }
+
+public:
+    // 主动连接时发送SYN，带上所有支持的Option；被动连接时发送SYN,ACK，只带上对方也支持的Option。
+    // 不需要连接对象，`TCPServerTask`发送SYN cookie时也使用它
+    static void SendSYN(Context *context, const TCB &tcb, uint32_t ts_val)
+    {
+        PacketTemplate tmpl;
+        InitTemplate(context, tcb, &tmpl);
+        SendSYN(context, tmpl, tcb, ts_val);
+    }
+
+private:
+    static void SendSYN(Context *context, const PacketTemplate &tmpl, const TCB &tcb, uint32_t ts_val)
+    {
+        const bool passive = tcb.status == TCB::Status::SYN_RECEIVED;
+        auto _ = CreatePKT(context, tmpl, tcb, TCP_SYN_OPTIONS_LEN, 0);
+        struct rte_mbuf *pkt = std::get<0>(_);
+        struct rte_tcp_hdr *tcp_hdr = std::get<2>(_);
+        if (!pkt)
+            return; // 由重传定时器(或者对方重发的SYN)重试
+        tcp_hdr->sent_seq = rte_cpu_to_be_32(tcb.iss);
+        tcp_hdr->tcp_flags = passive ? (RTE_TCP_SYN_FLAG | RTE_TCP_ACK_FLAG) : RTE_TCP_SYN_FLAG;
+        if (!passive)
+            tcp_hdr->recv_ack = 0;
+        tcp_hdr->rx_win = rte_cpu_to_be_16(RTE_MIN(tcb.rcv_wnd, UINT16_MAX)); // SYN中的窗口不缩放
+        if (passive)
+            WriteTCPSYNOptions((uint8_t *)(tcp_hdr + 1), TCP_MSS, tcb.sack_ok, tcb.ts_ok, ts_val, tcb.ts_recent, tcb.wscale_ok, TCP_WSCALE);
+        else
+            WriteTCPSYNOptions((uint8_t *)(tcp_hdr + 1), TCP_MSS, true, true, ts_val, 0, true, TCP_WSCALE);
+
+        send_ipv4(context, pkt, tcb.remote_ip);
+    }
+
+    // 发送一个ACK，乱序队列不为空时带上SACK blocks
+    void SendACK()
+    {
+        Output(tcb.snd_nxt, RTE_TCP_ACK_FLAG, nullptr);
+        stats.acks_sent++;
+    }
+
+    // 发送一个序列号为`seq`的报文段，`data`不为空时把它的clone接在包头后面作为payload。
+    // 所有报文段都带上Timestamp，乱序队列不为空时带上SACK blocks。
+    bool Output(uint32_t seq, uint8_t tcp_flags, struct rte_mbuf *data)
+    {
+        return Output(seq, tcp_flags, &data, data ? 1 : 0);
+    }
+
+    // 把`datas`中的`nb_datas`个数据段依次接在同一个包头后面发送，超过一个MSS时标记为TSO报文段(`tso_segsz`为MSS)
+    bool Output(uint32_t seq, uint8_t tcp_flags, struct rte_mbuf *const *datas, uint32_t nb_datas)
+    {
+        uint8_t options[TCP_MAX_OPTIONS_LEN];
+        int options_length = 0;
+        if (tcb.ts_ok)
+            options_length += WriteTCPTimestampOption(options + options_length, tcp_ts_now(), tcb.ts_recent);
+        if (tcb.sack_ok && !ooo.Empty())
+        {
+            TCPSackBlock blocks[TCP_MAX_SACK_BLOCKS];
+            int nb_blocks = ooo.GetSackBlocks(blocks, (TCP_MAX_OPTIONS_LEN - options_length - 4) / 8);
+            options_length += WriteTCPSackOption(options + options_length, blocks, nb_blocks);
+        }
+
+        auto _ = CreatePKT(context, hdr_template, tcb, options_length, 0);
+        struct rte_mbuf *pkt = std::get<0>(_);
+        struct rte_ipv4_hdr *ip_hdr = std::get<1>(_);
+        struct rte_tcp_hdr *tcp_hdr = std::get<2>(_);
+        if (!pkt)
+            return false;
+        tcp_hdr->sent_seq = rte_cpu_to_be_32(seq);
+        tcp_hdr->tcp_flags = tcp_flags;
+        tcp_hdr->rx_win = rte_cpu_to_be_16(AdvertiseWindow() >> tcb.rcv_wscale);
+        memcpy(tcp_hdr + 1, options, options_length);
 
-            printf("[TCP] Sent SYN\n");
-            tcb.status = TCB::Status::SYN_SENT;
-        }
-        break;
-        case TCB::Status::ESTABLISHED:
+        uint32_t payload_length = 0;
+        for (uint32_t i = 0; i < nb_datas; i++)
         {
-            uint64_t now_tsc = rte_get_tsc_cycles();
-            if (now_tsc - last_sent_at_tsc < tsc_hz * 5)
+            // 发送队列中的数据可能还要重传，只发送它的clone
+            struct rte_mbuf *payload = rte_pktmbuf_clone(datas[i], context->mbuf_pool);
+            if (!payload)
             {
-                return;
+                rte_pktmbuf_free(pkt);
+                return false;
             }
-            if (!period_send_message)
+            if (rte_pktmbuf_chain(pkt, payload) != 0)
             {
-                return;
+                rte_pktmbuf_free(payload);
+                rte_pktmbuf_free(pkt);
+                return false;
             }
-            last_sent_at_tsc = now_tsc;
-
-            const char *message = "Hello DPDK TCP\n";
-            auto _ = CreatePKT(0, strlen(message));
-            struct rte_mbuf *pkt = std::get<0>(_);
-            struct rte_tcp_hdr *tcp_hdr = std::get<2>(_);
-            tcp_hdr->tcp_flags |= RTE_TCP_PSH_FLAG | RTE_TCP_ACK_FLAG;
-            memcpy(tcp_hdr + 1, message, strlen(message));
-
-            const uint16_t nb_tx = rte_eth_tx_burst(PORT, 0, &pkt, 1);
-            assert(nb_tx == 1);
-            printf("[TCP] Sent message\n");
-        }
-        break;
-        default:
-            // nothing
-            break;
+            payload_length += datas[i]->pkt_len;
         }
-    }
-
-    virtual ProcessResult TryProcess(struct rte_mbuf *pkt) override final
-    {
-        struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
-        assert(eth_hdr);
-        if (rte_be_to_cpu_16(eth_hdr->ether_type) == RTE_ETHER_TYPE_IPV4)
+        if (payload_length > 0)
         {
-            struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
-            if (ip_hdr->dst_addr == context->ip_addr && ip_hdr->src_addr == tcb.remote_ip && ip_hdr->next_proto_id == IPPROTO_TCP)
+            if (payload_length > SendMSS())
             {
-                struct rte_tcp_hdr *tcp_hdr = (struct rte_tcp_hdr *)(ip_hdr + 1);
-                if (tcp_hdr->src_port == tcb.remote_port && tcp_hdr->dst_port == tcb.local_port)
-                {
-                    switch (tcb.status)
-                    {
-                    case TCB::Status::SYN_SENT:
-                    {
-                        if ((tcp_hdr->tcp_flags & RTE_TCP_SYN_FLAG) && (tcp_hdr->tcp_flags & RTE_TCP_ACK_FLAG) && (rte_be_to_cpu_32(tcp_hdr->recv_ack) == tcb.seq + 1))
-                        {
-                            printf("[TCP] SYN,ACK Received\n");
-
-                            tcb.seq++;
-                            tcb.ack = rte_be_to_cpu_32(tcp_hdr->sent_seq) + 1;
-
-                            auto _ = CreatePKT(0, 0);
-                            struct rte_mbuf *pkt = std::get<0>(_);
-                            struct rte_tcp_hdr *tcp_hdr = std::get<2>(_);
-                            tcp_hdr->tcp_flags |= RTE_TCP_ACK_FLAG;
-                            const uint16_t nb_tx = rte_eth_tx_burst(PORT, 0, &pkt, 1);
-                            assert(nb_tx == 1);
-                            printf("[TCP] Sent ACK\n");
-                            tcb.status = TCB::Status::ESTABLISHED;
-
-                            return ProcessResult::PROCESSED;
-                        }
-                    }
-                    break;
-                    case TCB::Status::ESTABLISHED:
-                    {
-                        if (tcp_hdr->tcp_flags & RTE_TCP_ACK_FLAG)
-                        {
-                            tcb.seq = rte_be_to_cpu_32(tcp_hdr->recv_ack);
-                        }
-                        if (rte_be_to_cpu_32(tcp_hdr->sent_seq) == tcb.ack)
-                        {
-                            uint8_t *payload = (uint8_t *)tcp_hdr + (uint32_t)(tcp_hdr->data_off >> 4) * 4;
-                            int payload_length = rte_be_to_cpu_16(ip_hdr->total_length) - (payload - (uint8_t *)ip_hdr);
-                            if (payload_length > 0)
-                            {
-                                printf("[TCP] Received data (length=%d): %s\n", payload_length, std::string((char *)payload, payload_length).c_str());
-
-                                tcb.ack += payload_length;
-
-                                auto _ = CreatePKT(0, 0);
-                                struct rte_mbuf *pkt = std::get<0>(_);
-                                struct rte_tcp_hdr *tcp_hdr = std::get<2>(_);
-                                tcp_hdr->tcp_flags |= RTE_TCP_ACK_FLAG;
-                                const uint16_t nb_tx = rte_eth_tx_burst(PORT, 0, &pkt, 1);
-                                assert(nb_tx == 1);
-                                printf("[TCP] Relay ACK\n");
-                            }
-                        }
-                        if (tcp_hdr->tcp_flags & RTE_TCP_FIN_FLAG)
-                        {
-                            auto _ = CreatePKT(0, 0);
-                            struct rte_mbuf *pkt = std::get<0>(_);
-                            struct rte_tcp_hdr *tcp_hdr = std::get<2>(_);
-                            tcp_hdr->tcp_flags |= RTE_TCP_FIN_FLAG | RTE_TCP_ACK_FLAG;
-
-                            const uint16_t nb_tx = rte_eth_tx_burst(PORT, 0, &pkt, 1);
-                            assert(nb_tx == 1);
-                            printf("[TCP] Sent FIN\n");
-                            tcb.status = TCB::Status::LAST_ACK;
-                        }
-                        return ProcessResult::PROCESSED;
-                    }
-                    break;
-                    case TCB::Status::LAST_ACK:
-                    {
-                        if (tcp_hdr->tcp_flags & RTE_TCP_ACK_FLAG)
-                        {
-                            printf("[TCP] Closed\n");
-                            tcb.status = TCB::Status::CLOSED;
-                        }
-                    }
-                    break;
-                    default:
-                        // nothing
-                        break;
-                    };
-                }
+                pkt->ol_flags |= RTE_MBUF_F_TX_TCP_SEG;
+                pkt->tso_segsz = SendMSS();
             }
+            ip_hdr->total_length = rte_cpu_to_be_16(rte_be_to_cpu_16(ip_hdr->total_length) + payload_length);
+            // TSO报文段的伪首部不包括长度
+            tcp_hdr->cksum = rte_ipv4_phdr_cksum(ip_hdr, pkt->ol_flags);
         }
 
-        return ProcessResult::NOT_PROCESSED;
+        // 带ACK的报文段确认了到目前为止收到的所有数据，不需要再单独回复
+        if (tcp_flags & RTE_TCP_ACK_FLAG)
+        {
+            ack_pending_bytes = 0;
+            ack_now = false;
+            context->timers->Cancel(&delack_timer);
+        }
+        send_ipv4(context, pkt, tcb.remote_ip);
+        return true;
     }
 
-    virtual bool IsAlive() override final { return tcb.status != TCB::Status::CLOSED; }
+    static void InitTemplate(Context *context, const TCB &tcb, PacketTemplate *tmpl)
+    {
+        tmpl->Init(IPPROTO_TCP, context->mac_addr, context->ip_addr, tcb.remote_ip, tcb.local_port, tcb.remote_port);
+    }
 
-private:
-    std::tuple<struct rte_mbuf *, struct rte_ipv4_hdr *, struct rte_tcp_hdr *> CreatePKT(uint32_t options_length, uint32_t payload_length)
+    // 分配一个TCP报文段，从`tmpl`复制包头之后填写序列号、确认号和Option的空间(清零)，窗口和flags由调用者填写。
+    // 没有mbuf时返回的指针都是nullptr
+    static std::tuple<struct rte_mbuf *, struct rte_ipv4_hdr *, struct rte_tcp_hdr *> CreatePKT(Context *context, const PacketTemplate &tmpl, const TCB &tcb,
+                                                                                                 uint32_t options_length, uint32_t payload_length)
     {
         options_length = (options_length + 3) / 4 * 4;
 
-        struct rte_mbuf *pkt = rte_pktmbuf_alloc(context->mbuf_pool);
+        struct rte_mbuf *pkt = context->mbufs->Alloc(MbufPriority::CRITICAL);
         if (!pkt)
-            rte_exit(EXIT_FAILURE, "Failed to alloc pkt\n");
-
-        struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
-        rte_ether_addr_copy(&context->mac_addr, &eth_hdr->src_addr);
-        rte_ether_addr_copy(&tcb.remote_mac_addr, &eth_hdr->dst_addr);
-        eth_hdr->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
-
-        struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
-        memset(ip_hdr, 0, sizeof(*ip_hdr));
-        ip_hdr->version_ihl = IP_VHL_DEF;
-        ip_hdr->type_of_service = 0;
-        ip_hdr->fragment_offset = 0x40; // 高3位是flags
-        ip_hdr->time_to_live = IP_DEFTTL;
-        ip_hdr->packet_id = rte_cpu_to_be_16(0x7acb);
-        ip_hdr->src_addr = context->ip_addr;
-        ip_hdr->dst_addr = tcb.remote_ip;
-        ip_hdr->next_proto_id = IPPROTO_TCP;
-        ip_hdr->total_length = rte_cpu_to_be_16(sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_tcp_hdr) + options_length + payload_length);
+            return {nullptr, nullptr, nullptr};
 
+        struct rte_ipv4_hdr *ip_hdr = tmpl.Apply(pkt, options_length, payload_length);
         struct rte_tcp_hdr *tcp_hdr = (struct rte_tcp_hdr *)(ip_hdr + 1);
-        memset(tcp_hdr, 0, sizeof(*tcp_hdr) + options_length);
-        tcp_hdr->src_port = tcb.local_port;
-        tcp_hdr->dst_port = tcb.remote_port;
-        tcp_hdr->sent_seq = rte_cpu_to_be_32(tcb.seq);
-        tcp_hdr->recv_ack = rte_cpu_to_be_32(tcb.ack);
-        tcp_hdr->data_off = ((sizeof(*tcp_hdr) + options_length) / 4) << 4; // data_off实际只占用4bit，另外4bit保留位应该设为0
-        tcp_hdr->rx_win = rte_cpu_to_be_16(0xfaf0);
-
-        // Fill other DPDK metadata
-        pkt->packet_type = RTE_PTYPE_L2_ETHER | RTE_PTYPE_L3_IPV4 | RTE_PTYPE_L4_TCP;
-        const uint32_t PKT_LEN = sizeof(*eth_hdr) + sizeof(*ip_hdr) + sizeof(*tcp_hdr) + options_length + payload_length;
-        pkt->pkt_len = PKT_LEN;
-        pkt->data_len = pkt->pkt_len;
-        pkt->l2_len = sizeof(struct rte_ether_hdr);
-        pkt->l3_len = sizeof(struct rte_ipv4_hdr);
-        pkt->l4_len = sizeof(struct rte_tcp_hdr);
-        pkt->ol_flags |= (RTE_MBUF_F_TX_IPV4 | RTE_MBUF_F_TX_IP_CKSUM | RTE_MBUF_F_TX_TCP_CKSUM);
-
+        tcp_hdr->sent_seq = rte_cpu_to_be_32(tcb.snd_nxt);
+        tcp_hdr->recv_ack = rte_cpu_to_be_32(tcb.rcv_nxt);
+        if (options_length)
+            memset(tcp_hdr + 1, 0, options_length);
         tcp_hdr->cksum = rte_ipv4_phdr_cksum(ip_hdr, pkt->ol_flags);
 
         return {pkt, ip_hdr, tcp_hdr};
     }
 };
 
-// 一个TCP Server
+inline void TCPApplication::OnPeerClosed(TCPConnectionTask *conn) { conn->Close(); }
+
+// 一个TCP Server：收到SYN之后从`context->tcp_connections`中分配一个连接，之后这个连接的数据包都直接交给连接处理。
+// 半连接最多`TCP_SYN_BACKLOG`个，超过之后开启了SYN cookie时不再分配连接，而是回复带cookie的SYN,ACK，
+// 收到cookie校验通过的ACK时直接创建ESTABLISHED状态的连接；没有开启时丢弃SYN
 class TCPServerTask : public Task
 {
     rte_be16_t listen_port;
+    TCPApplication *app;              // 这个端口上接受的连接交给哪个应用
+    TCPCongestionControlType cc_type; // 这个端口上接受的连接使用的拥塞控制算法
+    bool syn_cookies;
+    bool delayed_ack;                 // 这个端口上接受的连接是否延迟ACK
+    bool reuse_port;                  // 是否允许其他Task同时监听这个端口
+    SynCookie cookie;
 
-    typedef std::pair<rte_be32_t, rte_be16_t> remote_info_t; // <remote_addr, remote_port>
-    std::map<remote_info_t, TCB> tcbs;
+    TCPListenerStats stats;
 
 public:
-    std::queue<TCB> estab_tcbs;
+    TCPServerTask(const std::string &name, Context *context, rte_be16_t listen_port, TCPApplication *app,
+                  TCPCongestionControlType cc_type = TCPCongestionControlType::CUBIC, bool syn_cookies = true, bool delayed_ack = true,
+                  bool reuse_port = false)
+        : Task(name, context), listen_port(listen_port), app(app), cc_type(cc_type), syn_cookies(syn_cookies), delayed_ack(delayed_ack),
+          reuse_port(reuse_port)
+    {
+        memset(&stats, 0, sizeof(stats));
+    }
 
-public:
-    TCPServerTask(const std::string &name, Context *context, rte_be16_t listen_port) : Task(name, context), listen_port(listen_port)
+    virtual ~TCPServerTask() override
     {
+        printf("[TCPServer] %s: %" PRIu64 " SYNs received, %" PRIu64 " dropped, %" PRIu64 " accepted, "
+               "%" PRIu64 " half-open timeouts, %" PRIu64 " half-open resets, "
+               "cookies %" PRIu64 " sent / %" PRIu64 " validated / %" PRIu64 " failed\n",
+               name.c_str(), stats.syns_received, stats.syns_dropped, stats.accepted, stats.half_open_timeouts, stats.half_open_resets,
+               stats.cookies_sent, stats.cookies_validated, stats.cookies_failed);
     }
 
-    virtual ProcessResult TryProcess(struct rte_mbuf *pkt) override final
+    virtual void Setup() override final
     {
-        struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
-        assert(eth_hdr);
-        if (rte_be_to_cpu_16(eth_hdr->ether_type) == RTE_ETHER_TYPE_IPV4)
+        if (!context->dispatcher->BindListener(this, IPPROTO_TCP, listen_port, true, reuse_port))
+            printf("[TCPServer] %s: cannot listen on port %u\n", name.c_str(), rte_be_to_cpu_16(listen_port));
+    }
+
+    virtual ProcessResult TryProcess(struct rte_mbuf *pkt, const PacketInfo &info) override final
+    {
+        // 已知连接的数据包不会到这里，这里只处理新连接的SYN和SYN cookie的ACK
+        struct rte_tcp_hdr *tcp_hdr = (struct rte_tcp_hdr *)info.l4_hdr;
+        const uint8_t flags = tcp_hdr->tcp_flags & (RTE_TCP_SYN_FLAG | RTE_TCP_ACK_FLAG | RTE_TCP_RST_FLAG);
+        if (flags == RTE_TCP_SYN_FLAG)
+            return OnSYN(info, tcp_hdr);
+        if (flags == RTE_TCP_ACK_FLAG && syn_cookies)
+            return OnCookieACK(pkt, info, tcp_hdr);
+        return ProcessResult::NOT_PROCESSED;
+    }
+
+    const TCPListenerStats &GetStats() const { return stats; }
+
+private:
+    ProcessResult OnSYN(const PacketInfo &info, const struct rte_tcp_hdr *tcp_hdr)
+    {
+        stats.syns_received++;
+
+        TCPOptions opts;
+        ParseTCPOptions(tcp_hdr, &opts);
+
+        TCB tcb = NewTCB(info, tcp_hdr);
+        tcb.status = TCB::Status::SYN_RECEIVED;
+        tcb.rcv_nxt = rte_be_to_cpu_32(tcp_hdr->sent_seq) + 1;
+
+        if (stats.half_open >= TCP_SYN_BACKLOG)
         {
-            struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
-            if (ip_hdr->dst_addr == context->ip_addr && ip_hdr->next_proto_id == IPPROTO_TCP)
+            if (!syn_cookies)
             {
-                struct rte_tcp_hdr *tcp_hdr = (struct rte_tcp_hdr *)(ip_hdr + 1);
-                if (tcp_hdr->dst_port == listen_port)
-                {
-                    if (tcp_hdr->tcp_flags & RTE_TCP_SYN_FLAG)
-                    {
-                        remote_info_t remote_info((rte_be32_t)ip_hdr->src_addr, (rte_be16_t)tcp_hdr->src_port);
-                        if (tcbs.count(remote_info) == 0)
-                        {
-                            auto &tcb = tcbs[remote_info];
-                            tcb.remote_mac_addr = eth_hdr->src_addr;
-                            tcb.remote_ip = ip_hdr->src_addr;
-                            tcb.remote_port = tcp_hdr->src_port;
-                            tcb.local_port = listen_port;
-                            tcb.status = TCB::Status::SYN_RECEIVED;
-                            tcb.seq = rand();
-                            tcb.ack = rte_be_to_cpu_32(tcp_hdr->sent_seq) + 1;
-
-                            auto _ = CreatePKT(tcb, 4 + 2 + 10 + 1 + 3, 0);
-                            struct rte_mbuf *pkt = std::get<0>(_);
-                            struct rte_tcp_hdr *tcp_hdr = std::get<2>(_);
-                            tcp_hdr->tcp_flags |= RTE_TCP_SYN_FLAG | RTE_TCP_ACK_FLAG;
-
-                            uint8_t *options = (uint8_t *)(tcp_hdr + 1);
-                            { // MSS Option
-                                options[0] = 2;
-                                options[1] = 4;
-                                *(rte_be16_t *)(options + 2) = rte_cpu_to_be_16(1460);
-                                options += 4;
-                            }
-                            { // SACK permitted
-                                options[0] = 4;
-                                options[1] = 2;
-                                options += 2;
-                            }
-                            { // Timestamp Option
-                                options[0] = 8;
-                                options[1] = 10;
-                                *(rte_be32_t *)(options + 2) = rte_cpu_to_be_32(clock());
-                                options += 10;
-                            }
-                            { // No OP
-                                options[0] = 1;
-                                options += 1;
-                            }
-                            { // Window scale
-                                options[0] = 3;
-                                options[1] = 3;
-                                options[2] = 7;
-                                options += 3;
-                            }
+                stats.syns_dropped++;
+                return ProcessResult::PROCESSED;
+            }
+            // 不分配连接，协商的结果编码在ISN和TSval中
+            uint32_t ts_val;
+            tcb.iss = cookie.Encode(info.dst_ip, info.src_ip, listen_port, tcb.remote_port, tcb.rcv_nxt - 1, &opts, &ts_val);
+            tcb.Negotiate(opts);
+            TCPConnectionTask::SendSYN(context, tcb, ts_val);
+            stats.cookies_sent++;
+            return ProcessResult::PROCESSED;
+        }
 
-                            const uint16_t nb_tx = rte_eth_tx_burst(PORT, 0, &pkt, 1);
-                            assert(nb_tx == 1);
+        // 只回复对方也支持的Option
+        tcb.iss = tcp_new_isn(info.dst_ip, info.src_ip, info.dst_port, info.src_port);
+        tcb.snd_una = tcb.snd_nxt = tcb.iss;
+        tcb.Negotiate(opts);
 
-                            printf("[TCPServer] Received SYN\n");
-                            return ProcessResult::PROCESSED;
-                        }
-                    }
-                    else if (tcp_hdr->tcp_flags & RTE_TCP_ACK_FLAG)
-                    {
-                        remote_info_t remote_info((rte_be32_t)ip_hdr->src_addr, (rte_be16_t)tcp_hdr->src_port);
-                        if (tcbs.count(remote_info))
-                        {
-                            auto &tcb = tcbs[remote_info];
-                            if (rte_be_to_cpu_32(tcp_hdr->recv_ack) == tcb.seq + 1)
-                            {
-                                tcb.seq++;
-                                tcb.ack = rte_be_to_cpu_32(tcp_hdr->sent_seq);
-                                tcb.status = TCB::Status::ESTABLISHED;
+        TCPConnectionTask *conn = context->tcp_connections->Alloc("TCPConnection", context, tcb, app, &stats);
+        if (!conn)
+        {
+            stats.syns_dropped++;
+            return ProcessResult::PROCESSED;
+        }
+        conn->Setup();
+        return ProcessResult::PROCESSED;
+    }
+
+    // 不属于任何连接的ACK，可能是SYN cookie的第三次握手
+    ProcessResult OnCookieACK(struct rte_mbuf *pkt, const PacketInfo &info, const struct rte_tcp_hdr *tcp_hdr)
+    {
+        const uint32_t ack = rte_be_to_cpu_32(tcp_hdr->recv_ack);
+        const uint32_t seq = rte_be_to_cpu_32(tcp_hdr->sent_seq);
+        TCPOptions ack_opts, syn_opts;
+        ParseTCPOptions(tcp_hdr, &ack_opts);
+        if (!cookie.Decode(info.dst_ip, info.src_ip, listen_port, tcp_hdr->src_port, ack, seq, ack_opts, &syn_opts))
+        {
+            stats.cookies_failed++;
+            return ProcessResult::NOT_PROCESSED;
+        }
+        stats.cookies_validated++;
+
+        TCB tcb = NewTCB(info, tcp_hdr);
+        tcb.status = TCB::Status::ESTABLISHED;
+        tcb.Negotiate(syn_opts);
+        tcb.iss = ack - 1;
+        tcb.snd_una = tcb.snd_nxt = ack;
+        tcb.snd_wnd = (uint32_t)rte_be_to_cpu_16(tcp_hdr->rx_win) << tcb.snd_wscale;
+        tcb.rcv_nxt = seq;
+
+        TCPConnectionTask *conn = context->tcp_connections->Alloc("TCPConnection", context, tcb, app, &stats);
+        if (!conn)
+        {
+            stats.syns_dropped++;
+            return ProcessResult::PROCESSED;
+        }
+        conn->Setup();
+        stats.accepted++;
 
-                                printf("[TCPServer] Accept new TCP connection from %s:%d to %s:%d\n",
-                                       format_ipv4(ip_hdr->src_addr).c_str(), (int)rte_be_to_cpu_16(tcp_hdr->src_port),
-                                       format_ipv4(ip_hdr->dst_addr).c_str(), (int)rte_be_to_cpu_16(tcp_hdr->dst_port));
+        // ACK中可能已经带了数据
+        if (!conn->IsAlive())
+            return ProcessResult::PROCESSED;
+        return conn->TryProcess(pkt, info);
+    }
 
-                                estab_tcbs.push(tcb);
-                                tcbs.erase(remote_info);
-                            }
-                        }
-                    }
-                }
-            }
+    TCB NewTCB(const PacketInfo &info, const struct rte_tcp_hdr *tcp_hdr) const
+    {
+        TCB tcb;
+        memset(&tcb, 0, sizeof(tcb));
+        tcb.remote_ip = info.src_ip;
+        tcb.remote_port = tcp_hdr->src_port;
+        tcb.local_port = listen_port;
+        tcb.cc_type = cc_type;
+        tcb.delayed_ack = delayed_ack;
+        return tcb;
+    }
+};
+
+// 示例应用：把收到的数据原样发回去，不复制数据。发送队列满时暂存在`user_data`中，等`OnSendable`再发，
+// 在此之前不释放接收窗口，对方会因此减速
+class TCPEchoApplication : public TCPApplication
+{
+    // 发送队列满时还没有发回去的数据，按收到的顺序排列。一条mbuf链的segment数量有上限，链不上时另起一条，
+    // 这些数据已经被确认了，不能丢弃；它们一直占用接收窗口，对方发送的数据不会超过窗口
+    typedef std::vector<struct rte_mbuf *> PendingChains;
+
+public:
+    virtual void OnData(TCPConnectionTask *conn, struct rte_mbuf *data) override
+    {
+        PendingChains *pending = static_cast<PendingChains *>(conn->GetUserData());
+        if (pending && !pending->empty())
+        {
+            if (rte_pktmbuf_chain(pending->back(), data) != 0)
+                pending->push_back(data);
+            return;
+        }
+        Echo(conn, data);
+    }
+
+    virtual void OnSendable(TCPConnectionTask *conn) override
+    {
+        PendingChains *pending = static_cast<PendingChains *>(conn->GetUserData());
+        if (!pending)
+            return;
+        size_t n = 0;
+        while (n < pending->size())
+        {
+            struct rte_mbuf *data = (*pending)[n];
+            const uint32_t length = data->pkt_len;
+            if (!conn->Send(data))
+                break;
+            conn->Consume(length);
+            n++;
         }
+        pending->erase(pending->begin(), pending->begin() + n);
+    }
 
-        return ProcessResult::NOT_PROCESSED;
+    virtual void OnClosed(TCPConnectionTask *conn) override
+    {
+        PendingChains *pending = static_cast<PendingChains *>(conn->GetUserData());
+        if (!pending)
+            return;
+        for (struct rte_mbuf *data : *pending)
+            rte_pktmbuf_free(data);
+        delete pending;
+        conn->SetUserData(nullptr);
     }
 
 private:
-    std::tuple<struct rte_mbuf *, struct rte_ipv4_hdr *, struct rte_tcp_hdr *> CreatePKT(const TCB &tcb, uint32_t options_length, uint32_t payload_length)
+    static void Echo(TCPConnectionTask *conn, struct rte_mbuf *data)
     {
-        options_length = (options_length + 3) / 4 * 4;
+        const uint32_t length = data->pkt_len;
+        if (conn->Send(data))
+        {
+            conn->Consume(length);
+            return;
+        }
+        PendingChains *pending = static_cast<PendingChains *>(conn->GetUserData());
+        if (!pending)
+        {
+            pending = new PendingChains();
+            conn->SetUserData(pending);
+        }
+        pending->push_back(data);
+    }
+};
 
-        struct rte_mbuf *pkt = rte_pktmbuf_alloc(context->mbuf_pool);
-        if (!pkt)
-            rte_exit(EXIT_FAILURE, "Failed to alloc pkt\n");
+// 示例应用：连接建立之后发送一条消息，打印收到的数据
+class TCPHelloApplication : public TCPApplication
+{
+public:
+    virtual void OnConnected(TCPConnectionTask *conn) override
+    {
+        const char *message = "Hello DPDK TCP\n";
+        conn->Send((const uint8_t *)message, strlen(message));
+        printf("[TCP] Sent message\n");
+    }
 
-        struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
-        rte_ether_addr_copy(&context->mac_addr, &eth_hdr->src_addr);
-        rte_ether_addr_copy(&tcb.remote_mac_addr, &eth_hdr->dst_addr);
-        eth_hdr->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+    virtual void OnData(TCPConnectionTask *conn, struct rte_mbuf *data) override
+    {
+        for (struct rte_mbuf *seg = data; seg; seg = seg->next)
+            printf("[TCP] Received data (length=%u): %.*s\n", seg->data_len, (int)seg->data_len, rte_pktmbuf_mtod(seg, const char *));
+        conn->Release(data);
+    }
+};
 
-        struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
-        memset(ip_hdr, 0, sizeof(*ip_hdr));
-        ip_hdr->version_ihl = IP_VHL_DEF;
-        ip_hdr->type_of_service = 0;
-        ip_hdr->fragment_offset = 0x40; // 高3位是flags
-        ip_hdr->time_to_live = IP_DEFTTL;
-        ip_hdr->packet_id = rte_cpu_to_be_16(0x7acb);
-        ip_hdr->src_addr = context->ip_addr;
-        ip_hdr->dst_addr = tcb.remote_ip;
-        ip_hdr->next_proto_id = IPPROTO_TCP;
-        ip_hdr->total_length = rte_cpu_to_be_16(sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_tcp_hdr) + options_length + payload_length);
+static void main_loop(Context *context);
 
-        struct rte_tcp_hdr *tcp_hdr = (struct rte_tcp_hdr *)(ip_hdr + 1);
-        memset(tcp_hdr, 0, sizeof(*tcp_hdr) + options_length);
-        tcp_hdr->src_port = tcb.local_port;
-        tcp_hdr->dst_port = tcb.remote_port;
-        tcp_hdr->sent_seq = rte_cpu_to_be_32(tcb.seq);
-        tcp_hdr->recv_ack = rte_cpu_to_be_32(tcb.ack);
-        tcp_hdr->data_off = ((sizeof(*tcp_hdr) + options_length) / 4) << 4; // data_off实际只占用4bit，另外4bit保留位应该设为0
-        tcp_hdr->rx_win = rte_cpu_to_be_16(0xfaf0);
+static int lcore_main_loop(void *arg)
+{
+    main_loop(static_cast<Context *>(arg));
+    return 0;
+}
 
-        // Fill other DPDK metadata
-        pkt->packet_type = RTE_PTYPE_L2_ETHER | RTE_PTYPE_L3_IPV4 | RTE_PTYPE_L4_TCP;
-        const uint32_t PKT_LEN = sizeof(*eth_hdr) + sizeof(*ip_hdr) + sizeof(*tcp_hdr) + options_length + payload_length;
-        pkt->pkt_len = PKT_LEN;
-        pkt->data_len = pkt->pkt_len;
-        pkt->l2_len = sizeof(struct rte_ether_hdr);
-        pkt->l3_len = sizeof(struct rte_ipv4_hdr);
-        pkt->l4_len = sizeof(struct rte_tcp_hdr);
-        pkt->ol_flags |= (RTE_MBUF_F_TX_IPV4 | RTE_MBUF_F_TX_IP_CKSUM | RTE_MBUF_F_TX_TCP_CKSUM);
+// 每个worker lcore一个Context，DHCP结束之后从主lcore的Context复制而来
+static Context worker_contexts[RTE_MAX_LCORE];
 
-        tcp_hdr->cksum = rte_ipv4_phdr_cksum(ip_hdr, pkt->ol_flags);
+// 在其他lcore上启动主循环，第i个worker负责第i个队列(主lcore负责0号队列)
+static void launch_workers(const Context *main_context)
+{
+    for (uint16_t queue_id = 1; queue_id < main_context->nb_queues; queue_id++)
+    {
+        const unsigned lcore_id = queue_lcores[queue_id];
+        Context *context = &worker_contexts[lcore_id];
+        *context = *main_context;
+        context->mbuf_pool = queue_mbuf_pools[queue_id];
+        context->dispatcher = nullptr;
+        context->tx = nullptr;
+        context->mbufs = nullptr;
+        context->arp = nullptr;
+        context->fib = nullptr;
+        context->queue_id = queue_id;
+        context->status = Status::SETUP_TASKS;
+
+        int ret = rte_eal_remote_launch(lcore_main_loop, context, lcore_id);
+        if (ret != 0)
+            rte_exit(EXIT_FAILURE, "Cannot launch lcore %u: %s\n", lcore_id, rte_strerror(-ret));
+    }
+}
 
-        return {pkt, ip_hdr, tcp_hdr};
+// 应用lcore的循环：从自己的`UDPRing`批量取出UDP echo端口收到的数据报，原样交回协议栈lcore发送
+static int lcore_udp_app_loop(void *arg)
+{
+    UDPRing *ring = static_cast<UDPRing *>(arg);
+    printf("\nCore %u UDP application loop on port %u\n", rte_lcore_id(), UDP_ECHO_PORT);
+
+    uint64_t received = 0, sent = 0;
+    while (!force_quit)
+    {
+        UDPDatagram dgrams[MAX_PKT_BURST];
+        const uint16_t n = ring->Recv(dgrams, MAX_PKT_BURST);
+        if (n == 0)
+        {
+            rte_pause();
+            continue;
+        }
+        received += n;
+
+        UDPMessage msgs[MAX_PKT_BURST];
+        const uint16_t nb_msgs = UDPEchoApplication::PrepareReplies(dgrams, n, msgs);
+        UDPRing::Release(dgrams, n);
+        const uint16_t nb_sent = ring->Send(msgs, nb_msgs);
+        for (uint16_t i = nb_sent; i < nb_msgs; i++)
+            rte_pktmbuf_free(msgs[i].mbuf);
+        sent += nb_sent;
     }
-};
+
+    printf("[UDP] App lcore %u: received %" PRIu64 ", sent %" PRIu64 "\n", rte_lcore_id(), received, sent);
+    return 0;
+}
 
 static void main_loop(Context *context)
 {
-    printf("\nCore %u main loop. [Ctrl+C to quit]\n", rte_lcore_id());
+    printf("\nCore %u main loop on queue %u. [Ctrl+C to quit]\n", rte_lcore_id(), context->queue_id);
 
 #define MOVE_STATUS_TO(new_status)                  \
     {                                               \
@@ -1050,25 +3028,48 @@ static void main_loop(Context *context)
         context->status = Status::new_status;       \
     }
 
-    std::vector<std::unique_ptr<Task>> running_tasks;
+    Dispatcher dispatcher(context);
+    context->dispatcher = &dispatcher;
+    if (context->queue_id == 0)
+        printf("[RX] Using %s packet classifier\n", dispatcher.ClassifierName());
 
-    // 用于进行局域网测试的IP地址
-    // rte_be32_t lan_test_ip = rte_cpu_to_be_32(RTE_IPV4(192, 168, 86, 155));
-    // std::string lan_test_ip_str = "192.168.86.155";
+    TxBuffer tx(PORT, context->queue_id, port_conf.txmode.offloads, context->mbuf_pool, rte_socket_id());
+    context->tx = &tx;
 
-    // // 以下这些任务还没有满足条件，因此还不能放在`running_tasks`中。
-    // // 具体的触发条件见`Status::MAIN_LOOP`部分的处理逻辑。
-    // Task *send_udp_to_lan = new UDPSendTask(8080, lan_test_ip, 8080, &context->lan_dst_mac_addr, "UDPSend:" + lan_test_ip_str, context);
+    TimerWheel timers;
+    context->timers = &timers;
 
-    // // 用于进行广域网测试的IP地址
-    // rte_be32_t wan_test_ip = rte_cpu_to_be_32(RTE_IPV4(39, 107, 102, 23));
-    // std::string wan_test_ip_str = "39.107.102.23";
+    MbufAllocator mbufs(context->mbuf_pool, &timers, context->queue_id);
+    context->mbufs = &mbufs;
 
-    // Task *send_udp_to_wan = new UDPSendTask(8080, wan_test_ip, 8080, &context->gateway_mac_addr, "UDPSend:" + wan_test_ip_str, context);
+    ARPTable arp("arp_table", &tx, &timers, &mbufs, &context->mac_addr, &context->ip_addr, rte_socket_id());
+    context->arp = &arp;
 
-    // bool has_created_tcp_task = false;
+    char fib_name[32];
+    snprintf(fib_name, sizeof(fib_name), "fib_%u", context->queue_id);
+    FIB fib(fib_name, rte_socket_id());
+    context->fib = &fib;
 
-    TCPServerTask *tcp_server = nullptr;
+    // 每隔`TASK_REAP_INTERVAL_US`清理一次已经结束的Task
+    bool reap_due = true;
+    Timer reap_timer([](Timer *, void *arg) { *static_cast<bool *>(arg) = true; }, &reap_due);
+
+    // TCP连接释放时累加到这里，也要在连接之前声明
+    TCPQueueStats tcp_stats;
+    memset(&tcp_stats, 0, sizeof(tcp_stats));
+    context->tcp_stats = &tcp_stats;
+
+    // Task析构时会取消自己的定时器、删除自己在`dispatcher`中的注册信息，
+    // 所以要在`dispatcher`、`timers`和`reap_timer`之后声明，保证先于它们析构
+    std::vector<UDPSocket *> udp_ring_sockets;
+    context->udp_ring_sockets = &udp_ring_sockets;
+    std::vector<std::unique_ptr<Task>> running_tasks;
+    ARPReplyTask *arp_reply = nullptr;   // 属于`running_tasks`，只用于最后打印统计信息
+    PingReplyTask *ping_reply = nullptr; // 同上
+    TCPEchoApplication echo_app;
+    UDPEchoApplication udp_echo_app;
+    ObjectPool<TCPConnectionTask> tcp_connections("tcp_connections", TCP_MAX_CONNECTIONS, rte_socket_id());
+    context->tcp_connections = &tcp_connections;
 
 #define NEW_TASK(__)                                            \
     {                                                           \
@@ -1089,6 +3090,11 @@ static void main_loop(Context *context)
         break;
         case Status::DHCP_START:
         {
+            // 没有mbuf时下一轮循环重试
+            struct rte_mbuf *pkt = context->mbufs->Alloc(MbufPriority::CRITICAL);
+            if (!pkt)
+                break;
+
             // 构造DHCP Options
             uint8_t *dhcp_options[128];
             int dhcp_options_n = 0;
@@ -1143,10 +3149,6 @@ static void main_loop(Context *context)
             // 设置END
             reinterpret_cast<uint8_t *>(dhcp)[dhcp_total_length - 1] = DHCP_OPT_END_CODE;
 
-            struct rte_mbuf *pkt = rte_pktmbuf_alloc(context->mbuf_pool);
-            if (!pkt)
-                rte_exit(EXIT_FAILURE, "Failed to alloc pkt\n");
-
             struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
             rte_ether_addr_copy(&context->mac_addr, &eth_hdr->src_addr);
             memset(&eth_hdr->dst_addr, 0xFF, sizeof(eth_hdr->dst_addr));
@@ -1182,8 +3184,8 @@ static void main_loop(Context *context)
             pkt->l4_len = sizeof(struct rte_udp_hdr);
             pkt->ol_flags |= (RTE_MBUF_F_TX_IPV4 | RTE_MBUF_F_TX_IP_CKSUM);
 
-            const uint16_t nb_tx = rte_eth_tx_burst(PORT, 0, &pkt, 1);
-            assert(nb_tx == 1);
+            context->tx->Send(pkt);
+            context->tx->Flush();
 
             // 释放内存
             for (int i = 0; i < dhcp_options_n; i++)
@@ -1200,7 +3202,8 @@ static void main_loop(Context *context)
         case Status::DHCP_DISCOVER_SENT:
         {
             struct rte_mbuf *bufs[MAX_PKT_BURST];
-            const uint16_t nb_rx = rte_eth_rx_burst(PORT, 0, bufs, MAX_PKT_BURST);
+            const uint16_t nb_rx = rte_eth_rx_burst(PORT, context->dhcp_context.poll_queue_id, bufs, MAX_PKT_BURST);
+            context->dhcp_context.poll_queue_id = (context->dhcp_context.poll_queue_id + 1) % context->nb_queues;
 
             if (unlikely(nb_rx == 0))
                 continue;
@@ -1223,6 +3226,7 @@ static void main_loop(Context *context)
                                 if (dhcp->op == DHCP_OP_BOOTREPLY && dhcp->magic_cookie == DHCP_MAGIC_COOKIE_BE)
                                 {
                                     context->ip_addr = dhcp->yiaddr;
+                                    context->dhcp_context.server_addr = dhcp->siaddr;
                                     printf("[DHCP] Got ip address %s from %s via DHCP\n", format_ipv4(context->ip_addr).c_str(), format_ipv4(dhcp->siaddr).c_str());
                                     // parse options
                                     for (int pos = 0;;)
@@ -1247,6 +3251,15 @@ static void main_loop(Context *context)
                                             context->broadcast_addr = *reinterpret_cast<rte_be32_t *>(option->value);
                                             printf("\t[DHCP] Got broadcast address %s\n", format_ipv4(context->broadcast_addr).c_str());
                                         }
+                                        if (option->code == DHCP_OPT_LEASE_TIME_CODE && option->len == DHCP_OPT_LEASE_TIME_LEN)
+                                        {
+                                            context->dhcp_context.lease_time = rte_be_to_cpu_32(*reinterpret_cast<rte_be32_t *>(option->value));
+                                            printf("\t[DHCP] Got lease time %u seconds\n", context->dhcp_context.lease_time);
+                                        }
+                                        if (option->code == DHCP_OPT_SERVER_ID_CODE && option->len == DHCP_OPT_SERVER_ID_LEN)
+                                        {
+                                            context->dhcp_context.server_addr = *reinterpret_cast<rte_be32_t *>(option->value);
+                                        }
                                         if (option->code == DHCP_OPT_DNS_SERVER_CODE && option->len > 0 && option->len % DHCP_OPT_DNS_SERVER_LEN_DIVISIBLE == 0)
                                         {
                                             context->dns_server_addr = *reinterpret_cast<rte_be32_t *>(option->value);
@@ -1254,13 +3267,8 @@ static void main_loop(Context *context)
                                         }
                                     }
 
-                                    NEW_TASK(new ARPReplyTask("ARPReply", context));
-                                    NEW_TASK(new PingReplyTask("PingReply", context));
-                                    // NEW_TASK(new UDPReceiveTask(8080, "UDP:8080", context));
-                                    // NEW_TASK(new ARPRequestTask(lan_test_ip, &context->lan_dst_mac_addr, "ARPRequest:" + lan_test_ip_str, context));
-                                    // NEW_TASK(new ARPRequestTask(context->gateway_addr, &context->gateway_mac_addr, "ARPRequest:gateway", context));
-                                    NEW_TASK(tcp_server = new TCPServerTask("TCPServer:8080", context, rte_cpu_to_be_16(8080)));
-                                    MOVE_STATUS_TO(MAIN_LOOP);
+                                    MOVE_STATUS_TO(SETUP_TASKS);
+                                    launch_workers(context);
                                 }
                             }
                         }
@@ -1268,69 +3276,95 @@ static void main_loop(Context *context)
                 }
 
                 rte_pktmbuf_free(pkt);
+                if (context->status != Status::DHCP_DISCOVER_SENT)
+                {
+                    // 已经拿到地址并启动了worker，同一批中剩下的包(可能还有重复的BOOTREPLY)不再处理
+                    rte_pktmbuf_free_bulk(&bufs[i + 1], nb_rx - i - 1);
+                    break;
+                }
+            }
+        }
+        break;
+        case Status::SETUP_TASKS:
+        {
+            arp_reply = new ARPReplyTask("ARPReply", context);
+            NEW_TASK(arp_reply);
+            ping_reply = new PingReplyTask("PingReply", context);
+            NEW_TASK(ping_reply);
+            NEW_TASK(new DHCPLeaseTask("DHCPLease", context));
+            // UDP echo：有应用lcore时每个应用lcore一个`UDPRing`，每个`UDPRing`一个`reuse_port`的Socket，由应用lcore回复；
+            // 否则在本lcore直接回复
+            if (nb_app_lcores > 0)
+            {
+                for (unsigned i = 0; i < nb_app_lcores; i++)
+                    NEW_TASK(new UDPSocket("UDP:" + std::to_string(UDP_ECHO_PORT) + "#" + std::to_string(i), context,
+                                           rte_cpu_to_be_16(UDP_ECHO_PORT), nullptr, udp_app_rings[i], true, true, true));
+            }
+            else
+            {
+                NEW_TASK(new UDPSocket("UDP:" + std::to_string(UDP_ECHO_PORT), context, rte_cpu_to_be_16(UDP_ECHO_PORT), &udp_echo_app));
             }
+            fib.AddConnected(context->ip_addr, context->netmask, context->gateway_addr, PORT);
+            for (const StaticRoute &route : std::initializer_list<StaticRoute> FIB_STATIC_ROUTES)
+                fib.AddStatic(route);
+            // 刚获得地址，由0号队列通知局域网；每个lcore都提前解析网关的MAC地址
+            if (context->queue_id == 0)
+                arp.Announce();
+            arp.Resolve(context->gateway_addr);
+            NEW_TASK(new TCPServerTask("TCPServer:8080", context, rte_cpu_to_be_16(8080), &echo_app, TCPCongestionControlType::CUBIC));
+            MOVE_STATUS_TO(MAIN_LOOP);
         }
         break;
         case Status::MAIN_LOOP:
         {
             struct rte_mbuf *bufs[MAX_PKT_BURST];
-            const uint16_t nb_rx = rte_eth_rx_burst(PORT, 0, bufs, MAX_PKT_BURST);
+            const uint16_t nb_rx = rte_eth_rx_burst(PORT, context->queue_id, bufs, MAX_PKT_BURST);
 
-            for (int i = 0; i < nb_rx; i++)
+            dispatcher.DispatchBurst(bufs, nb_rx);
+            // 其他lcore收到的ARP数据包，只用来更新ARP表
+            if (arp_rings[context->queue_id])
             {
-                struct rte_mbuf *pkt = bufs[i];
-                for (auto &&task : running_tasks)
+                const unsigned nb_arp = rte_ring_dequeue_burst(arp_rings[context->queue_id], (void **)bufs, MAX_PKT_BURST, nullptr);
+                for (unsigned i = 0; i < nb_arp; i++)
                 {
-                    if (task->TryProcess(pkt) == Task::ProcessResult::PROCESSED)
-                    {
-                        break;
-                    }
+                    arp.Input(rte_pktmbuf_mtod_offset(bufs[i], struct rte_arp_hdr *, sizeof(struct rte_ether_hdr)));
+                    rte_pktmbuf_free(bufs[i]);
                 }
-                rte_pktmbuf_free(pkt);
             }
 
-            for (auto it = running_tasks.begin(); it != running_tasks.end();)
-            {
-                if (!(*it)->IsAlive())
-                {
-                    printf("[TASK] task %s ended\n", (*it)->name.c_str());
-                    it = running_tasks.erase(it);
-                }
-                else
-                {
-                    it++;
-                }
-            }
+            // 应用lcore要发送的UDP数据报
+            for (UDPSocket *sock : udp_ring_sockets)
+                sock->PollRing();
 
-            for (auto &&task : running_tasks)
-            {
-                task->Tick();
-            }
+            // 这一批数据包产生的回复(ACK/Pong/ARP Reply等)一起发出去
+            if (nb_rx > 0)
+                tx.Flush();
 
-            // // 检查是否有`Task`的条件满足了
-            // if (send_udp_to_lan && !is_mac_addr_empty(&context->lan_dst_mac_addr))
-            // {
-            //     NEW_TASK(send_udp_to_lan);
-            //     send_udp_to_lan = nullptr;
-            // }
-
-            // if (send_udp_to_wan && !is_mac_addr_empty(&context->gateway_mac_addr))
-            // {
-            //     NEW_TASK(send_udp_to_wan);
-            //     send_udp_to_wan = nullptr;
-            // }
-
-            // if (!has_created_tcp_task && !is_mac_addr_empty(&context->lan_dst_mac_addr))
-            // {
-            //     NEW_TASK(new TCPConnectionTask("TCP:" + lan_test_ip_str, context, context->lan_dst_mac_addr, lan_test_ip, rte_cpu_to_be_16(8080), rte_cpu_to_be_16(rand() % 10000 + 1000)));
-            //     has_created_tcp_task = true;
-            // }
-
-            if (!tcp_server->estab_tcbs.empty())
+            // 只处理到期的定时器，不轮询所有的Task
+            const uint64_t now_tsc = rte_get_tsc_cycles();
+            timers.Advance(now_tsc);
+            // 释放这一轮中结束的连接
+            tcp_connections.Reap();
+            // 定时器中发送的数据包不会攒太久
+            tx.MaybeFlush(now_tsc);
+
+            if (reap_due)
             {
-                auto &tcb = tcp_server->estab_tcbs.front();
-                tcp_server->estab_tcbs.pop();
-                NEW_TASK(new TCPConnectionTask("TCPConnection", context, tcb));
+                reap_due = false;
+                timers.Schedule(&reap_timer, TASK_REAP_INTERVAL_US);
+                for (auto it = running_tasks.begin(); it != running_tasks.end();)
+                {
+                    if (!(*it)->IsAlive())
+                    {
+                        printf("[TASK] task %s ended\n", (*it)->name.c_str());
+                        dispatcher.Unbind(it->get());
+                        it = running_tasks.erase(it);
+                    }
+                    else
+                    {
+                        it++;
+                    }
+                }
             }
         }
         break;
@@ -1342,6 +3376,54 @@ static void main_loop(Context *context)
             rte_exit(EXIT_FAILURE, "Unknown status %d\n", static_cast<int>(context->status));
         }
     }
+
+    printf("[TCP] Queue %u: %u connections still open, %" PRIu64 " connections refused because the pool was full\n",
+           context->queue_id, tcp_connections.InUse(), tcp_connections.AllocFailed());
+    printf("[TCP] Queue %u: %" PRIu64 " connections released, sent %" PRIu64 " bytes in %" PRIu64 " segments, "
+           "retransmitted %" PRIu64 " bytes in %" PRIu64 " segments (%" PRIu64 " fast retransmits, %" PRIu64 " timeouts), "
+           "%" PRIu64 " TSO sends, received %" PRIu64 " bytes (%" PRIu64 " out-of-order segments), "
+           "%" PRIu64 " pure ACKs (%" PRIu64 " delayed)\n",
+           context->queue_id, tcp_stats.connections, tcp_stats.bytes_sent, tcp_stats.segs_sent,
+           tcp_stats.bytes_retransmitted, tcp_stats.segs_retransmitted, tcp_stats.fast_retransmits, tcp_stats.timeouts,
+           tcp_stats.tso_sends, tcp_stats.bytes_received, tcp_stats.ooo_segments, tcp_stats.acks_sent, tcp_stats.acks_delayed);
+
+    if (arp_reply)
+    {
+        const ARPReplyTask::Stats &arp_reply_stats = arp_reply->GetStats();
+        printf("[ARP] Queue %u: replied %" PRIu64 " in place, %" PRIu64 " with new mbufs, %" PRIu64 " failed\n",
+               context->queue_id, arp_reply_stats.replied_in_place, arp_reply_stats.replied, arp_reply_stats.alloc_failed);
+    }
+
+    if (ping_reply)
+    {
+        const PingReplyTask::Stats &ping_stats = ping_reply->GetStats();
+        printf("[PING] Queue %u: replied %" PRIu64 " in place, %" PRIu64 " with new mbufs, %" PRIu64 " failed\n",
+               context->queue_id, ping_stats.replied_in_place, ping_stats.replied, ping_stats.alloc_failed);
+    }
+
+    const ARPTable::Stats &arp_stats = arp.GetStats();
+    printf("[ARP] Queue %u: %u entries, %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " requests, %" PRIu64 " updates, "
+           "%" PRIu64 " failures, %" PRIu64 " packets dropped\n",
+           context->queue_id, arp.Size(), arp_stats.hits, arp_stats.misses, arp_stats.requests_sent, arp_stats.updates,
+           arp_stats.failures, arp_stats.pending_dropped);
+
+    fib.Dump(context->queue_id);
+
+    const Dispatcher::Stats &rx_stats = dispatcher.GetStats();
+    printf("[RX] Queue %u: %" PRIu64 " packets classified one by one, %" PRIu64 " dropped, "
+           "%" PRIu64 " bad IP checksums, %" PRIu64 " bad L4 checksums, %" PRIu64 " TCP segments merged\n",
+           context->queue_id, rx_stats.slow_path, rx_stats.dropped, rx_stats.bad_ip_cksum, rx_stats.bad_l4_cksum, rx_stats.gro_merged);
+
+    tx.Flush();
+    const TxBuffer::Stats &tx_stats = tx.GetStats();
+    printf("[TX] Queue %u: sent %" PRIu64 ", retried %" PRIu64 ", dropped %" PRIu64 ", GSO segments %" PRIu64 "\n",
+           context->queue_id, tx_stats.sent, tx_stats.retried, tx_stats.dropped, tx_stats.gso_segments);
+
+    const MbufAllocator::Stats &mbuf_stats = mbufs.GetStats();
+    printf("[MBUF] Queue %u: %s has %u of %u mbufs available; allocated %" PRIu64 " in %" PRIu64 " refills, "
+           "%" PRIu64 " failed, %" PRIu64 " dropped under pressure, %" PRIu64 " low-watermark events\n",
+           context->queue_id, context->mbuf_pool->name, rte_mempool_avail_count(context->mbuf_pool), context->mbuf_pool->size,
+           mbuf_stats.allocated, mbuf_stats.refills, mbuf_stats.failed, mbuf_stats.dropped, mbuf_stats.low_events);
 }
 
 int main(int argc, char **argv)
@@ -1359,25 +3441,65 @@ int main(int argc, char **argv)
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
 
-    struct rte_mempool *pktmbuf_pool = rte_pktmbuf_pool_create("mbuf_pool", 8192U,
-                                                               MEMPOOL_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE,
-                                                               rte_socket_id());
-    if (!pktmbuf_pool)
-        rte_exit(EXIT_FAILURE, "Cannot init mbuf pool\n");
+    // 最后`APP_LCORES`个lcore作为应用lcore，其余每个lcore负责一对RX/TX队列，队列数不能超过网卡支持的数量
+    struct rte_eth_dev_info dev_info;
+    if (rte_eth_dev_info_get(PORT, &dev_info) != 0)
+        rte_exit(EXIT_FAILURE, "Cannot get info of port %" PRIu16 "\n", PORT);
+    const unsigned nb_app = RTE_MIN((unsigned)APP_LCORES, rte_lcore_count() - 1);
+    uint16_t nb_queues = RTE_MIN(RTE_MIN(rte_lcore_count() - nb_app, (unsigned)MAX_QUEUES), RTE_MIN(dev_info.max_rx_queues, dev_info.max_tx_queues));
+    if (nb_queues + nb_app < rte_lcore_count())
+        printf("Only %u of %u lcores will be used\n", nb_queues + nb_app, rte_lcore_count());
+
+    uint16_t nb_lcores = 0;
+    queue_lcores[nb_lcores++] = rte_get_main_lcore();
+    unsigned lcore_id;
+    RTE_LCORE_FOREACH_WORKER(lcore_id)
+    {
+        if (nb_lcores < nb_queues)
+            queue_lcores[nb_lcores++] = lcore_id;
+        else if (nb_app_lcores < nb_app)
+            app_lcores[nb_app_lcores++] = lcore_id;
+    }
 
-    if (port_init(PORT, pktmbuf_pool) != 0)
+    if (port_init(PORT, nb_queues) != 0)
         rte_exit(EXIT_FAILURE, "Cannot init port %" PRIu16 "\n",
                  PORT);
 
     check_port_link_status(PORT);
 
+    // 只有一个队列时不需要转发ARP数据包
+    for (uint16_t queue_id = 0; nb_queues > 1 && queue_id < nb_queues; queue_id++)
+    {
+        char name[RTE_RING_NAMESIZE];
+        snprintf(name, sizeof(name), "arp_ring_%u", queue_id);
+        arp_rings[queue_id] = rte_ring_create(name, ARP_RING_SIZE, rte_socket_id(), RING_F_SC_DEQ);
+        if (!arp_rings[queue_id])
+            rte_exit(EXIT_FAILURE, "Cannot create %s\n", name);
+    }
+
+    // 应用lcore从启动开始就等待数据报，`UDPRing`在协议栈lcore创建`UDPSocket`之前创建好
+    for (unsigned i = 0; i < nb_app_lcores; i++)
+    {
+        udp_app_rings[i] = new UDPRing(UDP_ECHO_PORT, i, UDP_RING_SIZE, RING_F_SC_DEQ, rte_lcore_to_socket_id(app_lcores[i]));
+        ret = rte_eal_remote_launch(lcore_udp_app_loop, udp_app_rings[i], app_lcores[i]);
+        if (ret != 0)
+            rte_exit(EXIT_FAILURE, "Cannot launch lcore %u: %s\n", app_lcores[i], rte_strerror(-ret));
+    }
+
     Context context;
     memset(&context, 0, sizeof(context));
-    context.mbuf_pool = pktmbuf_pool;
+    context.mbuf_pool = queue_mbuf_pools[0];
+    context.queue_id = 0;
+    context.nb_queues = nb_queues;
     rte_eth_macaddr_get(PORT, &context.mac_addr);
 
     main_loop(&context);
 
+    // 等待所有worker lcore退出
+    rte_eal_mp_wait_lcore();
+    for (unsigned i = 0; i < nb_app_lcores; i++)
+        delete udp_app_rings[i];
+
     /* clean up the EAL */
     rte_eal_cleanup();
     printf("Bye...\n");
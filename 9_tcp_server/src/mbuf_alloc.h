@@ -0,0 +1,134 @@
+// mbuf分配器：每个lcore一个，所有要发送的新数据包都从这里分配。用`rte_pktmbuf_alloc_bulk`一次从mbuf池取`MBUF_ALLOC_BULK`个mbuf
+// 放在本地，之后的分配直接从本地取。mbuf池用完时不再退出程序，而是按照数据包的重要程度降级：
+// - CRITICAL：TCP报文段、DHCP、ARP请求，只要池中还有mbuf就分配，失败时由调用者稍后重试(TCP靠重传定时器)
+// - NORMAL：Ping回复、ARP回复、UDP、TCP发送队列中的新数据，池中剩余低于`MBUF_LOW_WATERMARK_PERCENT`时直接失败并计数，
+//   把剩下的mbuf留给CRITICAL；此时TCP暂停接收应用的数据，并且不再扩大通告的接收窗口(`UnderPressure`)
+// 低于水位线时输出告警，恢复到两倍水位线以上时解除。每次从池中取一批mbuf以及每隔`MBUF_CHECK_US`检查一次池中的剩余。
+
+#ifndef __MBUF_ALLOC_H__
+#define __MBUF_ALLOC_H__
+
+#include "configs.h"
+#include "timer_wheel.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+
+enum class MbufPriority
+{
+    CRITICAL, // 池中还有mbuf就分配
+    NORMAL,   // 低于水位线时失败
+};
+
+class MbufAllocator
+{
+public:
+    struct Stats
+    {
+        uint64_t allocated;
+        uint64_t refills;    // 从池中批量取mbuf的次数
+        uint64_t failed;     // 池中没有mbuf，分配失败
+        uint64_t dropped;    // 低于水位线时拒绝的NORMAL分配
+        uint64_t low_events; // 进入低水位的次数
+    };
+
+private:
+    struct rte_mempool *pool;
+    TimerWheel *timers;
+    uint16_t queue_id;
+
+    struct rte_mbuf *cache[MBUF_ALLOC_BULK];
+    uint32_t nb_cached;
+
+    uint32_t low_watermark;  // 池中剩余低于它时进入低水位
+    uint32_t high_watermark; // 恢复到它以上时解除
+    bool under_pressure;
+    Timer check_timer;
+
+    Stats stats;
+
+public:
+    MbufAllocator(struct rte_mempool *pool, TimerWheel *timers, uint16_t queue_id)
+        : pool(pool), timers(timers), queue_id(queue_id), nb_cached(0), under_pressure(false), check_timer(OnCheckTimer, this)
+    {
+        low_watermark = pool->size * MBUF_LOW_WATERMARK_PERCENT / 100;
+        high_watermark = low_watermark * 2;
+        memset(&stats, 0, sizeof(stats));
+        timers->Schedule(&check_timer, MBUF_CHECK_US);
+    }
+
+    ~MbufAllocator()
+    {
+        timers->Cancel(&check_timer);
+        if (nb_cached)
+            rte_pktmbuf_free_bulk(cache, nb_cached);
+    }
+
+    MbufAllocator(const MbufAllocator &) = delete;
+    MbufAllocator &operator=(const MbufAllocator &) = delete;
+
+    // 分配一个mbuf，失败时返回nullptr(已经计数)
+    struct rte_mbuf *Alloc(MbufPriority priority = MbufPriority::CRITICAL)
+    {
+        if (priority == MbufPriority::NORMAL && unlikely(under_pressure))
+        {
+            stats.dropped++;
+            return nullptr;
+        }
+        if (unlikely(nb_cached == 0) && !Refill())
+        {
+            stats.failed++;
+            return nullptr;
+        }
+        stats.allocated++;
+        return cache[--nb_cached];
+    }
+
+    // mbuf池快用完了，应该减少新的数据
+    bool UnderPressure() const { return under_pressure; }
+
+    const Stats &GetStats() const { return stats; }
+    struct rte_mempool *Pool() const { return pool; }
+
+private:
+    bool Refill()
+    {
+        stats.refills++;
+        if (rte_pktmbuf_alloc_bulk(pool, cache, MBUF_ALLOC_BULK) == 0)
+            nb_cached = MBUF_ALLOC_BULK;
+        else if ((cache[0] = rte_pktmbuf_alloc(pool)) != nullptr)
+            nb_cached = 1; // 池中不够一批，只取一个
+        CheckWatermark();
+        return nb_cached > 0;
+    }
+
+    void CheckWatermark()
+    {
+        const uint32_t avail = rte_mempool_avail_count(pool);
+        if (!under_pressure && avail < low_watermark)
+        {
+            under_pressure = true;
+            stats.low_events++;
+            printf("[MBUF] Queue %u: %s is running low (%u of %u mbufs available), throttling\n",
+                   queue_id, pool->name, avail, pool->size);
+        }
+        else if (under_pressure && avail >= high_watermark)
+        {
+            under_pressure = false;
+            printf("[MBUF] Queue %u: %s recovered (%u of %u mbufs available)\n", queue_id, pool->name, avail, pool->size);
+        }
+    }
+
+    static void OnCheckTimer(Timer *timer, void *arg)
+    {
+        MbufAllocator *self = static_cast<MbufAllocator *>(arg);
+        self->CheckWatermark();
+        self->timers->Schedule(timer, MBUF_CHECK_US);
+    }
+};
+
+#endif // __MBUF_ALLOC_H__
@@ -0,0 +1,105 @@
+// 对象池：启动时一次性分配好固定数量的对象的空间(每个对象按cache line对齐)，之后分配/释放都不会调用malloc。
+// 对象在自己的成员函数中不能直接释放自己，需要先`Retire`，由主循环在安全的时候调用`Reap`统一释放。
+
+#ifndef __OBJECT_POOL_H__
+#define __OBJECT_POOL_H__
+
+#include <cstdint>
+#include <new>
+#include <utility>
+
+#include <rte_common.h>
+#include <rte_debug.h>
+#include <rte_malloc.h>
+
+template <typename T>
+class ObjectPool
+{
+    uint8_t *storage;
+    size_t stride; // 每个对象占用的空间，按cache line对齐
+    uint32_t capacity;
+
+    uint32_t *free_list; // 空闲对象的下标，当作栈使用，最近释放的对象还在cache中，优先复用
+    uint32_t nb_free;
+    bool *in_use;
+
+    T **retired; // 等待`Reap`释放的对象
+    uint32_t nb_retired;
+
+    uint64_t nb_alloc_failed; // 对象用完导致分配失败的次数
+
+public:
+    ObjectPool(const char *name, uint32_t capacity, int socket_id) : capacity(capacity), nb_retired(0), nb_alloc_failed(0)
+    {
+        stride = RTE_ALIGN_CEIL(sizeof(T), RTE_CACHE_LINE_SIZE);
+        storage = (uint8_t *)rte_zmalloc_socket(name, stride * capacity, RTE_CACHE_LINE_SIZE, socket_id);
+        free_list = (uint32_t *)rte_malloc_socket(name, sizeof(uint32_t) * capacity, 0, socket_id);
+        in_use = (bool *)rte_zmalloc_socket(name, sizeof(bool) * capacity, 0, socket_id);
+        retired = (T **)rte_malloc_socket(name, sizeof(T *) * capacity, 0, socket_id);
+        if (!storage || !free_list || !in_use || !retired)
+            rte_exit(EXIT_FAILURE, "Cannot allocate object pool %s\n", name);
+        for (uint32_t i = 0; i < capacity; i++)
+            free_list[i] = capacity - 1 - i;
+        nb_free = capacity;
+    }
+
+    // 还在使用中的对象也会被析构
+    ~ObjectPool()
+    {
+        for (uint32_t i = 0; i < capacity; i++)
+        {
+            if (in_use[i])
+                At(i)->~T();
+        }
+        rte_free(storage);
+        rte_free(free_list);
+        rte_free(in_use);
+        rte_free(retired);
+    }
+
+    ObjectPool(const ObjectPool &) = delete;
+    ObjectPool &operator=(const ObjectPool &) = delete;
+
+    // 分配并构造一个对象，对象用完时返回nullptr
+    template <typename... Args>
+    T *Alloc(Args &&...args)
+    {
+        if (unlikely(nb_free == 0))
+        {
+            nb_alloc_failed++;
+            return nullptr;
+        }
+        const uint32_t i = free_list[--nb_free];
+        in_use[i] = true;
+        return new (At(i)) T(std::forward<Args>(args)...);
+    }
+
+    // 析构并释放一个对象
+    void Free(T *object)
+    {
+        const uint32_t i = ((uint8_t *)object - storage) / stride;
+        object->~T();
+        in_use[i] = false;
+        free_list[nb_free++] = i;
+    }
+
+    // 标记一个对象在下一次`Reap`时释放，同一个对象只能`Retire`一次
+    void Retire(T *object) { retired[nb_retired++] = object; }
+
+    // 释放所有`Retire`过的对象
+    void Reap()
+    {
+        for (uint32_t i = 0; i < nb_retired; i++)
+            Free(retired[i]);
+        nb_retired = 0;
+    }
+
+    uint32_t Capacity() const { return capacity; }
+    uint32_t InUse() const { return capacity - nb_free; }
+    uint64_t AllocFailed() const { return nb_alloc_failed; }
+
+private:
+    T *At(uint32_t i) { return (T *)(storage + stride * i); }
+};
+
+#endif // __OBJECT_POOL_H__
@@ -0,0 +1,243 @@
+// 数据包解析：每个收到的数据包只解析一次，解析结果保存在`PacketInfo`中供后续分发和处理使用
+
+#ifndef __PACKET_H__
+#define __PACKET_H__
+
+#include "checksum.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include <rte_mbuf.h>
+#include <rte_ether.h>
+#include <rte_arp.h>
+#include <rte_ip.h>
+#include <rte_icmp.h>
+#include <rte_udp.h>
+#include <rte_tcp.h>
+
+// 数据包的大类，决定了数据包由哪一类Task处理
+enum class PacketClass : uint8_t
+{
+    UNKNOWN = 0, // 不认识或者格式错误的数据包，直接丢弃
+    ARP,
+    ICMP,
+    UDP,
+    TCP,
+};
+
+// 数据包描述符
+struct PacketInfo
+{
+    PacketClass cls;
+
+    uint16_t ether_type; // 主机序
+    uint8_t proto;       // IPv4 next_proto_id，非IPv4时为0
+
+    // 五元组(网络序)，ARP时src_ip/dst_ip为sender/target IP
+    rte_be32_t src_ip;
+    rte_be32_t dst_ip;
+    rte_be16_t src_port;
+    rte_be16_t dst_port;
+
+    struct rte_ether_hdr *eth_hdr;
+    struct rte_ipv4_hdr *ip_hdr; // 非IPv4时为nullptr
+    void *l4_hdr;                // ARP时指向`rte_arp_hdr`
+
+    uint8_t *payload; // L4负载
+    uint32_t payload_length;
+};
+
+// 解析ARP包头，`info`中的其他字段由调用者填写
+static inline PacketClass ParseARP(struct rte_ether_hdr *eth_hdr, uint32_t data_len, PacketInfo *info)
+{
+    if (unlikely(data_len < sizeof(struct rte_ether_hdr) + sizeof(struct rte_arp_hdr)))
+        return info->cls;
+    struct rte_arp_hdr *arp_hdr = (struct rte_arp_hdr *)(eth_hdr + 1);
+    if (rte_be_to_cpu_16(arp_hdr->arp_hardware) != RTE_ARP_HRD_ETHER || rte_be_to_cpu_16(arp_hdr->arp_protocol) != RTE_ETHER_TYPE_IPV4)
+        return info->cls;
+    info->l4_hdr = arp_hdr;
+    info->src_ip = arp_hdr->arp_data.arp_sip;
+    info->dst_ip = arp_hdr->arp_data.arp_tip;
+    return info->cls = PacketClass::ARP;
+}
+
+// 解析IPv4负载中协议为`proto`的L4包头，IPv4包头已经检查过，`l4_length`为IPv4负载的长度
+static inline PacketClass ParseL4(uint8_t proto, uint8_t *l4, uint32_t l4_length, PacketInfo *info)
+{
+    info->l4_hdr = l4;
+    switch (proto)
+    {
+    case IPPROTO_ICMP:
+    {
+        if (unlikely(l4_length < sizeof(struct rte_icmp_hdr)))
+            return info->cls;
+        info->payload = l4 + sizeof(struct rte_icmp_hdr);
+        info->payload_length = l4_length - sizeof(struct rte_icmp_hdr);
+        return info->cls = PacketClass::ICMP;
+    }
+    case IPPROTO_UDP:
+    {
+        if (unlikely(l4_length < sizeof(struct rte_udp_hdr)))
+            return info->cls;
+        struct rte_udp_hdr *udp_hdr = (struct rte_udp_hdr *)l4;
+        const uint32_t dgram_len = rte_be_to_cpu_16(udp_hdr->dgram_len);
+        if (unlikely(dgram_len < sizeof(struct rte_udp_hdr) || dgram_len > l4_length))
+            return info->cls;
+        info->src_port = udp_hdr->src_port;
+        info->dst_port = udp_hdr->dst_port;
+        info->payload = l4 + sizeof(struct rte_udp_hdr);
+        info->payload_length = dgram_len - sizeof(struct rte_udp_hdr);
+        return info->cls = PacketClass::UDP;
+    }
+    case IPPROTO_TCP:
+    {
+        if (unlikely(l4_length < sizeof(struct rte_tcp_hdr)))
+            return info->cls;
+        struct rte_tcp_hdr *tcp_hdr = (struct rte_tcp_hdr *)l4;
+        const uint32_t tcp_hdr_len = (uint32_t)(tcp_hdr->data_off >> 4) * 4;
+        if (unlikely(tcp_hdr_len < sizeof(struct rte_tcp_hdr) || tcp_hdr_len > l4_length))
+            return info->cls;
+        info->src_port = tcp_hdr->src_port;
+        info->dst_port = tcp_hdr->dst_port;
+        info->payload = l4 + tcp_hdr_len;
+        info->payload_length = l4_length - tcp_hdr_len;
+        return info->cls = PacketClass::TCP;
+    }
+    default:
+        return info->cls;
+    }
+}
+
+// 解析数据包的各层包头，填充`info`，返回数据包的大类
+// 只解析第一个segment，包头不完整的数据包被认为是`UNKNOWN`
+static inline PacketClass ClassifyPacket(struct rte_mbuf *pkt, PacketInfo *info)
+{
+    memset(info, 0, sizeof(*info));
+    info->cls = PacketClass::UNKNOWN;
+
+    const uint32_t data_len = rte_pktmbuf_data_len(pkt);
+    if (unlikely(data_len < sizeof(struct rte_ether_hdr)))
+        return info->cls;
+
+    struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
+    info->eth_hdr = eth_hdr;
+    info->ether_type = rte_be_to_cpu_16(eth_hdr->ether_type);
+
+    if (info->ether_type == RTE_ETHER_TYPE_ARP)
+        return ParseARP(eth_hdr, data_len, info);
+
+    if (info->ether_type != RTE_ETHER_TYPE_IPV4)
+        return info->cls;
+    if (unlikely(data_len < sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr)))
+        return info->cls;
+
+    struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
+    const uint32_t ip_hdr_len = (ip_hdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+    const uint32_t ip_total_length = rte_be_to_cpu_16(ip_hdr->total_length);
+    if (unlikely(ip_hdr_len < sizeof(struct rte_ipv4_hdr) || ip_total_length < ip_hdr_len ||
+                 sizeof(struct rte_ether_hdr) + ip_total_length > rte_pktmbuf_pkt_len(pkt)))
+        return info->cls;
+
+    info->ip_hdr = ip_hdr;
+    info->proto = ip_hdr->next_proto_id;
+    info->src_ip = ip_hdr->src_addr;
+    info->dst_ip = ip_hdr->dst_addr;
+    return ParseL4(info->proto, (uint8_t *)ip_hdr + ip_hdr_len, ip_total_length - ip_hdr_len, info);
+}
+
+// `PacketClassifier`已经判断出类别为`CLS`的数据包：以太网类型、IPv4版本和包头长度(没有Option)、目的IP、协议号和目的端口都检查过了，
+// 这里不再重复这些判断，只检查长度并填写`info`。结果和`ClassifyPacket`相同，格式错误时返回`UNKNOWN`。
+// 类别是模板参数，同一类的数据包放在一起连续解析时没有按照类别的分支
+template <PacketClass CLS>
+static inline PacketClass ParseClassified(struct rte_mbuf *pkt, PacketInfo *info)
+{
+    static_assert(CLS != PacketClass::UNKNOWN, "nothing to parse");
+    memset(info, 0, sizeof(*info));
+    info->cls = PacketClass::UNKNOWN;
+
+    const uint32_t data_len = rte_pktmbuf_data_len(pkt);
+    struct rte_ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
+    info->eth_hdr = eth_hdr;
+    if (CLS == PacketClass::ARP)
+    {
+        info->ether_type = RTE_ETHER_TYPE_ARP;
+        return ParseARP(eth_hdr, data_len, info);
+    }
+
+    if (unlikely(data_len < sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr)))
+        return info->cls;
+    struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
+    const uint32_t ip_total_length = rte_be_to_cpu_16(ip_hdr->total_length);
+    if (unlikely(ip_total_length < sizeof(struct rte_ipv4_hdr) || sizeof(struct rte_ether_hdr) + ip_total_length > rte_pktmbuf_pkt_len(pkt)))
+        return info->cls;
+
+    constexpr uint8_t proto = CLS == PacketClass::ICMP ? IPPROTO_ICMP : CLS == PacketClass::UDP ? IPPROTO_UDP : IPPROTO_TCP;
+    info->ether_type = RTE_ETHER_TYPE_IPV4;
+    info->ip_hdr = ip_hdr;
+    info->proto = proto;
+    info->src_ip = ip_hdr->src_addr;
+    info->dst_ip = ip_hdr->dst_addr;
+    return ParseL4(proto, (uint8_t *)(ip_hdr + 1), ip_total_length - sizeof(struct rte_ipv4_hdr), info);
+}
+
+// 检查IPv4包头的checksum。网卡检查过的直接使用`ol_flags`中的结果，网卡没有检查(不支持或者没有开启)时用软件计算。
+// `info`必须是`ClassifyPacket`解析成功的IPv4数据包
+static inline bool VerifyIPv4Checksum(const struct rte_mbuf *pkt, const PacketInfo &info)
+{
+    switch (pkt->ol_flags & RTE_MBUF_F_RX_IP_CKSUM_MASK)
+    {
+    case RTE_MBUF_F_RX_IP_CKSUM_GOOD:
+    case RTE_MBUF_F_RX_IP_CKSUM_NONE: // 包头完整性已经检查过，只是包中的checksum字段没有填写(例如virtio)
+        return true;
+    case RTE_MBUF_F_RX_IP_CKSUM_BAD:
+        return false;
+    default:
+    {
+        const uint32_t ip_hdr_len = (uint8_t *)info.l4_hdr - (uint8_t *)info.ip_hdr;
+        return Checksum::Raw(info.ip_hdr, ip_hdr_len) == 0xFFFF;
+    }
+    }
+}
+
+// 检查TCP/UDP/ICMP的checksum，规则和`VerifyIPv4Checksum`相同。ICMP网卡不检查，总是用软件计算。
+// `software`为false时网卡没有检查的数据包直接认为正确，不用软件计算
+static inline bool VerifyL4Checksum(const struct rte_mbuf *pkt, const PacketInfo &info, bool software = true)
+{
+    if (info.cls != PacketClass::ICMP)
+    {
+        switch (pkt->ol_flags & RTE_MBUF_F_RX_L4_CKSUM_MASK)
+        {
+        case RTE_MBUF_F_RX_L4_CKSUM_GOOD:
+        case RTE_MBUF_F_RX_L4_CKSUM_NONE:
+            return true;
+        case RTE_MBUF_F_RX_L4_CKSUM_BAD:
+            return false;
+        default:
+            if (!software)
+                return true;
+            break;
+        }
+    }
+
+    const uint16_t l4_offset = (uint8_t *)info.l4_hdr - rte_pktmbuf_mtod(pkt, uint8_t *);
+    switch (info.cls)
+    {
+    case PacketClass::UDP:
+        // IPv4中UDP的checksum可以为0，表示没有计算
+        if (((const struct rte_udp_hdr *)info.l4_hdr)->dgram_cksum == 0)
+            return true;
+        /* fall through */
+    case PacketClass::TCP:
+        return Checksum::VerifyIPv4L4(pkt, info.ip_hdr, l4_offset);
+    case PacketClass::ICMP:
+    {
+        const uint32_t l4_length = rte_be_to_cpu_16(info.ip_hdr->total_length) - ((uint8_t *)info.l4_hdr - (uint8_t *)info.ip_hdr);
+        return Checksum::RawMbuf(pkt, l4_offset, l4_length) == 0xFFFF;
+    }
+    default:
+        return true;
+    }
+}
+
+#endif // __PACKET_H__
@@ -0,0 +1,138 @@
+// 发送数据包的包头模板：以太网+IPv4+TCP/UDP/ICMP包头预先构造好放在64字节中，发送时用一次64字节的复制(`rte_mov64`)写到mbuf开头，
+// 之后只修改长度、序列号、窗口等每个数据包不同的字段，不需要每次memset再逐个字段填写。
+// TCP连接和`UDPSendTask`在创建时构造一次自己的模板；没有固定对端的报文(SYN cookie的SYN,ACK、Ping回复)临时构造一个。
+// 以太网头中的目的MAC由ARP表在发送时填写。
+
+#ifndef __PACKET_TEMPLATE_H__
+#define __PACKET_TEMPLATE_H__
+
+#include "configs.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include <rte_byteorder.h>
+#include <rte_ether.h>
+#include <rte_icmp.h>
+#include <rte_ip.h>
+#include <rte_mbuf.h>
+#include <rte_memcpy.h>
+#include <rte_tcp.h>
+#include <rte_udp.h>
+
+#define PACKET_TEMPLATE_SIZE 64 // 以太网+IPv4+TCP共54字节，剩下的部分为0
+
+class PacketTemplate
+{
+    alignas(PACKET_TEMPLATE_SIZE) uint8_t hdr[PACKET_TEMPLATE_SIZE];
+    uint8_t proto;
+    uint8_t l4_len; // 不带Option的L4包头长度
+
+public:
+    static constexpr uint32_t L2_LEN = sizeof(struct rte_ether_hdr);
+    static constexpr uint32_t L3_LEN = sizeof(struct rte_ipv4_hdr);
+
+    PacketTemplate() : proto(0), l4_len(0) { memset(hdr, 0, sizeof(hdr)); }
+
+    // 构造模板，端口为网络序(ICMP不使用)。TCP数据包设置DF，TCP自己保证不超过MSS
+    void Init(uint8_t proto, const struct rte_ether_addr &src_mac, rte_be32_t src_ip, rte_be32_t dst_ip,
+              rte_be16_t src_port = 0, rte_be16_t dst_port = 0)
+    {
+        static_assert(sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_tcp_hdr) <= PACKET_TEMPLATE_SIZE,
+                      "TCP headers do not fit in the template");
+        memset(hdr, 0, sizeof(hdr));
+        this->proto = proto;
+
+        struct rte_ether_hdr *eth_hdr = (struct rte_ether_hdr *)hdr;
+        rte_ether_addr_copy(&src_mac, &eth_hdr->src_addr);
+        eth_hdr->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+
+        struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *)(eth_hdr + 1);
+        ip_hdr->version_ihl = IP_VHL_DEF;
+        ip_hdr->time_to_live = IP_DEFTTL;
+        ip_hdr->fragment_offset = proto == IPPROTO_TCP ? rte_cpu_to_be_16(RTE_IPV4_HDR_DF_FLAG) : 0;
+        ip_hdr->next_proto_id = proto;
+        ip_hdr->src_addr = src_ip;
+        ip_hdr->dst_addr = dst_ip;
+
+        switch (proto)
+        {
+        case IPPROTO_TCP:
+        {
+            struct rte_tcp_hdr *tcp_hdr = (struct rte_tcp_hdr *)(ip_hdr + 1);
+            tcp_hdr->src_port = src_port;
+            tcp_hdr->dst_port = dst_port;
+            tcp_hdr->data_off = (sizeof(*tcp_hdr) / 4) << 4;
+            l4_len = sizeof(*tcp_hdr);
+        }
+        break;
+        case IPPROTO_UDP:
+        {
+            struct rte_udp_hdr *udp_hdr = (struct rte_udp_hdr *)(ip_hdr + 1);
+            udp_hdr->src_port = src_port;
+            udp_hdr->dst_port = dst_port;
+            l4_len = sizeof(*udp_hdr);
+        }
+        break;
+        default:
+            l4_len = sizeof(struct rte_icmp_hdr);
+            break;
+        }
+    }
+
+    // 不带Option的包头总长度
+    uint32_t HeaderLength() const { return L2_LEN + L3_LEN + l4_len; }
+
+    // 把模板写到新分配的`pkt`开头，`opt_len`为L4 Option的长度(TCP，4字节对齐，调用者填写)，
+    // `payload_length`为接在包头后面、同一个mbuf中的负载长度。
+    // 填写IPv4总长度、UDP长度，以及mbuf的长度和checksum offload信息，返回IPv4包头，L4包头紧跟在后面
+    struct rte_ipv4_hdr *Apply(struct rte_mbuf *pkt, uint32_t opt_len, uint32_t payload_length) const
+    {
+        uint8_t *data = rte_pktmbuf_mtod(pkt, uint8_t *);
+        rte_mov64(data, hdr);
+        pkt->data_len = pkt->pkt_len = HeaderLength() + opt_len + payload_length;
+        return Fill(pkt, data, opt_len, payload_length);
+    }
+
+    // `pkt`开头已经留出了`HeaderLength()`字节的包头空间，后面(可能是mbuf链)都是负载：只复制包头本身，不覆盖负载，
+    // mbuf的长度不变。用于应用直接把数据写在mbuf中发送的UDP，其他和`Apply`相同
+    struct rte_ipv4_hdr *ApplyInPlace(struct rte_mbuf *pkt) const
+    {
+        uint8_t *data = rte_pktmbuf_mtod(pkt, uint8_t *);
+        rte_memcpy(data, hdr, HeaderLength());
+        return Fill(pkt, data, 0, pkt->pkt_len - HeaderLength());
+    }
+
+private:
+    struct rte_ipv4_hdr *Fill(struct rte_mbuf *pkt, uint8_t *data, uint32_t opt_len, uint32_t payload_length) const
+    {
+        const uint32_t l4_total = l4_len + opt_len;
+        struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *)(data + L2_LEN);
+        ip_hdr->total_length = rte_cpu_to_be_16(L3_LEN + l4_total + payload_length);
+
+        pkt->l2_len = L2_LEN;
+        pkt->l3_len = L3_LEN;
+        pkt->l4_len = l4_total; // TSO时网卡按照它复制包头
+        pkt->ol_flags |= RTE_MBUF_F_TX_IPV4 | RTE_MBUF_F_TX_IP_CKSUM;
+        switch (proto)
+        {
+        case IPPROTO_TCP:
+            pkt->packet_type = RTE_PTYPE_L2_ETHER | RTE_PTYPE_L3_IPV4 | RTE_PTYPE_L4_TCP;
+            pkt->ol_flags |= RTE_MBUF_F_TX_TCP_CKSUM;
+            ((struct rte_tcp_hdr *)(ip_hdr + 1))->data_off = (l4_total / 4) << 4;
+            break;
+        case IPPROTO_UDP:
+            pkt->packet_type = RTE_PTYPE_L2_ETHER | RTE_PTYPE_L3_IPV4 | RTE_PTYPE_L4_UDP;
+            pkt->ol_flags |= RTE_MBUF_F_TX_UDP_CKSUM;
+            ((struct rte_udp_hdr *)(ip_hdr + 1))->dgram_len = rte_cpu_to_be_16(l4_total + payload_length);
+            break;
+        default:
+            // ICMP的checksum由调用者用软件计算
+            pkt->packet_type = RTE_PTYPE_L2_ETHER | RTE_PTYPE_L3_IPV4 | RTE_PTYPE_L4_ICMP;
+            break;
+        }
+        return ip_hdr;
+    }
+};
+
+#endif // __PACKET_TEMPLATE_H__
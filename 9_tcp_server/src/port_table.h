@@ -0,0 +1,161 @@
+// 监听端口表：按照(proto, local port)查找监听的Task，TCP和UDP各一个65536项的直接索引表，查找只需要两次数组访问，和绑定的端口数无关。
+// 索引表中只放16位的下标，指向紧凑的端口组数组，每个lcore的索引表共256KB，端口组数组的大小由`PORT_TABLE_MAX_PORTS`决定。
+// 一个端口组最多有`PORT_REUSE_MAX`个成员(类似SO_REUSEPORT，所有成员绑定时都要允许共享)，数据包按照对端地址的哈希选择成员，
+// 同一个对端的数据包总是交给同一个成员。绑定端口0表示通配：这个协议没有被绑定的端口的数据包都交给它。
+
+#ifndef __PORT_TABLE_H__
+#define __PORT_TABLE_H__
+
+#include "configs.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include <netinet/in.h>
+
+#include <rte_byteorder.h>
+#include <rte_common.h>
+#include <rte_debug.h>
+#include <rte_malloc.h>
+
+template <typename T>
+class PortTable
+{
+public:
+    struct Group
+    {
+        T *members[PORT_REUSE_MAX];
+        uint8_t nb_members; // 为0表示空闲
+        bool reuse_port;
+        bool verify_l4_cksum; // 有一个成员需要时就校验
+    };
+
+private:
+    static constexpr uint32_t NB_PORTS = 65536;
+    static constexpr uint16_t NONE = 0; // 索引表中的0表示没有绑定，其他值是组的下标加1
+
+    uint16_t *tcp_index;
+    uint16_t *udp_index;
+    Group *groups;
+    uint16_t *free_groups; // 空闲的组(栈)
+    uint32_t nb_free;
+
+public:
+    PortTable(const char *name, int socket_id)
+    {
+        static_assert(PORT_TABLE_MAX_PORTS < UINT16_MAX, "group index must fit in the 16-bit port index");
+        tcp_index = (uint16_t *)rte_zmalloc_socket(name, sizeof(uint16_t) * NB_PORTS, RTE_CACHE_LINE_SIZE, socket_id);
+        udp_index = (uint16_t *)rte_zmalloc_socket(name, sizeof(uint16_t) * NB_PORTS, RTE_CACHE_LINE_SIZE, socket_id);
+        groups = (Group *)rte_zmalloc_socket(name, sizeof(Group) * PORT_TABLE_MAX_PORTS, RTE_CACHE_LINE_SIZE, socket_id);
+        free_groups = (uint16_t *)rte_malloc_socket(name, sizeof(uint16_t) * PORT_TABLE_MAX_PORTS, 0, socket_id);
+        if (!tcp_index || !udp_index || !groups || !free_groups)
+            rte_exit(EXIT_FAILURE, "Cannot allocate port table %s\n", name);
+        for (nb_free = 0; nb_free < PORT_TABLE_MAX_PORTS; nb_free++)
+            free_groups[nb_free] = PORT_TABLE_MAX_PORTS - 1 - nb_free;
+    }
+
+    ~PortTable()
+    {
+        rte_free(tcp_index);
+        rte_free(udp_index);
+        rte_free(groups);
+        rte_free(free_groups);
+    }
+
+    PortTable(const PortTable &) = delete;
+    PortTable &operator=(const PortTable &) = delete;
+
+    // 绑定`proto`的`local_port`(网络序，0表示通配)。端口已经被绑定时，只有已有的成员和`value`都允许共享、组还没有满才能加入
+    bool Insert(uint8_t proto, rte_be16_t local_port, T *value, bool reuse_port, bool verify_l4_cksum)
+    {
+        uint16_t *index = Index(proto);
+        if (!index)
+            return false;
+        const uint16_t port = rte_be_to_cpu_16(local_port);
+        Group *group;
+        if (index[port] == NONE)
+        {
+            if (nb_free == 0)
+                return false;
+            const uint16_t g = free_groups[--nb_free];
+            group = &groups[g];
+            group->reuse_port = reuse_port;
+            group->verify_l4_cksum = false;
+            index[port] = g + 1;
+        }
+        else
+        {
+            group = &groups[index[port] - 1];
+            if (!group->reuse_port || !reuse_port || group->nb_members >= PORT_REUSE_MAX)
+                return false;
+        }
+        group->members[group->nb_members++] = value;
+        group->verify_l4_cksum |= verify_l4_cksum;
+        return true;
+    }
+
+    // 把`value`从端口组中删除，组中没有成员之后释放端口
+    void Remove(uint8_t proto, rte_be16_t local_port, T *value)
+    {
+        uint16_t *index = Index(proto);
+        const uint16_t port = rte_be_to_cpu_16(local_port);
+        if (!index || index[port] == NONE)
+            return;
+        const uint16_t g = index[port] - 1;
+        Group *group = &groups[g];
+        for (uint8_t i = 0; i < group->nb_members; i++)
+        {
+            if (group->members[i] == value)
+            {
+                // 保持其余成员的顺序，同一个对端尽量还选择原来的成员
+                memmove(&group->members[i], &group->members[i + 1], sizeof(T *) * (group->nb_members - i - 1));
+                group->nb_members--;
+                break;
+            }
+        }
+        if (group->nb_members == 0)
+        {
+            memset(group, 0, sizeof(*group));
+            index[port] = NONE;
+            free_groups[nb_free++] = g;
+        }
+    }
+
+    // 查找`local_port`的端口组，没有绑定时使用通配的组，都没有时返回nullptr
+    const Group *Lookup(uint8_t proto, rte_be16_t local_port) const
+    {
+        const uint16_t *index = Index(proto);
+        if (unlikely(!index))
+            return nullptr;
+        uint16_t g = index[rte_be_to_cpu_16(local_port)];
+        if (g == NONE)
+            g = index[0];
+        return g == NONE ? nullptr : &groups[g - 1];
+    }
+
+    // 按照对端地址的哈希选择端口组中的成员
+    static T *Select(const Group *group, uint32_t hash)
+    {
+        if (likely(group->nb_members == 1))
+            return group->members[0];
+        return group->members[((uint64_t)hash * group->nb_members) >> 32];
+    }
+
+    uint32_t Size() const { return PORT_TABLE_MAX_PORTS - nb_free; }
+
+private:
+    uint16_t *Index(uint8_t proto) const
+    {
+        switch (proto)
+        {
+        case IPPROTO_TCP:
+            return tcp_index;
+        case IPPROTO_UDP:
+            return udp_index;
+        default:
+            return nullptr;
+        }
+    }
+};
+
+#endif // __PORT_TABLE_H__
@@ -0,0 +1,108 @@
+// SYN cookie(RFC 4987)：监听端口的半连接太多时不再为SYN分配连接，而是把需要记住的信息编码在SYN,ACK的ISN中，
+// 收到对方的ACK时从确认号中还原出来，在此之前不保存任何状态，SYN flood无法耗尽连接池。
+// ISN的格式和Linux相同：高8位是时间计数(大约每65秒加1)，低24位是MSS在`SYN_COOKIE_MSS_TABLE`中的下标，再加上两个带密钥的哈希值。
+// ISN中放不下的Window Scale和SACK放在SYN,ACK的TSval的低6位，对方在ACK的TSecr中原样带回；对方不支持Timestamp时这两个Option都不使用。
+
+#ifndef __SYNCOOKIE_H__
+#define __SYNCOOKIE_H__
+
+#include "tcp.h"
+
+#include <cstdint>
+
+#include <rte_byteorder.h>
+#include <rte_jhash.h>
+#include <rte_random.h>
+
+#define SYN_COOKIE_COUNT_SHIFT 16   // 时间计数 = tcp_ts_now()(毫秒) >> 16
+#define SYN_COOKIE_MAX_AGE 2        // 最多接受这么多个计数周期之前发出的cookie
+#define SYN_COOKIE_TS_BITS 6        // TSval的低6位用来编码Option
+#define SYN_COOKIE_WSCALE_MASK 0x0F // 对方的Window Scale，0x0F表示对方不支持
+#define SYN_COOKIE_SACK_BIT 0x10    // 对方支持SACK
+
+// 能编码的MSS，对方的MSS向下取到最接近的一个
+static const uint16_t SYN_COOKIE_MSS_TABLE[] = {536, 1300, 1440, 1460};
+
+class SynCookie
+{
+    uint32_t secrets[2];
+
+public:
+    SynCookie()
+    {
+        secrets[0] = (uint32_t)rte_rand();
+        secrets[1] = (uint32_t)rte_rand();
+    }
+
+    // 为对方的SYN生成SYN,ACK的ISN和TSval，`opts`被改成cookie能记住的结果，SYN,ACK中按照它回复Option
+    uint32_t Encode(rte_be32_t local_ip, rte_be32_t remote_ip, rte_be16_t local_port, rte_be16_t remote_port,
+                    uint32_t syn_seq, TCPOptions *opts, uint32_t *ts_val) const
+    {
+        uint32_t mss_index = 0;
+        const uint16_t mss = opts->mss ? opts->mss : TCP_DEFAULT_MSS;
+        for (uint32_t i = 0; i < RTE_DIM(SYN_COOKIE_MSS_TABLE); i++)
+        {
+            if (SYN_COOKIE_MSS_TABLE[i] <= mss)
+                mss_index = i;
+        }
+        opts->mss = SYN_COOKIE_MSS_TABLE[mss_index];
+
+        if (opts->has_timestamp)
+        {
+            uint32_t bits = opts->has_wscale ? RTE_MIN(opts->wscale, (uint8_t)14) : SYN_COOKIE_WSCALE_MASK;
+            if (opts->sack_permitted)
+                bits |= SYN_COOKIE_SACK_BIT;
+            *ts_val = (tcp_ts_now() & ~((1U << SYN_COOKIE_TS_BITS) - 1)) | bits;
+        }
+        else
+        {
+            opts->has_wscale = false;
+            opts->sack_permitted = false;
+            *ts_val = 0;
+        }
+
+        const uint32_t count = Count();
+        return Hash(local_ip, remote_ip, local_port, remote_port, 0, 0) + syn_seq + (count << 24) +
+               ((Hash(local_ip, remote_ip, local_port, remote_port, 1, count) + mss_index) & 0xFFFFFF);
+    }
+
+    // 校验对方ACK中的cookie，`ack_opts`为ACK中的Option，成功时在`syn_opts`中还原对方SYN中的Option
+    bool Decode(rte_be32_t local_ip, rte_be32_t remote_ip, rte_be16_t local_port, rte_be16_t remote_port,
+                uint32_t ack_seq, uint32_t seq, const TCPOptions &ack_opts, TCPOptions *syn_opts) const
+    {
+        const uint32_t cookie = ack_seq - 1 - Hash(local_ip, remote_ip, local_port, remote_port, 0, 0) - (seq - 1);
+        const uint32_t count = Count();
+        const uint32_t age = (count - (cookie >> 24)) & 0xFF;
+        if (age >= SYN_COOKIE_MAX_AGE)
+            return false;
+        const uint32_t mss_index = (cookie - Hash(local_ip, remote_ip, local_port, remote_port, 1, count - age)) & 0xFFFFFF;
+        if (mss_index >= RTE_DIM(SYN_COOKIE_MSS_TABLE))
+            return false;
+
+        memset(syn_opts, 0, sizeof(*syn_opts));
+        syn_opts->mss = SYN_COOKIE_MSS_TABLE[mss_index];
+        if (ack_opts.has_timestamp)
+        {
+            // TSecr不可能比现在还晚
+            if ((int32_t)(ack_opts.ts_ecr - tcp_ts_now()) > 0)
+                return false;
+            const uint32_t bits = ack_opts.ts_ecr & ((1U << SYN_COOKIE_TS_BITS) - 1);
+            syn_opts->has_timestamp = true;
+            syn_opts->ts_val = ack_opts.ts_val;
+            syn_opts->has_wscale = (bits & SYN_COOKIE_WSCALE_MASK) != SYN_COOKIE_WSCALE_MASK;
+            syn_opts->wscale = syn_opts->has_wscale ? (bits & SYN_COOKIE_WSCALE_MASK) : 0;
+            syn_opts->sack_permitted = (bits & SYN_COOKIE_SACK_BIT) != 0;
+        }
+        return true;
+    }
+
+private:
+    static uint32_t Count() { return tcp_ts_now() >> SYN_COOKIE_COUNT_SHIFT; }
+
+    uint32_t Hash(rte_be32_t local_ip, rte_be32_t remote_ip, rte_be16_t local_port, rte_be16_t remote_port, int c, uint32_t count) const
+    {
+        return rte_jhash_3words(remote_ip, ((uint32_t)local_port << 16) | remote_port, local_ip, secrets[c] + count);
+    }
+};
+
+#endif // __SYNCOOKIE_H__
@@ -0,0 +1,648 @@
+// TCP协议相关的通用工具：序列号比较、ISN生成、Option解析、乱序重组队列、发送队列、RTO计算
+
+#ifndef __TCP_H__
+#define __TCP_H__
+
+#include "configs.h"
+#include "mbuf_alloc.h"
+#include "timer_wheel.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include <rte_byteorder.h>
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_jhash.h>
+#include <rte_mbuf.h>
+#include <rte_memcpy.h>
+#include <rte_random.h>
+#include <rte_tcp.h>
+
+// 序列号比较，考虑32位回绕
+static inline bool tcp_seq_lt(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+static inline bool tcp_seq_leq(uint32_t a, uint32_t b) { return (int32_t)(a - b) <= 0; }
+static inline bool tcp_seq_gt(uint32_t a, uint32_t b) { return (int32_t)(a - b) > 0; }
+static inline bool tcp_seq_geq(uint32_t a, uint32_t b) { return (int32_t)(a - b) >= 0; }
+
+// Ref: https://www.rfc-editor.org/rfc/rfc9293#section-3.2
+#define TCP_OPT_END 0
+#define TCP_OPT_NOP 1
+#define TCP_OPT_MSS 2           // [kind=2][len=4][mss]
+#define TCP_OPT_WSCALE 3        // [kind=3][len=3][shift]
+#define TCP_OPT_SACK_PERMITTED 4 // [kind=4][len=2]
+#define TCP_OPT_SACK 5          // [kind=5][len=2+8n][left,right]*n
+#define TCP_OPT_TIMESTAMP 8     // [kind=8][len=10][ts_val][ts_ecr]
+
+#define TCP_OPT_MSS_LEN 4
+#define TCP_OPT_WSCALE_LEN 3
+#define TCP_OPT_SACK_PERMITTED_LEN 2
+#define TCP_OPT_TIMESTAMP_LEN 10
+
+#define TCP_OPT_TIMESTAMP_ALIGNED_LEN (2 + TCP_OPT_TIMESTAMP_LEN) // NOP,NOP,Timestamp
+
+#define TCP_MAX_OPTIONS_LEN 40
+#define TCP_MAX_SACK_BLOCKS 4 // 40字节的Option最多放得下4个SACK block
+#define TCP_MAX_WSCALE 14
+#define TCP_DEFAULT_MSS 536 // 对方没有发送MSS Option时使用的MSS
+
+// SYN和SYN,ACK的Option固定占用这么多字节：MSS + SACK permitted + Timestamp + NOP + Window scale
+#define TCP_SYN_OPTIONS_LEN (TCP_OPT_MSS_LEN + TCP_OPT_SACK_PERMITTED_LEN + TCP_OPT_TIMESTAMP_LEN + 1 + TCP_OPT_WSCALE_LEN)
+
+// 一个SACK block，表示[left, right)
+struct TCPSackBlock
+{
+    uint32_t left;
+    uint32_t right;
+};
+
+// 从TCP包头中解析出来的Option
+struct TCPOptions
+{
+    uint16_t mss; // 0表示没有MSS Option
+    bool has_wscale;
+    uint8_t wscale;
+    bool sack_permitted;
+    bool has_timestamp;
+    uint32_t ts_val;
+    uint32_t ts_ecr;
+    uint8_t nb_sack_blocks;
+    TCPSackBlock sack_blocks[TCP_MAX_SACK_BLOCKS];
+};
+
+// 解析TCP Option，格式错误的Option会被忽略
+static inline void ParseTCPOptions(const struct rte_tcp_hdr *tcp_hdr, TCPOptions *opts)
+{
+    memset(opts, 0, sizeof(*opts));
+
+    const uint8_t *options = (const uint8_t *)(tcp_hdr + 1);
+    const int length = (int)(tcp_hdr->data_off >> 4) * 4 - (int)sizeof(*tcp_hdr);
+    for (int pos = 0; pos < length;)
+    {
+        const uint8_t kind = options[pos];
+        if (kind == TCP_OPT_END)
+            break;
+        if (kind == TCP_OPT_NOP)
+        {
+            pos++;
+            continue;
+        }
+        if (pos + 1 >= length)
+            break;
+        const uint8_t len = options[pos + 1];
+        if (len < 2 || pos + len > length)
+            break;
+
+        const uint8_t *value = options + pos + 2;
+        switch (kind)
+        {
+        case TCP_OPT_MSS:
+            if (len == TCP_OPT_MSS_LEN)
+                opts->mss = rte_be_to_cpu_16(*(const rte_be16_t *)value);
+            break;
+        case TCP_OPT_WSCALE:
+            if (len == TCP_OPT_WSCALE_LEN)
+            {
+                opts->has_wscale = true;
+                opts->wscale = RTE_MIN(value[0], (uint8_t)TCP_MAX_WSCALE);
+            }
+            break;
+        case TCP_OPT_SACK_PERMITTED:
+            if (len == TCP_OPT_SACK_PERMITTED_LEN)
+                opts->sack_permitted = true;
+            break;
+        case TCP_OPT_SACK:
+            for (int i = 0; i + 8 <= len - 2 && opts->nb_sack_blocks < TCP_MAX_SACK_BLOCKS; i += 8)
+            {
+                TCPSackBlock &block = opts->sack_blocks[opts->nb_sack_blocks++];
+                block.left = rte_be_to_cpu_32(*(const rte_be32_t *)(value + i));
+                block.right = rte_be_to_cpu_32(*(const rte_be32_t *)(value + i + 4));
+            }
+            break;
+        case TCP_OPT_TIMESTAMP:
+            if (len == TCP_OPT_TIMESTAMP_LEN)
+            {
+                opts->has_timestamp = true;
+                opts->ts_val = rte_be_to_cpu_32(*(const rte_be32_t *)value);
+                opts->ts_ecr = rte_be_to_cpu_32(*(const rte_be32_t *)(value + 4));
+            }
+            break;
+        default:
+            break;
+        }
+        pos += len;
+    }
+}
+
+// 写SYN/SYN,ACK的Option，一共`TCP_SYN_OPTIONS_LEN`字节，不需要的Option用NOP填充
+static inline void WriteTCPSYNOptions(uint8_t *options, uint16_t mss,
+                                      bool sack_permitted,
+                                      bool timestamp, uint32_t ts_val, uint32_t ts_ecr,
+                                      bool wscale, uint8_t wscale_value)
+{
+    { // MSS Option
+        options[0] = TCP_OPT_MSS;
+        options[1] = TCP_OPT_MSS_LEN;
+        *(rte_be16_t *)(options + 2) = rte_cpu_to_be_16(mss);
+        options += TCP_OPT_MSS_LEN;
+    }
+    { // SACK permitted
+        if (sack_permitted)
+        {
+            options[0] = TCP_OPT_SACK_PERMITTED;
+            options[1] = TCP_OPT_SACK_PERMITTED_LEN;
+        }
+        else
+            memset(options, TCP_OPT_NOP, TCP_OPT_SACK_PERMITTED_LEN);
+        options += TCP_OPT_SACK_PERMITTED_LEN;
+    }
+    { // Timestamp Option
+        if (timestamp)
+        {
+            options[0] = TCP_OPT_TIMESTAMP;
+            options[1] = TCP_OPT_TIMESTAMP_LEN;
+            *(rte_be32_t *)(options + 2) = rte_cpu_to_be_32(ts_val);
+            *(rte_be32_t *)(options + 6) = rte_cpu_to_be_32(ts_ecr);
+        }
+        else
+            memset(options, TCP_OPT_NOP, TCP_OPT_TIMESTAMP_LEN);
+        options += TCP_OPT_TIMESTAMP_LEN;
+    }
+    { // No OP
+        options[0] = TCP_OPT_NOP;
+        options += 1;
+    }
+    { // Window scale
+        if (wscale)
+        {
+            options[0] = TCP_OPT_WSCALE;
+            options[1] = TCP_OPT_WSCALE_LEN;
+            options[2] = wscale_value;
+        }
+        else
+            memset(options, TCP_OPT_NOP, TCP_OPT_WSCALE_LEN);
+        options += TCP_OPT_WSCALE_LEN;
+    }
+}
+
+// 写NOP,NOP,Timestamp，返回写入的长度(12字节)
+static inline int WriteTCPTimestampOption(uint8_t *options, uint32_t ts_val, uint32_t ts_ecr)
+{
+    options[0] = TCP_OPT_NOP;
+    options[1] = TCP_OPT_NOP;
+    options[2] = TCP_OPT_TIMESTAMP;
+    options[3] = TCP_OPT_TIMESTAMP_LEN;
+    *(rte_be32_t *)(options + 4) = rte_cpu_to_be_32(ts_val);
+    *(rte_be32_t *)(options + 8) = rte_cpu_to_be_32(ts_ecr);
+    return TCP_OPT_TIMESTAMP_ALIGNED_LEN;
+}
+
+// 写NOP,NOP,SACK，返回写入的长度(4 + 8 * nb_blocks字节)
+static inline int WriteTCPSackOption(uint8_t *options, const TCPSackBlock *blocks, int nb_blocks)
+{
+    options[0] = TCP_OPT_NOP;
+    options[1] = TCP_OPT_NOP;
+    options[2] = TCP_OPT_SACK;
+    options[3] = 2 + 8 * nb_blocks;
+    for (int i = 0; i < nb_blocks; i++)
+    {
+        *(rte_be32_t *)(options + 4 + 8 * i) = rte_cpu_to_be_32(blocks[i].left);
+        *(rte_be32_t *)(options + 8 + 8 * i) = rte_cpu_to_be_32(blocks[i].right);
+    }
+    return 4 + 8 * nb_blocks;
+}
+
+// Timestamp Option使用的时钟，单位为毫秒
+static inline uint32_t tcp_ts_now()
+{
+    return (uint32_t)(rte_get_tsc_cycles() / (rte_get_tsc_hz() / MS_PER_S));
+}
+
+// 新连接的ISN(RFC 6528)：每4微秒加1的时钟，加上四元组的带密钥哈希。同一个四元组前后两个连接的ISN递增，
+// 不同四元组之间无法从观察到的ISN推测。密钥在第一次调用时生成，所有lcore共用
+static inline uint32_t tcp_new_isn(rte_be32_t local_ip, rte_be32_t remote_ip, rte_be16_t local_port, rte_be16_t remote_port)
+{
+    static const uint32_t secret = (uint32_t)rte_rand();
+    const uint32_t clock = (uint32_t)(rte_get_tsc_cycles() / (rte_get_tsc_hz() / 250000));
+    return clock + rte_jhash_3words(remote_ip, ((uint32_t)local_port << 16) | remote_port, local_ip, secret);
+}
+
+// 去掉mbuf链最前面的`n`个字节，返回新的链头(前面的segment可能被释放)，全部去掉时返回nullptr
+static inline struct rte_mbuf *mbuf_trim_head(struct rte_mbuf *m, uint32_t n)
+{
+    uint32_t pkt_len = m->pkt_len;
+    uint16_t nb_segs = m->nb_segs;
+    while (m && n >= m->data_len && n > 0)
+    {
+        struct rte_mbuf *next = m->next;
+        n -= m->data_len;
+        pkt_len -= m->data_len;
+        nb_segs--;
+        m->next = nullptr;
+        rte_pktmbuf_free_seg(m);
+        m = next;
+    }
+    if (!m)
+        return nullptr;
+    m->data_off += n;
+    m->data_len -= n;
+    m->pkt_len = pkt_len - n;
+    m->nb_segs = nb_segs;
+    return m;
+}
+
+// 只保留mbuf链最前面的`keep`个字节
+static inline void mbuf_trim_tail(struct rte_mbuf *m, uint32_t keep)
+{
+    if (keep >= m->pkt_len)
+        return;
+    m->pkt_len = keep;
+    uint16_t nb_segs = 0;
+    for (struct rte_mbuf *seg = m; seg; seg = seg->next)
+    {
+        nb_segs++;
+        if (keep <= seg->data_len)
+        {
+            seg->data_len = keep;
+            if (seg->next)
+            {
+                rte_pktmbuf_free(seg->next);
+                seg->next = nullptr;
+            }
+            break;
+        }
+        keep -= seg->data_len;
+    }
+    m->nb_segs = nb_segs;
+}
+
+// 乱序重组队列：保存序列号在rcv_nxt之后、还不能交给上层的数据段。
+// 数据段直接引用收到的mbuf(已经去掉了包头，只剩payload)，不做拷贝。
+// 队列中的数据段按照序列号排列且互不重叠，总长度不超过接收窗口。
+class TCPReassemblyQueue
+{
+    struct Segment
+    {
+        uint32_t seq;
+        uint32_t len;
+        struct rte_mbuf *data;
+    };
+
+    Segment segments[TCP_OOO_MAX_SEGMENTS];
+    int nb_segments;
+    uint32_t bytes;
+
+    uint32_t last_seq; // 最近一次插入的数据段，用于生成第一个SACK block
+
+public:
+    TCPReassemblyQueue() : nb_segments(0), bytes(0), last_seq(0) {}
+    ~TCPReassemblyQueue() { Clear(); }
+
+    TCPReassemblyQueue(const TCPReassemblyQueue &) = delete;
+    TCPReassemblyQueue &operator=(const TCPReassemblyQueue &) = delete;
+
+    bool Empty() const { return nb_segments == 0; }
+    uint32_t Bytes() const { return bytes; }
+
+    void Clear()
+    {
+        for (int i = 0; i < nb_segments; i++)
+            rte_pktmbuf_free(segments[i].data);
+        nb_segments = 0;
+        bytes = 0;
+    }
+
+    // 插入一个乱序的数据段[seq, seq + data->pkt_len)，和已有数据重叠的部分会被去掉。
+    // 返回true表示`data`归队列所有；返回false表示`data`没有被使用(完全重复或者队列已满)，由调用者释放。
+    bool Insert(uint32_t seq, struct rte_mbuf *data)
+    {
+        uint32_t len = data->pkt_len;
+        if (len == 0 || nb_segments == TCP_OOO_MAX_SEGMENTS)
+            return false;
+
+        // 找到第一个结尾在seq之后的数据段
+        int i = 0;
+        while (i < nb_segments && tcp_seq_leq(segments[i].seq + segments[i].len, seq))
+            i++;
+
+        // 和前一个数据段(segments[i])重叠的部分去掉
+        uint32_t overlap = 0;
+        if (i < nb_segments && tcp_seq_leq(segments[i].seq, seq))
+        {
+            overlap = segments[i].seq + segments[i].len - seq;
+            if (overlap >= len)
+                return false; // 完全重复
+            seq += overlap;
+            len -= overlap;
+            i++;
+        }
+        // 和后一个数据段重叠的部分去掉
+        if (i < nb_segments && tcp_seq_lt(segments[i].seq, seq + len))
+        {
+            // 新数据段完全覆盖了后面的数据段时，后面的数据段保留，新数据段截断到它之前
+            len = segments[i].seq - seq;
+            if (len == 0)
+                return false; // 去掉重叠部分之后没有新数据，和完全重复一样处理
+        }
+        // 确定不会返回false之后再修改mbuf，返回false时调用者释放的还是原来的`data`
+        if (overlap > 0)
+            data = mbuf_trim_head(data, overlap);
+        mbuf_trim_tail(data, len);
+
+        memmove(&segments[i + 1], &segments[i], sizeof(Segment) * (nb_segments - i));
+        segments[i] = Segment{seq, len, data};
+        nb_segments++;
+        bytes += len;
+        last_seq = seq;
+        return true;
+    }
+
+    // 取出从`rcv_nxt`开始连续的所有数据，链成一个mbuf链返回，`*rcv_nxt`一次前进到连续数据的末尾。
+    // 没有连续数据时返回nullptr。
+    struct rte_mbuf *PopContiguous(uint32_t *rcv_nxt)
+    {
+        struct rte_mbuf *head = nullptr;
+        int n = 0;
+        while (n < nb_segments && tcp_seq_leq(segments[n].seq, *rcv_nxt))
+        {
+            Segment &seg = segments[n++];
+            bytes -= seg.len;
+            const uint32_t end = seg.seq + seg.len;
+            if (tcp_seq_leq(end, *rcv_nxt))
+            {
+                rte_pktmbuf_free(seg.data);
+                continue;
+            }
+            struct rte_mbuf *data = seg.data;
+            if (tcp_seq_lt(seg.seq, *rcv_nxt))
+                data = mbuf_trim_head(data, *rcv_nxt - seg.seq);
+            *rcv_nxt = end;
+            if (!head)
+                head = data;
+            else if (rte_pktmbuf_chain(head, data) != 0)
+            {
+                // mbuf链的segment数量达到上限，先把已经链好的交出去，剩下的下次再取
+                *rcv_nxt = end - data->pkt_len;
+                seg.seq = *rcv_nxt;
+                seg.len = data->pkt_len;
+                seg.data = data;
+                bytes += seg.len;
+                n--;
+                break;
+            }
+        }
+        nb_segments -= n;
+        memmove(&segments[0], &segments[n], sizeof(Segment) * nb_segments);
+        return head;
+    }
+
+    // 生成SACK blocks，第一个block包含最近收到的数据段(RFC 2018)，返回block数量
+    int GetSackBlocks(TCPSackBlock *blocks, int max_blocks) const
+    {
+        // 先把相邻的数据段合并成连续区间
+        TCPSackBlock ranges[TCP_OOO_MAX_SEGMENTS];
+        int nb_ranges = 0;
+        int first = -1;
+        for (int i = 0; i < nb_segments; i++)
+        {
+            if (nb_ranges > 0 && ranges[nb_ranges - 1].right == segments[i].seq)
+                ranges[nb_ranges - 1].right += segments[i].len;
+            else
+                ranges[nb_ranges++] = TCPSackBlock{segments[i].seq, segments[i].seq + segments[i].len};
+            if (segments[i].seq == last_seq)
+                first = nb_ranges - 1;
+        }
+
+        int n = 0;
+        if (first >= 0 && n < max_blocks)
+            blocks[n++] = ranges[first];
+        for (int i = 0; i < nb_ranges && n < max_blocks; i++)
+        {
+            if (i != first)
+                blocks[n++] = ranges[i];
+        }
+        return n;
+    }
+};
+
+// RTO计算(RFC 6298)，所有时间的单位都是微秒
+struct TCPRtoEstimator
+{
+    uint32_t srtt;
+    uint32_t rttvar;
+    uint32_t rto;
+    bool has_sample; // 是否已经有过RTT样本
+
+    TCPRtoEstimator() : srtt(0), rttvar(0), rto(TCP_RTO_INIT_US), has_sample(false) {}
+
+    // 用一个新的RTT样本更新SRTT、RTTVAR和RTO
+    void Sample(uint32_t rtt)
+    {
+        if (!has_sample)
+        {
+            srtt = rtt;
+            rttvar = rtt / 2;
+            has_sample = true;
+        }
+        else
+        {
+            const uint32_t delta = srtt > rtt ? srtt - rtt : rtt - srtt;
+            rttvar = rttvar - rttvar / 4 + delta / 4; // RTTVAR = 3/4 * RTTVAR + 1/4 * |SRTT - R'|
+            srtt = srtt - srtt / 8 + rtt / 8;         // SRTT = 7/8 * SRTT + 1/8 * R'
+        }
+        // RTO = SRTT + max(G, 4 * RTTVAR)，G为定时器的精度
+        rto = RTE_MIN(RTE_MAX(srtt + RTE_MAX((uint32_t)TIMER_WHEEL_TICK_US, 4 * rttvar), (uint32_t)TCP_RTO_MIN_US), (uint32_t)TCP_RTO_MAX_US);
+    }
+
+    // 超时之后RTO翻倍
+    void Backoff() { rto = RTE_MIN(rto * 2, (uint32_t)TCP_RTO_MAX_US); }
+};
+
+// 发送队列：保存上层交给TCP、还没有被对方确认的数据。
+// 数据在放入队列时就按照MSS切分成数据段，每个数据段是一个只包含payload的mbuf，
+// 发送时把它的clone接在包头mbuf后面，不需要复制数据；重传时再clone一次即可。
+// 队列是一个环：[head, next)是已经发送、等待确认的数据段，[next, tail)是还没有发送的数据段。
+class TCPSendQueue
+{
+public:
+    struct Segment
+    {
+        uint32_t seq;
+        uint32_t len;
+        struct rte_mbuf *data;
+        uint64_t sent_tsc; // 第一次发送的时间，用于计算RTT
+        bool retransmitted; // 被重传过的数据段不能用来计算RTT(Karn算法)
+    };
+
+private:
+    Segment segments[TCP_SND_QUEUE_SEGMENTS];
+    uint32_t head;
+    uint32_t next;
+    uint32_t tail;
+    uint32_t bytes;   // 队列中所有数据的字节数
+    uint32_t end_seq; // 队列中最后一个字节之后的序列号
+
+    Segment &At(uint32_t i) { return segments[i & (TCP_SND_QUEUE_SEGMENTS - 1)]; }
+
+public:
+    TCPSendQueue() : head(0), next(0), tail(0), bytes(0), end_seq(0) {}
+    ~TCPSendQueue() { Clear(); }
+
+    TCPSendQueue(const TCPSendQueue &) = delete;
+    TCPSendQueue &operator=(const TCPSendQueue &) = delete;
+
+    // 设置第一个字节的序列号，只能在队列为空时调用
+    void Init(uint32_t seq) { end_seq = seq; }
+
+    uint32_t Bytes() const { return bytes; }
+    uint32_t EndSeq() const { return end_seq; }
+    bool Empty() const { return head == tail; }
+
+    void Clear()
+    {
+        for (; head != tail; head++)
+            rte_pktmbuf_free(At(head).data);
+        next = tail;
+        bytes = 0;
+    }
+
+    // 把`data`切分成不超过`mss`字节的数据段放入队列，返回实际放入的字节数。
+    // 受`TCP_SND_BUF`和mbuf数量的限制，可能只放入一部分。
+    uint32_t Append(const uint8_t *data, uint32_t len, uint32_t mss, MbufAllocator *mbufs)
+    {
+        uint32_t done = 0;
+        len = RTE_MIN(len, TCP_SND_BUF - bytes);
+
+        // 最后一个数据段还没有发送且没有满的话先把它填满，引用其他mbuf中数据的数据段不能写
+        if (next != tail && len > 0 && RTE_MBUF_DIRECT(At(tail - 1).data) && At(tail - 1).data->next == nullptr &&
+            rte_mbuf_refcnt_read(At(tail - 1).data) == 1)
+        {
+            Segment &last = At(tail - 1);
+            const uint32_t n = RTE_MIN(RTE_MIN(len, mss - RTE_MIN(last.len, mss)), (uint32_t)rte_pktmbuf_tailroom(last.data));
+            if (n > 0)
+            {
+                rte_memcpy(rte_pktmbuf_append(last.data, n), data, n);
+                last.len += n;
+                done += n;
+            }
+        }
+
+        while (done < len && tail - head < TCP_SND_QUEUE_SEGMENTS)
+        {
+            struct rte_mbuf *m = mbufs->Alloc(MbufPriority::NORMAL);
+            if (!m)
+                break;
+            const uint32_t n = RTE_MIN(RTE_MIN(len - done, mss), (uint32_t)rte_pktmbuf_tailroom(m));
+            rte_memcpy(rte_pktmbuf_append(m, n), data + done, n);
+            At(tail++) = Segment{end_seq + done, n, m, 0, false};
+            done += n;
+        }
+
+        bytes += done;
+        end_seq += done;
+        return done;
+    }
+
+    // 零拷贝：把mbuf链`data`按`mss`切分放入队列，数据段是引用`data`中数据的indirect mbuf，不复制数据。
+    // 每个segment单独切分，不会和其他segment合并成一个数据段。
+    // 全部放得下时接管`data`并返回true，否则返回false，`data`仍然属于调用者
+    bool Append(struct rte_mbuf *data, uint32_t mss, MbufAllocator *mbufs)
+    {
+        const uint32_t len = data->pkt_len;
+        uint32_t nb_segments = 0;
+        for (struct rte_mbuf *seg = data; seg; seg = seg->next)
+            nb_segments += (seg->data_len + mss - 1) / mss;
+        if (len > TCP_SND_BUF - bytes || nb_segments > TCP_SND_QUEUE_SEGMENTS - (tail - head))
+            return false;
+
+        const uint32_t old_tail = tail;
+        uint32_t done = 0;
+        for (struct rte_mbuf *seg = data; seg; seg = seg->next)
+        {
+            for (uint32_t offset = 0; offset < seg->data_len;)
+            {
+                struct rte_mbuf *m = mbufs->Alloc(MbufPriority::NORMAL);
+                if (!m)
+                {
+                    // mbuf用完了，撤销这次放入的所有数据段
+                    for (; tail != old_tail; tail--)
+                        rte_pktmbuf_free(At(tail - 1).data);
+                    return false;
+                }
+                const uint32_t n = RTE_MIN(seg->data_len - offset, mss);
+                rte_pktmbuf_attach(m, seg);
+                m->data_off += offset;
+                m->data_len = m->pkt_len = n;
+                At(tail++) = Segment{end_seq + done, n, m, 0, false};
+                offset += n;
+                done += n;
+            }
+        }
+
+        // 数据段都引用了`data`中的数据，这里只是减少引用计数
+        rte_pktmbuf_free(data);
+        bytes += done;
+        end_seq += done;
+        return true;
+    }
+
+    // 下一个还没有发送的数据段，没有时返回nullptr
+    Segment *NextUnsent() { return next != tail ? &At(next) : nullptr; }
+
+    // 下一个还没有发送的数据段之后的第`i`个数据段，用于把连续的数据段合成一个大报文段，没有时返回nullptr
+    Segment *UnsentAt(uint32_t i) { return tail - next > i ? &At(next + i) : nullptr; }
+
+    // `NextUnsent`返回的数据段已经发送出去了
+    void MarkSent(uint64_t now_tsc)
+    {
+        At(next).sent_tsc = now_tsc;
+        next++;
+    }
+
+    // 最早的一个已经发送、还没有被确认的数据段，没有时返回nullptr
+    Segment *FrontSent() { return head != next ? &At(head) : nullptr; }
+
+    // 重传超时：所有已经发送、还没有被确认的数据段都当作没有发送，之后从最早的数据段开始重新发送
+    void Rewind()
+    {
+        for (uint32_t i = head; i != next; i++)
+            At(i).retransmitted = true;
+        next = head;
+    }
+
+    // 对方确认了`ack`之前的所有数据，释放这些数据段，返回被确认的字节数。
+    // `*rtt_sent_tsc`为被确认的数据段中可以用来计算RTT的最晚的发送时间，没有时为0。
+    // `Rewind`之后，回退之前发送过的数据的ACK也会确认还没有重新发送的数据段
+    uint32_t Ack(uint32_t ack, uint64_t *rtt_sent_tsc)
+    {
+        uint32_t acked = 0;
+        *rtt_sent_tsc = 0;
+        while (head != tail)
+        {
+            Segment &seg = At(head);
+            if (tcp_seq_leq(ack, seg.seq))
+                break;
+            if (tcp_seq_lt(ack, seg.seq + seg.len))
+            {
+                // 只确认了一部分，去掉已经确认的部分
+                const uint32_t n = ack - seg.seq;
+                seg.data = mbuf_trim_head(seg.data, n);
+                seg.seq += n;
+                seg.len -= n;
+                acked += n;
+                break;
+            }
+            if (!seg.retransmitted)
+                *rtt_sent_tsc = seg.sent_tsc;
+            acked += seg.len;
+            rte_pktmbuf_free(seg.data);
+            if (next == head)
+                next++;
+            head++;
+        }
+        bytes -= acked;
+        return acked;
+    }
+};
+
+#endif // __TCP_H__
@@ -0,0 +1,272 @@
+// TCP拥塞控制：`TCPCongestionControl`负责慢启动、快速恢复(NewReno, RFC 6582)和超时之后的处理，
+// 子类只需要实现拥塞避免阶段的窗口增长和丢包之后的窗口缩小。目前有NewReno和CUBIC两种实现，
+// 每个连接一个实例，由监听的`TCPServerTask`(或主动连接时的调用者)选择使用哪一种。
+
+#ifndef __TCP_CC_H__
+#define __TCP_CC_H__
+
+#include "configs.h"
+#include "tcp.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include <rte_common.h>
+#include <rte_cycles.h>
+
+enum class TCPCongestionControlType : uint8_t
+{
+    NEW_RENO = 0,
+    CUBIC,
+};
+
+enum class TCPCongestionState : uint8_t
+{
+    SLOW_START = 0,
+    CONGESTION_AVOIDANCE,
+    RECOVERY, // 快速恢复，直到`recover`之前的数据都被确认
+    LOSS,     // 重传超时，cwnd回到1个MSS，收到新的ACK之后重新慢启动
+};
+
+static inline const char *tcp_cc_state_name(TCPCongestionState state)
+{
+    switch (state)
+    {
+    case TCPCongestionState::SLOW_START:
+        return "slow-start";
+    case TCPCongestionState::CONGESTION_AVOIDANCE:
+        return "congestion-avoidance";
+    case TCPCongestionState::RECOVERY:
+        return "recovery";
+    case TCPCongestionState::LOSS:
+        return "loss";
+    }
+    return "unknown";
+}
+
+struct TCPCongestionControlStorage;
+
+class TCPCongestionControl
+{
+public:
+    // `OnAck`的返回值
+    enum AckResult
+    {
+        ACK_NORMAL,
+        ACK_PARTIAL, // 快速恢复中的partial ACK，需要立即重传下一个没有被确认的数据段
+    };
+
+protected:
+    uint32_t mss;
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t recover; // 进入快速恢复时的snd_nxt
+    TCPCongestionState state;
+
+public:
+    TCPCongestionControl(uint32_t mss) : mss(mss), recover(0), state(TCPCongestionState::SLOW_START)
+    {
+        cwnd = RTE_MIN(TCP_INIT_CWND_SEGMENTS * mss, RTE_MAX(2 * mss, (uint32_t)14600)); // RFC 6928
+        ssthresh = UINT32_MAX;
+    }
+    virtual ~TCPCongestionControl() {}
+
+    virtual const char *Name() const = 0;
+
+    uint32_t Cwnd() const { return cwnd; }
+    uint32_t Ssthresh() const { return ssthresh; }
+    TCPCongestionState State() const { return state; }
+
+    // 新的数据被确认了，`acked`为确认的字节数，`ack`为ACK中的确认号，`srtt`为平滑之后的RTT(微秒)
+    AckResult OnAck(uint32_t acked, uint32_t ack, uint32_t srtt)
+    {
+        if (state == TCPCongestionState::RECOVERY)
+        {
+            if (tcp_seq_geq(ack, recover))
+            {
+                // full ACK，退出快速恢复，窗口收缩到ssthresh
+                cwnd = ssthresh;
+                state = TCPCongestionState::CONGESTION_AVOIDANCE;
+                return ACK_NORMAL;
+            }
+            // partial ACK，窗口减去被确认的数据再加一个MSS(RFC 6582 3.2)
+            cwnd = cwnd > acked ? cwnd - acked : 0;
+            cwnd = RTE_MAX(cwnd + mss, mss);
+            return ACK_PARTIAL;
+        }
+
+        if (cwnd < ssthresh)
+        {
+            state = TCPCongestionState::SLOW_START;
+            cwnd += RTE_MIN(acked, mss); // RFC 5681 3.1
+            return ACK_NORMAL;
+        }
+
+        state = TCPCongestionState::CONGESTION_AVOIDANCE;
+        OnCongestionAvoidance(acked, srtt);
+        return ACK_NORMAL;
+    }
+
+    // 收到第`dupacks`个重复的ACK，返回是否需要快速重传
+    bool OnDupAck(uint32_t dupacks, uint32_t flight_size, uint32_t snd_nxt)
+    {
+        if (state == TCPCongestionState::RECOVERY)
+        {
+            // 每个重复的ACK都说明有一个数据段离开了网络
+            cwnd += mss;
+            return false;
+        }
+        if (dupacks != TCP_DUPACK_THRESHOLD)
+            return false;
+
+        ssthresh = OnLoss(flight_size);
+        cwnd = ssthresh + TCP_DUPACK_THRESHOLD * mss;
+        recover = snd_nxt;
+        state = TCPCongestionState::RECOVERY;
+        return true;
+    }
+
+    // 重传超时
+    void OnTimeout(uint32_t flight_size)
+    {
+        if (state != TCPCongestionState::LOSS)
+            ssthresh = OnLoss(flight_size);
+        cwnd = mss;
+        state = TCPCongestionState::LOSS;
+    }
+
+    // 在`storage`中构造一个拥塞控制算法的实例，不分配内存，不再使用时直接调用析构函数
+    static TCPCongestionControl *Create(TCPCongestionControlType type, uint32_t mss, TCPCongestionControlStorage *storage);
+
+protected:
+    // 拥塞避免阶段收到ACK时增大cwnd
+    virtual void OnCongestionAvoidance(uint32_t acked, uint32_t srtt) = 0;
+
+    // 检测到丢包，返回新的ssthresh
+    virtual uint32_t OnLoss(uint32_t flight_size) = 0;
+};
+
+// NewReno(RFC 5681 + RFC 6582)：拥塞避免阶段每个RTT增加一个MSS，丢包时窗口减半
+class TCPNewReno : public TCPCongestionControl
+{
+    uint32_t bytes_acked; // 拥塞避免阶段累计确认的字节数，达到cwnd时cwnd增加一个MSS
+
+public:
+    TCPNewReno(uint32_t mss) : TCPCongestionControl(mss), bytes_acked(0) {}
+
+    virtual const char *Name() const override { return "newreno"; }
+
+protected:
+    virtual void OnCongestionAvoidance(uint32_t acked, uint32_t srtt) override
+    {
+        bytes_acked += acked;
+        if (bytes_acked >= cwnd)
+        {
+            bytes_acked -= cwnd;
+            cwnd += mss;
+        }
+    }
+
+    virtual uint32_t OnLoss(uint32_t flight_size) override
+    {
+        bytes_acked = 0;
+        return RTE_MAX(flight_size / 2, 2 * mss);
+    }
+};
+
+// CUBIC(RFC 9438)：拥塞避免阶段窗口按照距离上次丢包的时间的三次函数增长，和RTT无关，适合高BDP的链路
+class TCPCubic : public TCPCongestionControl
+{
+    static constexpr double C = 0.4;
+    static constexpr double BETA = 0.7;
+
+    double w_max;          // 上次丢包时的窗口(MSS)
+    double w_last_max;     // 再上一次丢包时的窗口，用于fast convergence
+    double k;              // 窗口增长回w_max需要的时间(秒)
+    double w_est;          // 按照Reno方式估计的窗口(MSS)，保证不比Reno慢
+    uint64_t epoch_start;  // 本轮拥塞避免开始的时间(TSC)，0表示还没有开始
+    double cwnd_acc;       // 不足一个字节的窗口增长
+
+public:
+    TCPCubic(uint32_t mss) : TCPCongestionControl(mss), w_max(0), w_last_max(0), k(0), w_est(0), epoch_start(0), cwnd_acc(0) {}
+
+    virtual const char *Name() const override { return "cubic"; }
+
+protected:
+    virtual void OnCongestionAvoidance(uint32_t acked, uint32_t srtt) override
+    {
+        const double cwnd_segs = (double)cwnd / mss;
+        const uint64_t now = rte_get_tsc_cycles();
+        if (epoch_start == 0)
+        {
+            epoch_start = now;
+            if (w_max < cwnd_segs)
+            {
+                // 没有丢过包，或者窗口已经超过了上次丢包时的大小
+                w_max = cwnd_segs;
+                k = 0;
+            }
+            else
+            {
+                k = cbrt((w_max - cwnd_segs) / C);
+            }
+            w_est = cwnd_segs;
+        }
+
+        const double rtt = RTE_MAX(srtt, (uint32_t)TIMER_WHEEL_TICK_US) / 1e6;
+        const double t = (double)(now - epoch_start) / rte_get_tsc_hz();
+        const double target = C * pow(t + rtt - k, 3) + w_max; // W_cubic(t + RTT)
+
+        // Reno-friendly区域：每个RTT增加 3 * (1 - beta) / (1 + beta) 个MSS
+        w_est += 3.0 * (1 - BETA) / (1 + BETA) * acked / cwnd;
+
+        double increase; // 本次ACK带来的窗口增长(MSS)
+        if (target > cwnd_segs)
+            increase = (target - cwnd_segs) / cwnd_segs * ((double)acked / mss);
+        else
+            increase = 0.01 * ((double)acked / mss) / cwnd_segs; // 在w_max附近时缓慢增长
+        if (w_est > cwnd_segs + increase)
+            increase = w_est - cwnd_segs;
+
+        cwnd_acc += increase * mss;
+        const uint32_t inc = (uint32_t)cwnd_acc;
+        cwnd += inc;
+        cwnd_acc -= inc;
+    }
+
+    virtual uint32_t OnLoss(uint32_t flight_size) override
+    {
+        const double cwnd_segs = (double)cwnd / mss;
+        // fast convergence：窗口比上次丢包时还小，说明有新的流加入，让出更多带宽
+        if (cwnd_segs < w_last_max)
+            w_max = cwnd_segs * (1 + BETA) / 2;
+        else
+            w_max = cwnd_segs;
+        w_last_max = cwnd_segs;
+        epoch_start = 0;
+        cwnd_acc = 0;
+        return RTE_MAX((uint32_t)(cwnd * BETA), 2 * mss);
+    }
+};
+
+// 足够放下任何一种拥塞控制算法的空间，嵌入在连接中
+struct TCPCongestionControlStorage
+{
+    alignas(std::max_align_t) uint8_t data[RTE_MAX(sizeof(TCPNewReno), sizeof(TCPCubic))];
+};
+
+inline TCPCongestionControl *TCPCongestionControl::Create(TCPCongestionControlType type, uint32_t mss, TCPCongestionControlStorage *storage)
+{
+    switch (type)
+    {
+    case TCPCongestionControlType::CUBIC:
+        return new (storage->data) TCPCubic(mss);
+    case TCPCongestionControlType::NEW_RENO:
+    default:
+        return new (storage->data) TCPNewReno(mss);
+    }
+}
+
+#endif // __TCP_CC_H__
@@ -0,0 +1,172 @@
+// 分层定时器轮：每个lcore一个，Task把自己的定时器(TCP重传、keepalive、ARP重试、DHCP续约等)注册到这里，
+// 主循环每次只处理已经到期的定时器，不需要轮询所有的Task。
+// 一共`TIMER_WHEEL_LEVELS`层，每层`1 << TIMER_WHEEL_LEVEL_BITS`个槽，第0层每个槽是1个tick，
+// 第1层每个槽是第0层转一圈的时间，以此类推。定时器按照距离到期的时间放入对应的层，
+// 低层转完一圈时把上一层对应槽里的定时器重新分配到下面的层(cascade)。启动/取消都是O(1)。
+
+#ifndef __TIMER_WHEEL_H__
+#define __TIMER_WHEEL_H__
+
+#include "configs.h"
+
+#include <cstdint>
+
+#include <rte_common.h>
+#include <rte_cycles.h>
+
+// 一个定时器，一般作为成员嵌入到需要定时的对象中，对象析构前必须`Cancel`
+struct Timer
+{
+    typedef void (*Callback)(Timer *timer, void *arg);
+
+    Timer *prev;
+    Timer *next;
+    uint64_t expire; // 到期时间(tick)
+    Callback callback;
+    void *arg;
+
+    Timer() : prev(nullptr), next(nullptr), expire(0), callback(nullptr), arg(nullptr) {}
+    Timer(Callback callback, void *arg) : prev(nullptr), next(nullptr), expire(0), callback(callback), arg(arg) {}
+
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+
+    // 是否已经启动且还没有到期
+    bool Pending() const { return prev != nullptr; }
+};
+
+class TimerWheel
+{
+    static constexpr uint32_t SLOTS = 1U << TIMER_WHEEL_LEVEL_BITS;
+    static constexpr uint32_t MASK = SLOTS - 1;
+    static constexpr uint64_t MAX_TICKS = (1ULL << (TIMER_WHEEL_LEVEL_BITS * TIMER_WHEEL_LEVELS)) - 1; // 最长能定时多久
+
+    Timer slots[TIMER_WHEEL_LEVELS][SLOTS]; // 每个槽是一个双向循环链表，槽本身是表头
+    uint64_t now;                           // 下一个要处理的tick
+    uint64_t nb_timers;                     // 正在运行的定时器数量
+    uint64_t tick_tsc;                      // 一个tick有多少个cycle
+    uint64_t start_tsc;
+
+public:
+    TimerWheel()
+    {
+        for (auto &level : slots)
+            for (auto &slot : level)
+                slot.prev = slot.next = &slot;
+        tick_tsc = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S * TIMER_WHEEL_TICK_US;
+        start_tsc = rte_get_tsc_cycles();
+        now = 0;
+        nb_timers = 0;
+    }
+
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel &operator=(const TimerWheel &) = delete;
+
+    // 启动`timer`，`delay_us`微秒之后到期，已经启动的定时器会被重新设置
+    void Schedule(Timer *timer, uint64_t delay_us)
+    {
+        if (timer->Pending())
+            Unlink(timer);
+        // 至少等到下一个tick，避免在`Advance`的回调中启动的定时器被立即触发
+        const uint64_t ticks = (delay_us + TIMER_WHEEL_TICK_US - 1) / TIMER_WHEEL_TICK_US;
+        timer->expire = now + RTE_MIN(RTE_MAX(ticks, (uint64_t)1), MAX_TICKS);
+        Place(timer);
+        nb_timers++;
+    }
+
+    void Cancel(Timer *timer)
+    {
+        if (timer->Pending())
+            Unlink(timer);
+    }
+
+    // 处理所有在`now_tsc`之前到期的定时器
+    void Advance(uint64_t now_tsc)
+    {
+        const uint64_t target = (now_tsc - start_tsc) / tick_tsc;
+        while (now <= target)
+        {
+            if (nb_timers == 0)
+            {
+                // 没有定时器时直接跳到目标时间，所有的槽都是空的，不需要cascade
+                now = target + 1;
+                break;
+            }
+
+            const uint32_t index = now & MASK;
+            // 第0层转完一圈，把上一层的定时器分配下来，上一层也转完一圈的话继续往上
+            for (int level = 1; level < TIMER_WHEEL_LEVELS; level++)
+            {
+                if (index != 0 || Cascade(level, (now >> (TIMER_WHEEL_LEVEL_BITS * level)) & MASK) != 0)
+                    break;
+            }
+
+            // 先把到期的定时器移到一个临时链表中，回调中重新启动的定时器不会被这一轮处理
+            Timer expired;
+            Splice(&slots[0][index], &expired);
+            while (expired.next != &expired)
+            {
+                Timer *timer = expired.next;
+                Unlink(timer);
+                timer->callback(timer, timer->arg);
+            }
+            now++;
+        }
+    }
+
+private:
+    // 根据到期时间把定时器放到对应层的槽中
+    void Place(Timer *timer)
+    {
+        const uint64_t delta = timer->expire > now ? timer->expire - now : 0;
+        int level = 0;
+        while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMER_WHEEL_LEVEL_BITS * (level + 1))))
+            level++;
+        const uint64_t expire = timer->expire > now ? timer->expire : now;
+        Timer *head = &slots[level][(expire >> (TIMER_WHEEL_LEVEL_BITS * level)) & MASK];
+        timer->prev = head->prev;
+        timer->next = head;
+        head->prev->next = timer;
+        head->prev = timer;
+    }
+
+    // 把第`level`层第`index`个槽中的定时器重新放到下面的层，返回`index`
+    uint32_t Cascade(int level, uint32_t index)
+    {
+        Timer list;
+        Splice(&slots[level][index], &list);
+        while (list.next != &list)
+        {
+            Timer *timer = list.next;
+            list.next = timer->next;
+            timer->next->prev = &list;
+            Place(timer);
+        }
+        return index;
+    }
+
+    // 把`from`链表中的所有定时器移到空链表`to`中
+    static void Splice(Timer *from, Timer *to)
+    {
+        if (from->next == from)
+        {
+            to->prev = to->next = to;
+            return;
+        }
+        to->next = from->next;
+        to->prev = from->prev;
+        to->next->prev = to;
+        to->prev->next = to;
+        from->prev = from->next = from;
+    }
+
+    void Unlink(Timer *timer)
+    {
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        timer->prev = timer->next = nullptr;
+        nb_timers--;
+    }
+};
+
+#endif // __TIMER_WHEEL_H__
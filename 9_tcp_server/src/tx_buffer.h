@@ -0,0 +1,153 @@
+// 发送缓冲区：每个TX队列一个，Task把要发送的数据包放进来，
+// 攒够`MAX_PKT_BURST`个、处理完一批收到的数据包或者超过`TX_DRAIN_US`之后再一次性调用`rte_eth_tx_burst`。
+// 网卡不支持的checksum offload在放入缓冲区时用软件补上，网卡不支持TSO时大报文段在这里用`rte_gso`切分
+
+#ifndef __TX_BUFFER_H__
+#define __TX_BUFFER_H__
+
+#include "configs.h"
+#include "checksum.h"
+
+#include <rte_gso.h>
+
+#include <rte_ethdev.h>
+#include <rte_malloc.h>
+#include <rte_cycles.h>
+#include <rte_debug.h>
+
+class TxBuffer
+{
+public:
+    struct Stats
+    {
+        uint64_t sent;    // 成功交给网卡的数据包
+        uint64_t retried; // 第一次没有发送成功、重试之后发送成功的数据包
+        uint64_t dropped; // 重试之后依然失败被丢弃的数据包
+        uint64_t gso_segments; // GSO切分出来的数据包
+    };
+
+private:
+    uint16_t port;
+    uint16_t queue_id;
+    uint64_t tx_offloads; // 网卡开启了的TX offload
+    struct rte_eth_dev_tx_buffer *buffer;
+    struct rte_gso_ctx gso_ctx;
+
+    uint64_t drain_tsc;      // 超过这么多个cycle没有flush过就强制flush
+    uint64_t last_flush_tsc; // 上一次flush的时间
+
+    Stats stats;
+
+public:
+    TxBuffer(uint16_t port, uint16_t queue_id, uint64_t tx_offloads, struct rte_mempool *pool, int socket_id)
+        : port(port), queue_id(queue_id), tx_offloads(tx_offloads)
+    {
+        buffer = (struct rte_eth_dev_tx_buffer *)rte_zmalloc_socket("tx_buffer", RTE_ETH_TX_BUFFER_SIZE(MAX_PKT_BURST), 0, socket_id);
+        if (!buffer)
+            rte_exit(EXIT_FAILURE, "Cannot allocate tx buffer for queue %u\n", queue_id);
+        rte_eth_tx_buffer_init(buffer, MAX_PKT_BURST);
+        rte_eth_tx_buffer_set_err_callback(buffer, OnTxError, this);
+
+        // 切分出来的数据包包头复制到新的mbuf中，负载是引用原数据的indirect mbuf
+        memset(&gso_ctx, 0, sizeof(gso_ctx));
+        gso_ctx.direct_pool = pool;
+        gso_ctx.indirect_pool = pool;
+        gso_ctx.gso_types = RTE_ETH_TX_OFFLOAD_TCP_TSO;
+
+        drain_tsc = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S * TX_DRAIN_US;
+        last_flush_tsc = rte_get_tsc_cycles();
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    ~TxBuffer()
+    {
+        Flush();
+        rte_free(buffer);
+    }
+
+    TxBuffer(const TxBuffer &) = delete;
+    TxBuffer &operator=(const TxBuffer &) = delete;
+
+    // 把`pkt`放入发送缓冲区，之后`pkt`归发送缓冲区所有，调用者不能再使用或释放它
+    void Send(struct rte_mbuf *pkt)
+    {
+        if (unlikely((pkt->ol_flags & RTE_MBUF_F_TX_TCP_SEG) && !(tx_offloads & RTE_ETH_TX_OFFLOAD_TCP_TSO)))
+        {
+            SendGSO(pkt);
+            return;
+        }
+        Checksum::SoftwareTxOffload(pkt, tx_offloads);
+        stats.sent += rte_eth_tx_buffer(port, queue_id, buffer, pkt);
+    }
+
+    // 把缓冲区中所有的数据包交给网卡
+    void Flush()
+    {
+        stats.sent += rte_eth_tx_buffer_flush(port, queue_id, buffer);
+        last_flush_tsc = rte_get_tsc_cycles();
+    }
+
+    // 距离上一次flush超过`TX_DRAIN_US`时flush
+    void MaybeFlush(uint64_t now_tsc)
+    {
+        if (now_tsc - last_flush_tsc >= drain_tsc)
+            Flush();
+    }
+
+    const Stats &GetStats() const { return stats; }
+
+private:
+    // 把TSO报文段切分成`tso_segsz`字节的TCP数据段。切分之后不再是TSO报文段，伪首部的checksum要包括长度，需要重新计算
+    void SendGSO(struct rte_mbuf *pkt)
+    {
+        struct rte_mbuf *segs[TX_GSO_MAX_SEGS];
+        gso_ctx.gso_size = pkt->l2_len + pkt->l3_len + pkt->l4_len + pkt->tso_segsz;
+        int nb_segs = rte_gso_segment(pkt, &gso_ctx, segs, RTE_DIM(segs));
+        if (nb_segs < 0)
+        {
+            stats.dropped++;
+            rte_pktmbuf_free(pkt);
+            return;
+        }
+        if (nb_segs == 0)
+        {
+            // 不需要切分，`TCP_SEG`标志已经被清除
+            segs[nb_segs++] = pkt;
+        }
+        else
+        {
+            // 切分出来的数据包引用了`pkt`中的数据，这里只是减少引用计数
+            rte_pktmbuf_free(pkt);
+            stats.gso_segments += nb_segs;
+        }
+
+        for (int i = 0; i < nb_segs; i++)
+        {
+            struct rte_mbuf *seg = segs[i];
+            struct rte_ipv4_hdr *ip_hdr = rte_pktmbuf_mtod_offset(seg, struct rte_ipv4_hdr *, seg->l2_len);
+            struct rte_tcp_hdr *tcp_hdr = (struct rte_tcp_hdr *)((uint8_t *)ip_hdr + seg->l3_len);
+            ip_hdr->hdr_checksum = 0;
+            tcp_hdr->cksum = rte_ipv4_phdr_cksum(ip_hdr, seg->ol_flags);
+            Checksum::SoftwareTxOffload(seg, tx_offloads);
+            stats.sent += rte_eth_tx_buffer(port, queue_id, buffer, seg);
+        }
+    }
+
+    // TX ring满了时`rte_eth_tx_buffer`会把没有发出去的数据包交给这个回调，重试几次之后依然失败就丢弃
+    static void OnTxError(struct rte_mbuf **unsent, uint16_t count, void *userdata)
+    {
+        TxBuffer *self = static_cast<TxBuffer *>(userdata);
+        uint16_t sent = 0;
+        for (int retry = 0; retry < TX_RETRY_TIMES && sent < count; retry++)
+        {
+            sent += rte_eth_tx_burst(self->port, self->queue_id, unsent + sent, count - sent);
+        }
+        self->stats.sent += sent;
+        self->stats.retried += sent;
+        self->stats.dropped += count - sent;
+        for (uint16_t i = sent; i < count; i++)
+            rte_pktmbuf_free(unsent[i]);
+    }
+};
+
+#endif // __TX_BUFFER_H__
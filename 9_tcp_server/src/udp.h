@@ -0,0 +1,172 @@
+// UDP协议相关的通用工具：收发数据报的描述符，以及一个端口在协议栈lcore和应用lcore之间的收发队列。
+// 收到的数据报不复制，描述符直接指向收包mbuf中的负载；发送时应用把数据写在mbuf中，协议栈在前面预留的空间中填写包头，也不复制。
+
+#ifndef __UDP_H__
+#define __UDP_H__
+
+#include "configs.h"
+
+#include <cstdint>
+#include <cstdio>
+
+#include <rte_byteorder.h>
+#include <rte_common.h>
+#include <rte_debug.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+#include <rte_udp.h>
+
+// 以太网+IPv4(不带Option)+UDP包头的长度，要发送的mbuf前面至少要留出这么多headroom
+#define UDP_HEADERS_LEN (sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr))
+
+// 收到的一个数据报，`data`指向`mbuf`中的负载，负载超出第一个segment时(巨帧)剩下的部分在mbuf链后面的segment中。
+// 处理完之后释放`mbuf`(`UDPRing::Release`，或者`UDPApplication::OnReceive`返回之后由协议栈释放)
+struct UDPDatagram
+{
+    struct rte_mbuf *mbuf;
+    rte_be32_t remote_ip;
+    rte_be16_t remote_port;
+    rte_be16_t local_port;
+    const uint8_t *data;
+    uint32_t length;
+};
+
+// 要发送的一个数据报，`mbuf`中只有负载(可以是mbuf链)，前面要留出`UDP_HEADERS_LEN`字节的headroom
+struct UDPMessage
+{
+    rte_be32_t remote_ip;
+    rte_be16_t remote_port;
+    struct rte_mbuf *mbuf;
+};
+
+// 根据协议栈收包时填写的`l2_len`/`l3_len`找到UDP包头，填写`dgram`
+static inline void UDPDatagramFromMbuf(struct rte_mbuf *pkt, UDPDatagram *dgram)
+{
+    const struct rte_ipv4_hdr *ip_hdr = rte_pktmbuf_mtod_offset(pkt, const struct rte_ipv4_hdr *, pkt->l2_len);
+    const struct rte_udp_hdr *udp_hdr = (const struct rte_udp_hdr *)((const uint8_t *)ip_hdr + pkt->l3_len);
+    dgram->mbuf = pkt;
+    dgram->remote_ip = ip_hdr->src_addr;
+    dgram->remote_port = udp_hdr->src_port;
+    dgram->local_port = udp_hdr->dst_port;
+    dgram->data = (const uint8_t *)(udp_hdr + 1);
+    dgram->length = rte_be_to_cpu_16(udp_hdr->dgram_len) - sizeof(*udp_hdr);
+}
+
+// 在`pkt`前面预留包头的空间，先写上目的地址和端口，其余字段由协议栈的`UDPSocket`从包头模板填写。headroom不够时返回false
+static inline bool UDPReserveHeaders(struct rte_mbuf *pkt, rte_be32_t remote_ip, rte_be16_t remote_port)
+{
+    uint8_t *data = (uint8_t *)rte_pktmbuf_prepend(pkt, UDP_HEADERS_LEN);
+    if (unlikely(!data))
+        return false;
+    struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *)(data + sizeof(struct rte_ether_hdr));
+    struct rte_udp_hdr *udp_hdr = (struct rte_udp_hdr *)(ip_hdr + 1);
+    ip_hdr->dst_addr = remote_ip;
+    udp_hdr->dst_port = remote_port;
+    return true;
+}
+
+// 一个UDP端口在协议栈lcore和应用lcore之间的队列：每个协议栈lcore上绑定这个端口的`UDPSocket`把收到的数据报放入`rx`，
+// 由应用lcore(没有分配网卡队列的lcore)批量取出；应用lcore把要发送的数据报放入`tx`，由协议栈lcore取出发送。
+// 两个方向都只传递mbuf指针，描述符由取出的一方根据mbuf填写。所有lcore共享，在启动worker lcore之前创建
+class UDPRing
+{
+    struct rte_ring *rx;
+    struct rte_ring *tx;
+
+public:
+    // `size`必须是2的幂。默认多生产者多消费者，只有一个应用lcore时可以传入`RING_F_SC_DEQ`。
+    // 一个端口有多个`UDPRing`(每个应用lcore一个，见`UDPSocket`的`reuse_port`)时用`index`区分
+    UDPRing(uint16_t port, uint16_t index = 0, unsigned size = UDP_RING_SIZE, unsigned rx_flags = 0, int socket_id = SOCKET_ID_ANY)
+    {
+        char name[RTE_RING_NAMESIZE];
+        snprintf(name, sizeof(name), "udp_rx_%u_%u", port, index);
+        rx = rte_ring_create(name, size, socket_id, rx_flags);
+        if (!rx)
+            rte_exit(EXIT_FAILURE, "Cannot create %s\n", name);
+        snprintf(name, sizeof(name), "udp_tx_%u_%u", port, index);
+        tx = rte_ring_create(name, size, socket_id, 0);
+        if (!tx)
+            rte_exit(EXIT_FAILURE, "Cannot create %s\n", name);
+    }
+
+    ~UDPRing()
+    {
+        struct rte_mbuf *pkts[MAX_PKT_BURST];
+        unsigned n;
+        while ((n = rte_ring_dequeue_burst(rx, (void **)pkts, MAX_PKT_BURST, nullptr)) > 0)
+            rte_pktmbuf_free_bulk(pkts, n);
+        while ((n = rte_ring_dequeue_burst(tx, (void **)pkts, MAX_PKT_BURST, nullptr)) > 0)
+            rte_pktmbuf_free_bulk(pkts, n);
+        rte_ring_free(rx);
+        rte_ring_free(tx);
+    }
+
+    UDPRing(const UDPRing &) = delete;
+    UDPRing &operator=(const UDPRing &) = delete;
+
+    /* 应用lcore调用 */
+
+    // 最多取出`n`个收到的数据报，返回取出的数量
+    uint16_t Recv(UDPDatagram *dgrams, uint16_t n)
+    {
+        struct rte_mbuf *pkts[MAX_PKT_BURST];
+        uint16_t nb = 0;
+        while (nb < n)
+        {
+            const unsigned got = rte_ring_dequeue_burst(rx, (void **)pkts, RTE_MIN((uint16_t)(n - nb), (uint16_t)MAX_PKT_BURST), nullptr);
+            for (unsigned i = 0; i < got; i++)
+                UDPDatagramFromMbuf(pkts[i], &dgrams[nb + i]);
+            nb += got;
+            if (got < MAX_PKT_BURST)
+                break;
+        }
+        return nb;
+    }
+
+    // 释放`Recv`得到的数据报(没有交给`Send`的)
+    static void Release(UDPDatagram *dgrams, uint16_t n)
+    {
+        for (uint16_t i = 0; i < n; i++)
+        {
+            if (dgrams[i].mbuf)
+                rte_pktmbuf_free(dgrams[i].mbuf);
+        }
+    }
+
+    // 类似`sendmmsg`：把`msgs`依次放入发送队列，返回放入的数量，之后的mbuf(队列满或者headroom不够)仍然归调用者所有
+    uint16_t Send(const UDPMessage *msgs, uint16_t n)
+    {
+        struct rte_mbuf *pkts[MAX_PKT_BURST];
+        uint16_t nb = 0;
+        while (nb < n)
+        {
+            const uint16_t batch = RTE_MIN((uint16_t)(n - nb), (uint16_t)MAX_PKT_BURST);
+            uint16_t nb_ready = 0;
+            while (nb_ready < batch && UDPReserveHeaders(msgs[nb + nb_ready].mbuf, msgs[nb + nb_ready].remote_ip, msgs[nb + nb_ready].remote_port))
+            {
+                pkts[nb_ready] = msgs[nb + nb_ready].mbuf;
+                nb_ready++;
+            }
+            const unsigned sent = rte_ring_enqueue_burst(tx, (void **)pkts, nb_ready, nullptr);
+            // 没有放入队列的mbuf去掉预留的包头，还给调用者
+            for (unsigned i = sent; i < nb_ready; i++)
+                rte_pktmbuf_adj(pkts[i], UDP_HEADERS_LEN);
+            nb += sent;
+            if (sent < batch)
+                break;
+        }
+        return nb;
+    }
+
+    /* 协议栈lcore调用 */
+
+    // 把收到的数据报放入接收队列，返回放入的数量，其余的由调用者释放
+    uint16_t Deliver(struct rte_mbuf **pkts, uint16_t n) { return rte_ring_enqueue_burst(rx, (void **)pkts, n, nullptr); }
+
+    // 取出应用要发送的数据报，包头空间已经预留好
+    uint16_t Collect(struct rte_mbuf **pkts, uint16_t n) { return rte_ring_dequeue_burst(tx, (void **)pkts, n, nullptr); }
+};
+
+#endif // __UDP_H__